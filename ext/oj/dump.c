@@ -98,9 +98,6 @@ static void	dump_obj_attrs(VALUE obj, VALUE clas, slot_t id, int depth, Out out)
 static void	dump_odd(VALUE obj, Odd odd, VALUE clas, int depth, Out out);
 
 static void	grow(Out out, size_t len);
-static size_t	hibit_friendly_size(const uint8_t *str, size_t len);
-static size_t	xss_friendly_size(const uint8_t *str, size_t len);
-static size_t	ascii_friendly_size(const uint8_t *str, size_t len);
 
 static void	dump_leaf(Leaf leaf, int depth, Out out);
 static void	dump_leaf_str(Leaf leaf, Out out);
@@ -156,44 +153,57 @@ static char	xss_friendly_chars[256] = "\
 33333333333333333333333333333333\
 33333333333333333333333333333333";
 
-inline static size_t
-newline_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
+#define ONES	0x0101010101010101ULL
+#define HIGHS	0x8080808080808080ULL
 
-    for (; 0 < len; str++, len--) {
-	size += newline_friendly_chars[*str];
-    }
-    return size - len * (size_t)'0';
-}
+// Non-zero if any byte in w is less than n, n must be 128 or less.
+#define HAS_LESS(w, n)	(((w) - ONES * (n)) & ~(w) & HIGHS)
+#define HAS_BYTE(w, c)	HAS_LESS((w) ^ (ONES * (c)), 1)
 
-inline static size_t
-hibit_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-
-    for (; 0 < len; str++, len--) {
-	size += hibit_friendly_chars[*str];
+// True if none of the 8 bytes in w can need escaping in the mode. It may be
+// false for a word that needs no escapes, such as a newline in NLEsc mode.
+inline static int
+clean_word(uint64_t w, char mode) {
+    if (HAS_LESS(w, 0x20) || HAS_BYTE(w, '"') || HAS_BYTE(w, '\\')) {
+	return 0;
     }
-    return size - len * (size_t)'0';
-}
-
-inline static size_t
-ascii_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
-
-    for (; 0 < len; str++, len--) {
-	size += ascii_friendly_chars[*str];
+    switch (mode) {
+    case XSSEsc:
+	if (HAS_BYTE(w, '&') || HAS_BYTE(w, '<') || HAS_BYTE(w, '>') || HAS_BYTE(w, '/')) {
+	    return 0;
+	}
+	// fall through
+    case ASCIIEsc:
+	return !((w & HIGHS) || HAS_BYTE(w, 0x7F));
+    default:
+	return 1;
     }
-    return size - len * (size_t)'0';
 }
 
-inline static size_t
-xss_friendly_size(const uint8_t *str, size_t len) {
-    size_t	size = 0;
+// Returns the first character from str that is not copied as is.
+inline static const char*
+clean_end(const char *str, const char *end, const char *cmap, char mode) {
+    const char	*stop;
+    uint64_t	w;
 
-    for (; 0 < len; str++, len--) {
-	size += xss_friendly_chars[*str];
+    while (str + 8 <= end) {
+	memcpy(&w, str, 8);
+	if (clean_word(w, mode)) {
+	    str += 8;
+	    continue;
+	}
+	for (stop = str + 8; str < stop; str++) {
+	    if ('1' != cmap[(uint8_t)*str]) {
+		return str;
+	    }
+	}
     }
-    return size - len * (size_t)'0';
+    for (; str < end; str++) {
+	if ('1' != cmap[(uint8_t)*str]) {
+	    return str;
+	}
+    }
+    return end;
 }
 
 inline static void
@@ -518,31 +528,34 @@ dump_float(VALUE obj, Out out) {
     *out->cur = '\0';
 }
 
+// The longest escape is a surrogate pair, \uXXXX\uXXXX.
+#define ESCAPE_MAX	12
+
 static void
 dump_cstr(const char *str, size_t cnt, int is_sym, int escape1, Out out) {
-    size_t	size;
+    const char	*end = str + cnt;
+    const char	*clean;
     char	*cmap;
+    char	mode = out->opts->escape_mode;
 
-    switch (out->opts->escape_mode) {
+    switch (mode) {
     case NLEsc:
 	cmap = newline_friendly_chars;
-	size = newline_friendly_size((uint8_t*)str, cnt);
 	break;
     case ASCIIEsc:
 	cmap = ascii_friendly_chars;
-	size = ascii_friendly_size((uint8_t*)str, cnt);
 	break;
     case XSSEsc:
 	cmap = xss_friendly_chars;
-	size = xss_friendly_size((uint8_t*)str, cnt);
 	break;
     case JSONEsc:
     default:
 	cmap = hibit_friendly_chars;
-	size = hibit_friendly_size((uint8_t*)str, cnt);
     }
-    if (out->end - out->cur <= (long)size + BUFFER_EXTRA) { // extra 10 for escaped first char, quotes, and sym
-	grow(out, size + BUFFER_EXTRA);
+    // Most strings need no escapes so room is made for the string as is and
+    // the buffer only grows again if an escape needs more.
+    if (out->end - out->cur <= (long)cnt + BUFFER_EXTRA) { // extra 10 for escaped first char, quotes, and sym
+	grow(out, cnt + BUFFER_EXTRA);
     }
     *out->cur++ = '"';
     if (escape1) {
@@ -551,58 +564,54 @@ dump_cstr(const char *str, size_t cnt, int is_sym, int escape1, Out out) {
 	*out->cur++ = '0';
 	*out->cur++ = '0';
 	dump_hex((uint8_t)*str, out);
-	cnt--;
-	size--;
 	str++;
 	is_sym = 0; // just to make sure
     }
-    if (cnt == size) {
-	if (is_sym) {
-	    *out->cur++ = ':';
-	}
-	for (; '\0' != *str; str++) {
-	    *out->cur++ = *str;
-	}
-	*out->cur++ = '"';
-    } else {
-	const char	*end = str + cnt;
-
-	if (is_sym) {
-	    *out->cur++ = ':';
-	}
-	for (; str < end; str++) {
-	    switch (cmap[(uint8_t)*str]) {
-	    case '1':
-		*out->cur++ = *str;
-		break;
-	    case '2':
-		*out->cur++ = '\\';
-		switch (*str) {
-		case '\\':	*out->cur++ = '\\';	break;
-		case '\b':	*out->cur++ = 'b';	break;
-		case '\t':	*out->cur++ = 't';	break;
-		case '\n':	*out->cur++ = 'n';	break;
-		case '\f':	*out->cur++ = 'f';	break;
-		case '\r':	*out->cur++ = 'r';	break;
-		default:	*out->cur++ = *str;	break;
-		}
-		break;
-	    case '3': // Unicode
-		str = dump_unicode(str, end, out);
-		break;
-	    case '6': // control characters
-		*out->cur++ = '\\';
-		*out->cur++ = 'u';
-		*out->cur++ = '0';
-		*out->cur++ = '0';
-		dump_hex((uint8_t)*str, out);
+    if (is_sym) {
+	*out->cur++ = ':';
+    }
+    while (str < end) {
+	clean = clean_end(str, end, cmap, mode);
+	if (str < clean) {
+	    memcpy(out->cur, str, clean - str);
+	    out->cur += clean - str;
+	    str = clean;
+	    if (end <= str) {
 		break;
-	    default:
-		break; // ignore, should never happen if the table is correct
 	    }
 	}
-	*out->cur++ = '"';
+	if (out->end - out->cur <= (end - str) + ESCAPE_MAX + BUFFER_EXTRA) {
+	    grow(out, (end - str) + ESCAPE_MAX + BUFFER_EXTRA);
+	}
+	switch (cmap[(uint8_t)*str]) {
+	case '2':
+	    *out->cur++ = '\\';
+	    switch (*str) {
+	    case '\\':	*out->cur++ = '\\';	break;
+	    case '\b':	*out->cur++ = 'b';	break;
+	    case '\t':	*out->cur++ = 't';	break;
+	    case '\n':	*out->cur++ = 'n';	break;
+	    case '\f':	*out->cur++ = 'f';	break;
+	    case '\r':	*out->cur++ = 'r';	break;
+	    default:	*out->cur++ = *str;	break;
+	    }
+	    break;
+	case '3': // Unicode
+	    str = dump_unicode(str, end, out);
+	    break;
+	case '6': // control characters
+	    *out->cur++ = '\\';
+	    *out->cur++ = 'u';
+	    *out->cur++ = '0';
+	    *out->cur++ = '0';
+	    dump_hex((uint8_t)*str, out);
+	    break;
+	default:
+	    break; // ignore, should never happen if the table is correct
+	}
+	str++;
     }
+    *out->cur++ = '"';
     *out->cur = '\0';
 }
 
@@ -2121,7 +2130,7 @@ static void
 dump_leaf_str(Leaf leaf, Out out) {
     switch (leaf->value_type) {
     case STR_VAL:
-	dump_cstr(leaf->str, strlen(leaf->str), 0, 0, out);
+	dump_cstr(leaf->str, oj_leaf_str_len(leaf), 0, 0, out);
 	break;
     case RUBY_VAL:
 	dump_cstr(rb_string_value_cstr(&leaf->value), RSTRING_LEN(leaf->value), 0, 0, out);
@@ -2137,7 +2146,7 @@ static void
 dump_leaf_fixnum(Leaf leaf, Out out) {
     switch (leaf->value_type) {
     case STR_VAL:
-	dump_chars(leaf->str, strlen(leaf->str), out);
+	dump_chars(leaf->str, oj_leaf_str_len(leaf), out);
 	break;
     case RUBY_VAL:
 	if (T_BIGNUM == rb_type(leaf->value)) {
@@ -2157,7 +2166,7 @@ static void
 dump_leaf_float(Leaf leaf, Out out) {
     switch (leaf->value_type) {
     case STR_VAL:
-	dump_chars(leaf->str, strlen(leaf->str), out);
+	dump_chars(leaf->str, oj_leaf_str_len(leaf), out);
 	break;
     case RUBY_VAL:
 	dump_float(leaf->value, out);
@@ -2229,7 +2238,7 @@ dump_leaf_hash(Leaf leaf, int depth, Out out) {
 		grow(out, size);
 	    }
 	    fill_indent(out, d2);
-	    dump_cstr(e->key, strlen(e->key), 0, 0, out);
+	    dump_cstr(e->key, oj_leaf_key_len(e), 0, 0, out);
 	    *out->cur++ = ':';
 	    dump_leaf(e, d2, out);
 	    if (e->next != first) {
@@ -2249,6 +2258,20 @@ dump_leaf_hash(Leaf leaf, int depth, Out out) {
 
 static void
 dump_leaf(Leaf leaf, int depth, Out out) {
+    if (0 != out->leaf_raw && COL_VAL == leaf->value_type) {
+	size_t		len;
+	const char	*raw = out->leaf_raw(out->leaf_ctx, leaf, &len);
+
+	if (0 != raw) {
+	    if (out->end - out->cur <= (long)len) {
+		grow(out, len);
+	    }
+	    memcpy(out->cur, raw, len);
+	    out->cur += len;
+	    *out->cur = '\0';
+	    return;
+	}
+    }
     switch (leaf->rtype) {
     case T_NIL:
 	dump_nil(out);
@@ -2281,7 +2304,7 @@ dump_leaf(Leaf leaf, int depth, Out out) {
 }
 
 void
-oj_dump_leaf_to_json(Leaf leaf, Options copts, Out out) {
+oj_dump_leaf_to_json(Leaf leaf, Options copts, Out out, LeafRaw raw, void *ctx) {
     if (0 == out->buf) {
 	out->buf = ALLOC_N(char, 4096);
 	out->end = out->buf + 4095 - BUFFER_EXTRA; // 1 less than end plus extra for possible errors
@@ -2292,11 +2315,13 @@ oj_dump_leaf_to_json(Leaf leaf, Options copts, Out out) {
     out->opts = copts;
     out->hash_cnt = 0;
     out->indent = copts->indent;
+    out->leaf_raw = raw;
+    out->leaf_ctx = ctx;
     dump_leaf(leaf, 0, out);
 }
 
 void
-oj_write_leaf_to_file(Leaf leaf, const char *path, Options copts) {
+oj_write_leaf_to_file(Leaf leaf, const char *path, Options copts, LeafRaw raw, void *ctx) {
     char	buf[4096];
     struct _Out out;
     size_t	size;
@@ -2305,7 +2330,7 @@ oj_write_leaf_to_file(Leaf leaf, const char *path, Options copts) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - BUFFER_EXTRA;
     out.allocated = 0;
-    oj_dump_leaf_to_json(leaf, copts, &out);
+    oj_dump_leaf_to_json(leaf, copts, &out, raw, ctx);
     size = out.cur - out.buf;
     if (0 == (f = fopen(path, "w"))) {
 	rb_raise(rb_eIOError, "%s\n", strerror(errno));
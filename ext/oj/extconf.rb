@@ -34,6 +34,10 @@ dflags = {
   'USE_RB_MUTEX' => (is_windows && !('1' == version[0] && '8' == version[1])) ? 1 : 0,
   'DATETIME_1_8' => ('ruby' == type && ('1' == version[0] && '8' == version[1])) ? 1 : 0,
   'NO_TIME_ROUND_PAD' => ('rubinius' == type) ? 1 : 0,
+  'HAS_ZLIB' => (have_header('zlib.h') && have_library('z', 'inflateInit2_')) ? 1 : 0,
+  'HAS_MMAP' => (!is_windows && have_func('mmap', 'sys/mman.h')) ? 1 : 0,
+  'HAS_STAT_MTIM' => have_struct_member('struct stat', 'st_mtim', 'sys/stat.h') ? 1 : 0,
+  'HAS_STAT_MTIMESPEC' => have_struct_member('struct stat', 'st_mtimespec', 'sys/stat.h') ? 1 : 0,
 }
 # This is a monster hack to get around issues with 1.9.3-p0 on CentOS 5.4. SO
 # some reason math.h and string.h contents are not processed. Might be a
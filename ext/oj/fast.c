@@ -36,15 +36,39 @@
 #include <string.h>
 #include <math.h>
 #include <errno.h>
+#include <stddef.h>
+#if USE_PTHREAD_MUTEX
+#include <pthread.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#if HAS_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "oj.h"
 #include "encode.h"
+#include "reader.h"
 
 // maximum to allocate on the stack, arbitrary limit
 #define SMALL_XML	65536
 #define MAX_STACK	100
-//#define BATCH_SIZE	(4096 / sizeof(struct _Leaf) - 1)
-#define BATCH_SIZE	100
+// Leaves are allocated in page sized batches unless overridden at build time.
+#ifndef BATCH_SIZE
+#define BATCH_SIZE	((4096 - 2 * sizeof(void*)) / sizeof(struct _Leaf))
+#endif
+// maximum number of free batches and docs kept for reuse
+#define BATCH_POOL_MAX	64
+#define DOC_POOL_MAX	8
+// containers with fewer children are searched linearly
+#define INDEX_MIN	16
+// compact containers with at least this much text are dumped from the text
+#define RAW_MIN		256
+// size of the blocks Doc text is allocated from
+#define TEXT_BLOCK	4096
+// least amount read from an IO before parsing continues
+#define IO_CHUNK	65536
 
 typedef struct _Batch {
     struct _Batch	*next;
@@ -52,22 +76,244 @@ typedef struct _Batch {
     struct _Leaf	leaves[BATCH_SIZE];
 } *Batch;
 
-typedef struct _Doc {
-    Leaf		data;
+// Child index for a container. Arrays hold the elements in order and mask is
+// the element count while objects use an open addressed table of mask + 1
+// slots keyed by key_hash().
+typedef struct _ChildIndex {
+    Leaf		*slots;
+    size_t		mask;
+} *ChildIndex;
+
+// Tape entry for a container parsed with the :tape option. Entries are in
+// the order the containers start so the entries for the containers inside
+// one follow it and after is the entry of the next container not inside it.
+typedef struct _Jump {
+    uint32_t		start;	// offset of the container in the text
+    uint32_t		end;	// offset just past the container
+    uint32_t		after;
+    uint32_t		cnt;	// values in the container including itself
+} *Jump;
+
+// set in cnt when nothing in the container dumps differently
+#define JUMP_PLAIN	0x80000000
+// texts longer than this are always built completely
+#define TAPE_MAX	0x7FFFFFFF
+
+// Location of a container in the unmodified text.
+typedef struct _Span {
+    size_t		off;
+    size_t		len;
+} *Span;
+
+// Allocated text for the keys of members added by edits and for strings with
+// escapes when the text is parsed in place.
+typedef struct _Text {
+    struct _Text	*next;
+    size_t		len;	// bytes used
+    size_t		cap;
+    char		str[1];
+} *Text;
+
+// A location in a Doc. The Doc has one and each Cursor has its own.
+typedef struct _Where {
     Leaf		*where;	     // points to current location
     Leaf		where_path[MAX_STACK]; // points to head of path
+} *Where;
+
+// Identifies the version of a file an index was written for. The size,
+// modification time, and inode are cheap to check on every open. The hash
+// of the text is only computed when asked for.
+typedef struct _FileStamp {
+    int64_t	size;	    // size of the file or -1 if not a file
+    int64_t	mtime;	    // modification time in nanoseconds
+    uint64_t	ino;
+    uint64_t	hash;	    // text_hash() of the file or 0 if not computed
+} *FileStamp;
+
+typedef struct _Doc {
+    Leaf		data;
+    struct _Where	loc;
     char		*json;
     unsigned long	size;	     // number of leaves/branches in the doc
     VALUE		self;
     Batch		batches;
+    st_table		*indexes;    // container Leaf to ChildIndex
+    size_t		mapped;	     // length of the json mapping, 0 if allocated
+    char		*text;	     // start of the text leaves point into
+    size_t		tlen;	     // length of text including the terminator
+    struct _FileStamp	stamp;	     // the file opened, size is -1 if not a file
+    int			edited;	     // set, delete, or insert changed the tree
+    st_table		*frozen;     // container Leaf to memoized frozen Array or Hash
+    int			memoize;     // freeze and keep containers once built
+    st_table		*keep;	     // Leaf to the Ruby value it holds
+    struct _Text	*texts;	     // keys added by edits
+    st_table		*spans;	     // container Leaf to Span in the original text
+    VALUE		orig_str;    // frozen String the text was copied from
+    char		*orig;	     // read only mapping of the file or 0
+    size_t		orig_mapped;
+    Jump		tape;	     // containers of a :tape Doc
+    uint32_t		tape_cnt;
+    uint32_t		tape_cap;
     struct _Batch	batch0;
 } *Doc;
 
+// Batches and docs released by a closed Doc are kept on free lists so that
+// opening and closing short lived documents does not go back to malloc.
+static Batch		batch_pool = 0;
+static int		batch_pool_cnt = 0;
+static Doc		doc_pool = 0;
+static int		doc_pool_cnt = 0;
+#if USE_PTHREAD_MUTEX
+static pthread_mutex_t	pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+typedef enum {
+    STEP_KEY	= 'k',
+    STEP_INDEX	= 'i',
+    STEP_UP	= 'u',
+    // only in queries
+    STEP_ANY	= '*',
+    STEP_DESCEND= 'd',
+    STEP_SLICE	= 's',
+    STEP_FILTER	= 'f',
+} StepType;
+
+typedef struct _PathStep {
+    const char	*key;	// not terminated, use klen
+    size_t	klen;
+    size_t	index;	// only set for STEP_INDEX
+    uint32_t	hash;	// key_hash() of the key
+    char	type;	// StepType
+} *PathStep;
+
+// A path compiled into steps. Temporary paths point into the caller's String
+// while the paths wrapped by Oj::Doc::Path own a copy.
+typedef struct _Path {
+    PathStep	steps;
+    PathStep	end;
+    const char	*str;
+    int		absolute;
+} *Path;
+
+// A step in a query. Key, index and up steps are the same as in a path.
+typedef struct _QStep {
+    struct _PathStep	step;
+    long		first;	// slice bounds, 1 based and negative from the end
+    long		last;
+    struct _Path	rel;	// filter path from each member to the value compared
+    char		op;	// filter comparison or 0 to only check the path exists
+    char		ltype;	// filter literal T_FLOAT, T_STRING, T_TRUE, T_FALSE, or T_NIL
+    double		num;
+    const char		*str;
+    size_t		slen;
+} *QStep;
+
+typedef struct _Query {
+    Doc		doc;
+    QStep	end;
+    void	(*match)(struct _Query *q, Leaf leaf);
+    void	*ctx;	// for the match function
+    VALUE	result;	// Array of matches or Qnil if yielding
+} *Query;
+
+// Running totals for the aggregate functions. The integer sum is isum plus
+// ibig which holds the part that has overflowed 64 bits.
+typedef struct _Agg {
+    long	total;	// all matches
+    long	cnt;	// numbers
+    int64_t	isum;
+    VALUE	ibig;
+    double	fsum;
+    int		has_float;
+    Leaf	min;
+    Leaf	max;
+    double	minv;
+    double	maxv;
+} *Agg;
+
+// State carried between the paths of a fetch_many() or fetch_hash() call so
+// the leading key and index steps a path shares with the previous path are
+// not looked up again. The prefix holds the leaf reached by each of the
+// leading steps of the previous path.
+typedef struct _Shared {
+    Doc			doc;
+    Path		prev;
+    size_t		cnt;	// valid entries in prefix
+    Leaf		prefix[MAX_STACK];
+    struct _Path	tmp[2];
+    struct _PathStep	steps[2][MAX_STACK];
+    int			cur;	// tmp and steps in use by the current path
+    VALUE		dflt;
+    VALUE		result;
+} *Shared;
+
+// Header of an index file written by Oj::Doc#save_index(). It is followed by
+// one IndexLeaf per leaf in document order, a container first and then each
+// of its members, and then by the text the leaves point into. All offsets are
+// from the start of that text so the file can be mapped anywhere.
+typedef struct _IndexHead {
+    char	magic[8];
+    uint32_t	order;	    // INDEX_ORDER as written, catches a byte order change
+    uint32_t	rec_size;   // sizeof(struct _IndexLeaf)
+    struct _FileStamp	stamp;	    // the JSON file indexed
+    uint64_t	cnt;	    // number of IndexLeaf records
+    uint64_t	tlen;	    // length of the text
+} *IndexHead;
+
+typedef struct _IndexLeaf {
+    uint64_t	str;	    // text offset of the value or member count of a container
+    uint64_t	key;	    // text offset of the key plus one, or 0, shifted over the rtype
+} *IndexLeaf;
+
+#define INDEX_MAGIC	"OjDocIx3"
+#define INDEX_ORDER	0x01020304
+
+// Text read from an IO by Oj::Doc.open_io(). Leaves point into the text so
+// it is kept in chunks that never move. Parsing only goes as far as the last
+// structural character outside of a string or comment, where a '\0' is
+// written, so a chunk never ends in the middle of a value. When the parser
+// reaches that point the rest of the chunk is carried over to a new one along
+// with more from the IO.
+typedef struct _IoText {
+    struct _Reader	reader;
+    Text		chunks;	    // chunks not yet handed to the Doc
+    char		*end;	    // end of the current chunk
+    char		*stop;	    // where the '\0' was written or 0 at the end
+    char		saved;	    // character at stop
+    int			eof;
+    struct _ReaderScan	scan;	    // scan state at the end of the current chunk
+} *IoText;
+
+// Where the json for a Doc comes from and how it is released.
+typedef struct _Source {
+    char	*json;	    // buffer that is freed with the Doc
+    char	*text;	    // text leaves point into
+    size_t	tlen;	    // length of text including the terminator
+    size_t	mapped;	    // length of the mapping if json is mapped
+    int		allocated;  // json was allocated and not on the stack
+    struct _FileStamp	stamp;	    // the file read, size is -1 if not a file
+    IndexHead	index;	    // index to load instead of parsing the text
+    int		memoize;
+    int		lazy;	    // parse without writing to the text
+    int		tape;	    // defer building containers, requires lazy
+    IoText	io;	    // text is read as it is parsed
+    VALUE	orig_str;   // unmodified copy of the text, see Doc
+    char	*orig;
+    size_t	orig_mapped;
+} *Source;
+
 typedef struct _ParseInfo {
     char	*str;		/* buffer being read from */
     char	*s;		/* current position in buffer */
     Doc		doc;
     void	*stack_min;
+    IndexHead	index;		/* load from an index instead of parsing */
+    char	*irregular;	/* last text that does not dump back the same */
+    int		spans;		/* record spans of compact containers */
+    int		lazy;		/* text is read only, see STR_SPAN */
+    int		tape;		/* containers are DEFERRED */
+    uint32_t	next_jump;	/* next nested container when expanding, 0 when scanning */
+    IoText	io;		/* more text can be read, see IoText */
 } *ParseInfo;
 
 static void	leaf_init(Leaf leaf, int type);
@@ -80,34 +326,60 @@ static VALUE	leaf_array_value(Doc doc, Leaf leaf);
 static VALUE	leaf_hash_value(Doc doc, Leaf leaf);
 
 static Leaf	read_next(ParseInfo pi);
-static Leaf	read_obj(ParseInfo pi);
-static Leaf	read_array(ParseInfo pi);
+static Leaf	read_obj(ParseInfo pi, Leaf h);
+static Leaf	read_array(ParseInfo pi, Leaf a);
+static Leaf	read_deferred(ParseInfo pi, int type);
+static void	leaf_expand(Doc doc, Leaf leaf);
 static Leaf	read_str(ParseInfo pi);
 static Leaf	read_num(ParseInfo pi);
 static Leaf	read_true(ParseInfo pi);
 static Leaf	read_false(ParseInfo pi);
 static Leaf	read_nil(ParseInfo pi);
 static void	next_non_white(ParseInfo pi);
-static char*	read_quoted_value(ParseInfo pi);
+static void	io_refill(ParseInfo pi);
+static char*	read_quoted_value(ParseInfo pi, int *spanp);
 static void	skip_comment(ParseInfo pi);
 
 static VALUE	protect_open_proc(VALUE x);
-static VALUE	parse_json(VALUE clas, char *json, int given, int allocated);
-static void	each_leaf(Doc doc, VALUE self);
-static int	move_step(Doc doc, const char *path, int loc);
-static Leaf	get_doc_leaf(Doc doc, const char *path);
-static Leaf	get_leaf(Leaf *stack, Leaf *lp, const char *path);
+static VALUE	parse_json(VALUE clas, Source src, int given);
+static void	src_init(Source src, char *json, size_t tlen, int allocated);
+static int	bool_opt(VALUE ropts, const char *name);
+static Leaf	index_load(ParseInfo pi);
+static void	each_leaf(Doc doc, Where w, VALUE self);
+static int	move_step(Doc doc, Where w, PathStep step, PathStep end, int loc);
+static Leaf	get_doc_leaf(Doc doc, Where w, Path path);
+static Leaf*	path_base(Doc doc, Where w, Path path, Leaf *stack);
+static Leaf	get_shared_leaf(Doc doc, Path path, Shared shared);
+static Leaf	get_leaf(Doc doc, Leaf *stack, Leaf *lp, PathStep step, PathStep end);
+static Leaf	find_child(Doc doc, Leaf leaf, PathStep step);
+static void	build_index(Doc doc, Leaf leaf);
 static void	each_value(Doc doc, Leaf leaf);
 
+static void	path_compile(Path path, const char *str, PathStep steps, size_t max);
+static Path	arg_path(VALUE rpath, Path tmp, PathStep steps);
+
 static void	doc_init(Doc doc);
 static void	doc_free(Doc doc);
-static VALUE	doc_open(VALUE clas, VALUE str);
-static VALUE	doc_open_file(VALUE clas, VALUE filename);
+static void	doc_keep(Doc doc, Leaf leaf, VALUE v);
+static VALUE	doc_open(int argc, VALUE *argv, VALUE clas);
+static VALUE	doc_open_file(int argc, VALUE *argv, VALUE clas);
+static VALUE	doc_save_index(VALUE self, VALUE filename);
 static VALUE	doc_where(VALUE self);
 static VALUE	doc_local_key(VALUE self);
 static VALUE	doc_home(VALUE self);
 static VALUE	doc_type(int argc, VALUE *argv, VALUE self);
 static VALUE	doc_fetch(int argc, VALUE *argv, VALUE self);
+static VALUE	doc_fetch_many(int argc, VALUE *argv, VALUE self);
+static VALUE	doc_fetch_hash(int argc, VALUE *argv, VALUE self);
+static VALUE	doc_query(VALUE self, VALUE rquery);
+static VALUE	doc_count(VALUE self, VALUE rquery);
+static VALUE	doc_sum(VALUE self, VALUE rquery);
+static VALUE	doc_min(VALUE self, VALUE rquery);
+static VALUE	doc_max(VALUE self, VALUE rquery);
+static VALUE	doc_avg(VALUE self, VALUE rquery);
+static VALUE	doc_set(VALUE self, VALUE rpath, VALUE value);
+static VALUE	doc_delete(VALUE self, VALUE rpath);
+static VALUE	doc_insert(VALUE self, VALUE rpath, VALUE value);
 static VALUE	doc_each_leaf(int argc, VALUE *argv, VALUE self);
 static VALUE	doc_move(VALUE self, VALUE str);
 static VALUE	doc_each_child(int argc, VALUE *argv, VALUE self);
@@ -116,6 +388,9 @@ static VALUE	doc_dump(int argc, VALUE *argv, VALUE self);
 static VALUE	doc_size(VALUE self);
 
 VALUE	oj_doc_class = 0;
+VALUE	oj_doc_path_class = 0;
+VALUE	oj_doc_cursor_class = 0;
+VALUE	oj_store_class = 0;
 
 // This is only for CentOS 5.4 with Ruby 1.9.3-p0.
 #ifdef NEEDS_STPCPY
@@ -130,7 +405,9 @@ char *stpcpy(char *dest, const char *src) {
 
 inline static void
 next_non_white(ParseInfo pi) {
-    for (; 1; pi->s++) {
+    char	*start = pi->s;
+
+    while (1) {
 	switch(*pi->s) {
 	case ' ':
 	case '\t':
@@ -141,9 +418,19 @@ next_non_white(ParseInfo pi) {
 	case '/':
 	    skip_comment(pi);
 	    break;
+	case '\0':
+	    if (0 != pi->io && pi->s == pi->io->stop) {
+		io_refill(pi);
+		continue;
+	    }
+	    // fall through
 	default:
+	    if (start != pi->s) {
+		pi->irregular = pi->s;
+	    }
 	    return;
 	}
+	pi->s++;
     }
 }
 
@@ -167,11 +454,25 @@ ulong_fill(char *s, size_t num) {
     return s;
 }
 
+inline static uint32_t
+key_hash(const char *key, size_t len) {
+    uint32_t	h = 2166136261u;
+    const char	*end = key + len;
+
+    for (; key < end; key++) {
+	h = (h ^ (uint8_t)*key) * 16777619u;
+    }
+    return h;
+}
+
 inline static void
 leaf_init(Leaf leaf, int type) {
     leaf->next = 0;
     leaf->rtype = type;
     leaf->parent_type = T_NONE;
+    leaf->indexed = NotSet;
+    leaf->span = 0;
+    leaf->key = 0;
     switch (type) {
     case T_ARRAY:
     case T_HASH:
@@ -199,15 +500,118 @@ leaf_init(Leaf leaf, int type) {
     }
 }
 
+size_t
+oj_leaf_str_len(Leaf leaf) {
+    const char	*s = leaf->str;
+
+    if (0 == (STR_SPAN & leaf->span)) {
+	return strlen(s);
+    }
+    if (T_STRING == leaf->rtype) {
+	return strchr(s, '"') - s;
+    }
+    for (; ('0' <= *s && *s <= '9') || '-' == *s || '+' == *s || '.' == *s || 'e' == *s || 'E' == *s; s++) {
+    }
+    return s - leaf->str;
+}
+
+size_t
+oj_leaf_key_len(Leaf leaf) {
+    if (KEY_SPAN & leaf->span) {
+	return strchr(leaf->key, '"') - leaf->key;
+    }
+    return strlen(leaf->key);
+}
+
+static Batch
+batch_alloc() {
+    Batch	b = 0;
+
+#if USE_PTHREAD_MUTEX
+    pthread_mutex_lock(&pool_mutex);
+#endif
+    if (0 != batch_pool) {
+	b = batch_pool;
+	batch_pool = b->next;
+	batch_pool_cnt--;
+    }
+#if USE_PTHREAD_MUTEX
+    pthread_mutex_unlock(&pool_mutex);
+#endif
+    if (0 == b) {
+	b = ALLOC(struct _Batch);
+    }
+    return b;
+}
+
+static void
+batch_release(Batch b) {
+#if USE_PTHREAD_MUTEX
+    pthread_mutex_lock(&pool_mutex);
+#endif
+    if (BATCH_POOL_MAX > batch_pool_cnt) {
+	b->next = batch_pool;
+	batch_pool = b;
+	batch_pool_cnt++;
+	b = 0;
+    }
+#if USE_PTHREAD_MUTEX
+    pthread_mutex_unlock(&pool_mutex);
+#endif
+    if (0 != b) {
+	xfree(b);
+    }
+}
+
+static Doc
+doc_alloc() {
+    Doc	doc = 0;
+
+#if USE_PTHREAD_MUTEX
+    pthread_mutex_lock(&pool_mutex);
+#endif
+    if (0 != doc_pool) {
+	doc = doc_pool;
+	doc_pool = (Doc)doc->data;
+	doc_pool_cnt--;
+    }
+#if USE_PTHREAD_MUTEX
+    pthread_mutex_unlock(&pool_mutex);
+#endif
+    if (0 == doc) {
+	doc = ALLOC(struct _Doc);
+    }
+    return doc;
+}
+
+// The data member links docs on the free list.
+static void
+doc_release(Doc doc) {
+#if USE_PTHREAD_MUTEX
+    pthread_mutex_lock(&pool_mutex);
+#endif
+    if (DOC_POOL_MAX > doc_pool_cnt) {
+	doc->data = (Leaf)doc_pool;
+	doc_pool = doc;
+	doc_pool_cnt++;
+	doc = 0;
+    }
+#if USE_PTHREAD_MUTEX
+    pthread_mutex_unlock(&pool_mutex);
+#endif
+    if (0 != doc) {
+	xfree(doc);
+    }
+}
+
 inline static Leaf
 leaf_new(Doc doc, int type) {
     Leaf	leaf;
 
     if (0 == doc->batches || BATCH_SIZE == doc->batches->next_avail) {
-	Batch	b = ALLOC(struct _Batch);
+	Batch	b = batch_alloc();
 
-	// Initializes all leaves with a NO_VAL value_type
-	memset(b, 0, sizeof(struct _Batch));
+	// leaves are set up by leaf_init() as they are handed out
 	b->next = doc->batches;
 	doc->batches = b;
 	b->next_avail = 0;
@@ -219,6 +623,16 @@ leaf_new(Doc doc, int type) {
     return leaf;
 }
 
+// Returns the last child of a container, building the children first if the
+// container was deferred.
+inline static Leaf
+leaf_elements(Doc doc, Leaf leaf) {
+    if (DEFERRED & leaf->span) {
+	leaf_expand(doc, leaf);
+    }
+    return leaf->elements;
+}
+
 inline static void
 leaf_append_element(Leaf parent, Leaf element) {
     if (0 == parent->elements) {
@@ -251,8 +665,11 @@ leaf_value(Doc doc, Leaf leaf) {
 	    leaf_float_value(leaf);
 	    break;
 	case T_STRING:
-	    leaf->value = rb_str_new2(leaf->str);
+	    leaf->value = rb_str_new(leaf->str, oj_leaf_str_len(leaf));
 	    leaf->value = oj_encode(leaf->value);
+	    if (doc->memoize) {
+		rb_obj_freeze(leaf->value);
+	    }
 	    leaf->value_type = RUBY_VAL;
 	    break;
 	case T_ARRAY:
@@ -265,6 +682,9 @@ leaf_value(Doc doc, Leaf leaf) {
 	    rb_raise(rb_const_get_at(Oj, rb_intern("Error")), "Unexpected type %02x.", leaf->rtype);
 	    break;
 	}
+	if (RUBY_VAL == leaf->value_type && !SPECIAL_CONST_P(leaf->value)) {
+	    doc_keep(doc, leaf, leaf->value);
+	}
     }
     return leaf->value;
 }
@@ -336,11 +756,17 @@ leaf_fixnum_value(Leaf leaf) {
 	}
     }
     if (big) {
-	char	c = *s;
-	
-	*s = '\0';
-	leaf->value = rb_cstr_to_inum(leaf->str, 10, 0);
-	*s = c;
+	if (STR_SPAN & leaf->span) {
+	    // conversion stops at the first non-digit so there is no need to
+	    // terminate the read only text
+	    leaf->value = rb_cstr_to_inum(leaf->str, 10, 0);
+	} else {
+	    char	c = *s;
+
+	    *s = '\0';
+	    leaf->value = rb_cstr_to_inum(leaf->str, 10, 0);
+	    *s = c;
+	}
     } else {
 	if (neg) {
 	    n = -n;
@@ -352,15 +778,54 @@ leaf_fixnum_value(Leaf leaf) {
 
 static void
 leaf_float_value(Leaf leaf) {
-    leaf->value = rb_float_new(rb_cstr_to_dbl(leaf->str, 1));
+    if (STR_SPAN & leaf->span) {
+	char	buf[64];
+	size_t	len = oj_leaf_str_len(leaf);
+
+	if (len < sizeof(buf)) {
+	    memcpy(buf, leaf->str, len);
+	    buf[len] = '\0';
+	    leaf->value = rb_float_new(rb_cstr_to_dbl(buf, 1));
+	} else {
+	    leaf->value = rb_float_new(rb_str_to_dbl(rb_str_new(leaf->str, len), 1));
+	}
+    } else {
+	leaf->value = rb_float_new(rb_cstr_to_dbl(leaf->str, 1));
+    }
     leaf->value_type = RUBY_VAL;
 }
 
+static VALUE
+memo_get(Doc doc, Leaf leaf) {
+    st_data_t	v;
+
+    if (0 != doc->frozen && st_lookup(doc->frozen, (st_data_t)leaf, &v)) {
+	return (VALUE)v;
+    }
+    return Qundef;
+}
+
+static VALUE
+memo_set(Doc doc, Leaf leaf, VALUE v) {
+    if (0 == doc->frozen) {
+	doc->frozen = st_init_numtable();
+    }
+    rb_obj_freeze(v);
+    st_insert(doc->frozen, (st_data_t)leaf, (st_data_t)v);
+
+    return v;
+}
+
 static VALUE
 leaf_array_value(Doc doc, Leaf leaf) {
-    VALUE	a = rb_ary_new();
+    VALUE	a;
 
-    if (0 != leaf->elements) {
+    if (doc->memoize && Qundef != (a = memo_get(doc, leaf))) {
+	return a;
+    }
+    a = rb_ary_new();
+
+    if (0 != leaf_elements(doc, leaf)) {
 	Leaf	first = leaf->elements->next;
 	Leaf	e = first;
 
@@ -369,25 +834,36 @@ leaf_array_value(Doc doc, Leaf leaf) {
 	    e = e->next;
 	} while (e != first);
     }
+    if (doc->memoize) {
+	memo_set(doc, leaf, a);
+    }
     return a;
 }
 
 static VALUE
 leaf_hash_value(Doc doc, Leaf leaf) {
-    VALUE	h = rb_hash_new();
+    VALUE	h;
 
-    if (0 != leaf->elements) {
+    if (doc->memoize && Qundef != (h = memo_get(doc, leaf))) {
+	return h;
+    }
+    h = rb_hash_new();
+
+    if (0 != leaf_elements(doc, leaf)) {
 	Leaf	first = leaf->elements->next;
 	Leaf	e = first;
 	VALUE	key;
 
 	do {
-	    key = rb_str_new2(e->key);
+	    key = rb_str_new(e->key, oj_leaf_key_len(e));
 	    key = oj_encode(key);
 	    rb_hash_aset(h, key, leaf_value(doc, e));
 	    e = e->next;
 	} while (e != first);
     }
+    if (doc->memoize) {
+	memo_set(doc, leaf, h);
+    }
     return h;
 }
 
@@ -401,10 +877,18 @@ read_next(ParseInfo pi) {
     next_non_white(pi);	// skip white space
     switch (*pi->s) {
     case '{':
-	leaf = read_obj(pi);
+	if (pi->tape) {
+	    leaf = read_deferred(pi, T_HASH);
+	} else {
+	    leaf = read_obj(pi, leaf_new(pi->doc, T_HASH));
+	}
 	break;
     case '[':
-	leaf = read_array(pi);
+	if (pi->tape) {
+	    leaf = read_deferred(pi, T_ARRAY);
+	} else {
+	    leaf = read_array(pi, leaf_new(pi->doc, T_ARRAY));
+	}
 	break;
     case '"':
 	leaf = read_str(pi);
@@ -441,12 +925,32 @@ read_next(ParseInfo pi) {
     return leaf;
 }
 
+// Records where a container that just ended started if nothing between there
+// and the end would be dumped differently so the text can be copied instead.
+static void
+span_add(ParseInfo pi, Leaf leaf, char *start) {
+    Doc		doc = pi->doc;
+    Span	span;
+
+    if (pi->irregular >= start || (size_t)(pi->s - start) < RAW_MIN) {
+	return;
+    }
+    if (0 == doc->spans) {
+	doc->spans = st_init_numtable();
+    }
+    span = ALLOC(struct _Span);
+    span->off = start - doc->text;
+    span->len = pi->s - start;
+    st_insert(doc->spans, (st_data_t)leaf, (st_data_t)span);
+}
+
 static Leaf
-read_obj(ParseInfo pi) {
-    Leaf	h = leaf_new(pi->doc, T_HASH);
+read_obj(ParseInfo pi, Leaf h) {
+    char	*start = pi->s;
     char	*end;
     const char	*key = 0;
     Leaf	val = 0;
+    int		span;
 
     pi->s++;
     next_non_white(pi);
@@ -458,7 +962,7 @@ read_obj(ParseInfo pi) {
 	next_non_white(pi);
 	key = 0;
 	val = 0;
-	if ('"' != *pi->s || 0 == (key = read_quoted_value(pi))) {
+	if ('"' != *pi->s || 0 == (key = read_quoted_value(pi, &span))) {
 	    raise_error("unexpected character", pi->str, pi->s);
 	}
 	next_non_white(pi);
@@ -473,12 +977,17 @@ read_obj(ParseInfo pi) {
 	}
 	end = pi->s;
 	val->key = key;
+	if (span) {
+	    val->span |= KEY_SPAN;
+	}
 	val->parent_type = T_HASH;
 	leaf_append_element(h, val);
 	next_non_white(pi);
 	if ('}' == *pi->s) {
 	    pi->s++;
-	    *end = '\0';
+	    if (!pi->lazy) {
+		*end = '\0';
+	    }
 	    break;
 	} else if (',' == *pi->s) {
 	    pi->s++;
@@ -486,15 +995,20 @@ read_obj(ParseInfo pi) {
 	    //printf("*** '%s'\n", pi->s);
 	    raise_error("invalid format, expected , or } while in an object", pi->str, pi->s);
 	}
-	*end = '\0';
+	if (!pi->lazy) {
+	    *end = '\0';
+	}
+    }
+    if (pi->spans) {
+	span_add(pi, h, start);
     }
     return h;
 }
 
 static Leaf
-read_array(ParseInfo pi) {
-    Leaf	a = leaf_new(pi->doc, T_ARRAY);
+read_array(ParseInfo pi, Leaf a) {
     Leaf	e;
+    char	*start = pi->s;
     char	*end;
     int		cnt = 0;
 
@@ -519,21 +1033,171 @@ read_array(ParseInfo pi) {
 	    pi->s++;
 	} else if (']' == *pi->s) {
 	    pi->s++;
-	    *end = '\0';
+	    if (!pi->lazy) {
+		*end = '\0';
+	    }
 	    break;
 	} else {
 	    raise_error("invalid format, expected , or ] while in an array", pi->str, pi->s);
 	}
-	*end = '\0';
+	if (!pi->lazy) {
+	    *end = '\0';
+	}
+    }
+    if (pi->spans) {
+	span_add(pi, a, start);
     }
     return a;
 }
 
+// Allocation state to roll back to once a deferred container is scanned.
+typedef struct _Mark {
+    Batch	batch;
+    int		avail;
+    Text	text;
+    size_t	tlen;
+} *Mark;
+
+static void
+mark_set(Doc doc, Mark m) {
+    m->batch = doc->batches;
+    m->avail = doc->batches->next_avail;
+    m->text = doc->texts;
+    m->tlen = (0 == doc->texts) ? 0 : doc->texts->len;
+}
+
+static void
+mark_rollback(Doc doc, Mark m) {
+    while (m->batch != doc->batches) {
+	Batch	b = doc->batches;
+
+	doc->batches = b->next;
+	batch_release(b);
+    }
+    doc->batches->next_avail = m->avail;
+    while (m->text != doc->texts) {
+	Text	t = doc->texts;
+
+	doc->texts = t->next;
+	xfree(t);
+    }
+    if (0 != doc->texts) {
+	doc->texts->len = m->tlen;
+    }
+}
+
+// With the :tape option a container only gets a leaf that refers to its
+// entry on the tape. When scanning, the container is parsed to validate it
+// and fill in the entry and then everything built for it is dropped. When
+// expanding, the entry is already there so the container is skipped.
+static Leaf
+read_deferred(ParseInfo pi, int type) {
+    Doc		doc = pi->doc;
+    char	*start = pi->s;
+    uint32_t	i;
+    Leaf	leaf;
+
+    if (0 != pi->next_jump) {
+	Jump	j = doc->tape + pi->next_jump;
+
+	if (doc->tape_cnt <= pi->next_jump || (uint32_t)(start - doc->text) != j->start) {
+	    rb_raise(rb_eStandardError, "Oj::Doc tape out of step with the text.");
+	}
+	i = pi->next_jump;
+	pi->s = doc->text + j->end;
+	pi->next_jump = j->after;
+	leaf = leaf_new(doc, type);
+    } else {
+	struct _Mark	mark;
+	unsigned long	size = doc->size;
+	Jump		j;
+	Leaf		tmp;
+
+	if (doc->tape_cap <= doc->tape_cnt) {
+	    doc->tape_cap = (0 == doc->tape_cap) ? 256 : doc->tape_cap * 2;
+	    if (0 == doc->tape) {
+		doc->tape = ALLOC_N(struct _Jump, doc->tape_cap);
+	    } else {
+		REALLOC_N(doc->tape, struct _Jump, doc->tape_cap);
+	    }
+	}
+	i = doc->tape_cnt++;
+	tmp = leaf_new(doc, type);
+	mark_set(doc, &mark);
+	if (T_HASH == type) {
+	    read_obj(pi, tmp);
+	} else {
+	    read_array(pi, tmp);
+	}
+	mark_rollback(doc, &mark);
+	j = doc->tape + i;
+	j->start = (uint32_t)(start - doc->text);
+	j->end = (uint32_t)(pi->s - doc->text);
+	j->after = doc->tape_cnt;
+	j->cnt = (uint32_t)(doc->size - size + 1);
+	if (pi->irregular < start) {
+	    j->cnt |= JUMP_PLAIN;
+	}
+	// the scratch leaf is reused for the deferred container
+	leaf = tmp;
+	leaf_init(leaf, type);
+    }
+    leaf->span = DEFERRED;
+    leaf->jump = i;
+
+    return leaf;
+}
+
+// Builds the immediate children of a DEFERRED container. Any containers in
+// it are deferred in turn.
+static void
+leaf_expand(Doc doc, Leaf leaf) {
+    struct _ParseInfo	pi;
+    uint32_t		i = (uint32_t)leaf->jump;
+    Jump		j = doc->tape + i;
+    unsigned long	size = doc->size;
+
+    pi.str = doc->text;
+    pi.s = doc->text + j->start;
+    pi.doc = doc;
+    pi.stack_min = 0; // depth was checked when the tape was made
+    pi.index = 0;
+    pi.irregular = 0;
+    pi.spans = 0;
+    pi.lazy = 1;
+    pi.tape = 1;
+    pi.io = 0;
+    pi.next_jump = i + 1;
+    leaf->span &= ~DEFERRED;
+    leaf->elements = 0;
+    if (T_HASH == leaf->rtype) {
+	read_obj(&pi, leaf);
+    } else {
+	read_array(&pi, leaf);
+    }
+    doc->size = size;
+    if ((JUMP_PLAIN & j->cnt) && RAW_MIN <= j->end - j->start) {
+	Span	span;
+
+	if (0 == doc->spans) {
+	    doc->spans = st_init_numtable();
+	}
+	span = ALLOC(struct _Span);
+	span->off = j->start;
+	span->len = j->end - j->start;
+	st_insert(doc->spans, (st_data_t)leaf, (st_data_t)span);
+    }
+}
+
 static Leaf
 read_str(ParseInfo pi) {
     Leaf	leaf = leaf_new(pi->doc, T_STRING);
+    int		span;
 
-    leaf->str = read_quoted_value(pi);
+    leaf->str = read_quoted_value(pi, &span);
+    if (span) {
+	leaf->span = STR_SPAN;
+    }
 
     return leaf;
 }
@@ -566,6 +1230,9 @@ read_num(ParseInfo pi) {
     }
     leaf = leaf_new(pi->doc, type);
     leaf->str = start;
+    if (pi->lazy) {
+	leaf->span = STR_SPAN;
+    }
 
     return leaf;
 }
@@ -664,11 +1331,33 @@ unicode_to_chars(ParseInfo pi, char *t, uint32_t code) {
     return t;
 }
 
+static char*
+text_alloc(Doc doc, size_t size) {
+    Text	t = doc->texts;
+    char	*s;
+
+    if (0 == t || t->cap - t->len < size) {
+	size_t	cap = (TEXT_BLOCK < size) ? size : TEXT_BLOCK;
+
+	t = (Text)ALLOC_N(char, sizeof(struct _Text) + cap);
+	t->len = 0;
+	t->cap = cap;
+	t->next = doc->texts;
+	doc->texts = t;
+    }
+    s = t->str + t->len;
+    t->len += size;
+
+    return s;
+}
+
 /* Assume the value starts immediately and goes until the quote character is
- * reached again. Do not read the character after the terminating quote.
+ * reached again. Do not read the character after the terminating quote. When
+ * the text is read only a value without escapes is left unterminated in place
+ * and spanp is set, otherwise the value is unescaped into Doc text.
  */
 static char*
-read_quoted_value(ParseInfo pi) {
+read_quoted_value(ParseInfo pi, int *spanp) {
     char	*value = 0;
     char	*h = pi->s; // head
     char	*t = h;	    // tail
@@ -676,11 +1365,40 @@ read_quoted_value(ParseInfo pi) {
     h++;	// skip quote character
     t++;
     value = h;
+    *spanp = 0;
+    if (pi->lazy) {
+	char	*e = h;
+
+	for (; '"' != *e && '\\' != *e; e++) {
+	    if ('\0' == *e) {
+		pi->s = e;
+		raise_error("quoted string not terminated", pi->str, pi->s);
+	    } else if ((uint8_t)*e < 0x20) {
+		pi->irregular = e;
+	    }
+	}
+	if ('"' == *e) {
+	    pi->s = e + 1;
+	    *spanp = 1;
+	    return value;
+	}
+	// unescaped text is never longer than the escaped text
+	for (; '"' != *e; e++) {
+	    if ('\0' == *e) {
+		pi->s = e;
+		raise_error("quoted string not terminated", pi->str, pi->s);
+	    } else if ('\\' == *e && '\0' != e[1]) {
+		e++;
+	    }
+	}
+	value = t = text_alloc(pi->doc, e - h + 1);
+    }
     for (; '"' != *h; h++, t++) {
 	if ('\0' == *h) {
 	    pi->s = h;
 	    raise_error("quoted string not terminated", pi->str, pi->s);
 	} else if ('\\' == *h) {
+	    pi->irregular = h;
 	    h++;
 	    switch (*h) {
 	    case 'n':	*t = '\n';	break;
@@ -721,8 +1439,13 @@ read_quoted_value(ParseInfo pi) {
 		raise_error("invalid escaped character", pi->str, pi->s);
 		break;
 	    }
-	} else if (t != h) {
-	    *t = *h;
+	} else {
+	    if ((uint8_t)*h < 0x20) {
+		pi->irregular = h;
+	    }
+	    if (t != h) {
+		*t = *h;
+	    }
 	}
     }
     *t = '\0'; // terminate value
@@ -734,24 +1457,79 @@ read_quoted_value(ParseInfo pi) {
 // doc support functions
 inline static void
 doc_init(Doc doc) {
-    memset(doc, 0, sizeof(struct _Doc));
-    doc->where = doc->where_path;
+    // batch0 leaves are set up as they are used so only the header is cleared
+    memset(doc, 0, offsetof(struct _Doc, batch0));
+    doc->loc.where = doc->loc.where_path;
     doc->self = Qundef;
+    doc->orig_str = Qnil;
+    doc->batch0.next = 0;
+    doc->batch0.next_avail = 0;
     doc->batches = &doc->batch0;
 }
 
+static int
+free_index_cb(st_data_t key, st_data_t value, st_data_t arg) {
+    ChildIndex	ci = (ChildIndex)value;
+
+    xfree(ci->slots);
+    xfree(ci);
+
+    return ST_CONTINUE;
+}
+
+static int
+free_span_cb(st_data_t key, st_data_t value, st_data_t arg) {
+    xfree((Span)value);
+
+    return ST_CONTINUE;
+}
+
 static void
 doc_free(Doc doc) {
     if (0 != doc) {
 	Batch	b;
 
+	if (0 != doc->spans) {
+	    st_foreach(doc->spans, free_span_cb, 0);
+	    st_free_table(doc->spans);
+	    doc->spans = 0;
+	}
+#if HAS_MMAP
+	if (0 != doc->orig) {
+	    munmap(doc->orig, doc->orig_mapped);
+	    doc->orig = 0;
+	}
+#endif
+
+	if (0 != doc->frozen) {
+	    st_free_table(doc->frozen);
+	    doc->frozen = 0;
+	}
+	if (0 != doc->keep) {
+	    st_free_table(doc->keep);
+	    doc->keep = 0;
+	}
+	if (0 != doc->tape) {
+	    xfree(doc->tape);
+	    doc->tape = 0;
+	}
+	while (0 != doc->texts) {
+	    Text	t = doc->texts;
+
+	    doc->texts = t->next;
+	    xfree(t);
+	}
+	if (0 != doc->indexes) {
+	    st_foreach(doc->indexes, free_index_cb, 0);
+	    st_free_table(doc->indexes);
+	    doc->indexes = 0;
+	}
 	while (0 != (b = doc->batches)) {
 	    doc->batches = doc->batches->next;
 	    if (&doc->batch0 != b) {
-		xfree(b);
+		batch_release(b);
 	    }
 	}
-	//xfree(f);
     }
 }
 
@@ -759,28 +1537,82 @@ static VALUE
 protect_open_proc(VALUE x) {
     ParseInfo	pi = (ParseInfo)x;
 
-    pi->doc->data = read_next(pi); // parse
-    *pi->doc->where = pi->doc->data;
-    pi->doc->where = pi->doc->where_path;
+    if (0 == pi->index) {
+	pi->doc->data = read_next(pi); // parse
+    } else {
+	pi->doc->data = index_load(pi);
+    }
+    *pi->doc->loc.where = pi->doc->data;
+    pi->doc->loc.where = pi->doc->loc.where_path;
     if (rb_block_given_p()) {
 	return rb_yield(pi->doc->self); // caller processing
     }
     return Qnil;
 }
 
+static void
+json_free(char *json, size_t mapped) {
+#if HAS_MMAP
+    if (0 < mapped) {
+	munmap(json, mapped);
+	return;
+    }
+#endif
+    xfree(json);
+}
+
+static int
+mark_frozen_cb(st_data_t key, st_data_t value, st_data_t arg) {
+    rb_gc_mark((VALUE)value);
+
+    return ST_CONTINUE;
+}
+
+static void
+mark_doc_cb(void *x) {
+    Doc	doc = (Doc)x;
+
+    if (0 != doc) {
+	if (0 != doc->frozen) {
+	    st_foreach(doc->frozen, mark_frozen_cb, 0);
+	}
+	if (0 != doc->keep) {
+	    st_foreach(doc->keep, mark_frozen_cb, 0);
+	}
+	rb_gc_mark(doc->orig_str);
+    }
+}
+
 static void
 free_doc_cb(void *x) {
     Doc	doc = (Doc)x;
 
     if (0 != doc) {
-	xfree(doc->json);
+	json_free(doc->json, doc->mapped);
 	doc_free(doc);
     }
 }
 
+// Returns the lowest address the parser may recurse down to from top or 0 to
+// not check.
+static void*
+parse_stack_min(void *top) {
+#if IS_WINDOWS
+    return (void*)((char*)top - (512 * 1024)); // assume a 1M stack and give half to ruby
+#else
+    struct rlimit	lim;
+
+    if (0 == getrlimit(RLIMIT_STACK, &lim)) {
+	return (void*)((char*)top - (lim.rlim_cur / 4 * 3)); // let 3/4ths of the stack be used only
+    }
+    return 0; // indicates not to check stack limit
+#endif
+}
+
 static VALUE
-parse_json(VALUE clas, char *json, int given, int allocated) {
+parse_json(VALUE clas, Source src, int given) {
     struct _ParseInfo	pi;
+    char		*json = src->text;
     VALUE		result = Qnil;
     Doc			doc;
     int			ex = 0;
@@ -788,7 +1620,7 @@ parse_json(VALUE clas, char *json, int given, int allocated) {
     if (given) {
 	doc = ALLOCA_N(struct _Doc, 1);
     } else {
-	doc = ALLOC_N(struct _Doc, 1);
+	doc = doc_alloc();
     }
     /* skip UTF-8 BOM if present */
     if (0xEF == (uint8_t)*json && 0xBB == (uint8_t)json[1] && 0xBF == (uint8_t)json[2]) {
@@ -797,33 +1629,43 @@ parse_json(VALUE clas, char *json, int given, int allocated) {
 	pi.str = json;
     }
     pi.s = pi.str;
+    pi.index = src->index;
+    pi.irregular = 0;
+    pi.tape = (src->tape && 0 == src->index);
+    pi.spans = (!pi.tape && (Qnil != src->orig_str || 0 != src->orig));
+    pi.lazy = src->lazy;
+    pi.next_jump = 0;
+    pi.io = src->io;
     doc_init(doc);
-    pi.doc = doc;
-#if IS_WINDOWS
-    pi.stack_min = (void*)((char*)&pi - (512 * 1024)); // assume a 1M stack and give half to ruby
-#else
-    {
-	struct rlimit	lim;
-
-	if (0 == getrlimit(RLIMIT_STACK, &lim)) {
-	    pi.stack_min = (void*)((char*)&lim - (lim.rlim_cur / 4 * 3)); // let 3/4ths of the stack be used only
-	} else {
-	    pi.stack_min = 0; // indicates not to check stack limit
-	}
+    if (0 != src->io) {
+	// the Doc frees the chunks from here on
+	doc->texts = src->io->chunks;
+	src->io->chunks = 0;
     }
-#endif
-    // last arg is free func void* func(void*)
-    doc->self = rb_data_object_alloc(clas, doc, 0, free_doc_cb);
+    pi.doc = doc;
+    pi.stack_min = parse_stack_min(&pi);
+    // Register before allocating so a GC triggered by the registration can
+    // not collect the new object. Last arg is free func void* func(void*).
+    doc->self = Qnil;
     rb_gc_register_address(&doc->self);
-    doc->json = json;
+    doc->self = rb_data_object_alloc(clas, doc, mark_doc_cb, free_doc_cb);
+    doc->json = src->json;
+    doc->mapped = src->mapped;
+    doc->text = src->text;
+    doc->tlen = src->tlen;
+    doc->stamp = src->stamp;
+    doc->memoize = src->memoize;
+    doc->orig_str = src->orig_str;
+    doc->orig = src->orig;
+    doc->orig_mapped = src->orig_mapped;
     DATA_PTR(doc->self) = doc;
     result = rb_protect(protect_open_proc, (VALUE)&pi, &ex);
     if (given || 0 != ex) {
 	rb_gc_unregister_address(&doc->self);
 	DATA_PTR(doc->self) = 0;
 	doc_free(pi.doc);
-	if (allocated && 0 != ex) { // will jump so caller will not free
-	    xfree(json);
+	if (src->allocated && 0 != ex) { // will jump so caller will not free
+	    json_free(src->json, src->mapped);
 	}
     } else {
 	result = doc->self;
@@ -834,99 +1676,309 @@ parse_json(VALUE clas, char *json, int given, int allocated) {
     return result;
 }
 
-static Leaf
-get_doc_leaf(Doc doc, const char *path) {
-    Leaf	leaf = *doc->where;
-
-    if (0 != doc->data && 0 != path) {
-	Leaf	stack[MAX_STACK];
-	Leaf	*lp;
+static void
+path_compile(Path path, const char *str, PathStep steps, size_t max) {
+    const char	*s = str;
+    PathStep	step;
+
+    path->str = str;
+    path->steps = steps;
+    path->end = steps;
+    path->absolute = ('/' == *s);
+    if (path->absolute) {
+	s++;
+    }
+    while ('\0' != *s) {
+	const char	*slash = strchr(s, '/');
+	const char	*c;
+	size_t		len = (0 == slash) ? strlen(s) : (size_t)(slash - s);
 
-	if ('/' == *path) {
-	    path++;
-	    *stack = doc->data;
-	    lp = stack;
-	} else if (doc->where == doc->where_path) {
-	    *stack = doc->data;
-	    lp = stack;
+	if (max <= (size_t)(path->end - path->steps)) {
+	    rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+	}
+	step = path->end++;
+	step->key = s;
+	step->klen = len;
+	step->index = 0;
+	step->hash = key_hash(s, len);
+	if (2 == len && '.' == *s && '.' == s[1]) {
+	    step->type = STEP_UP;
 	} else {
-	    size_t	cnt = doc->where - doc->where_path;
-
-	    if (MAX_STACK <= cnt) {
-		rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+	    step->type = (0 < len) ? STEP_INDEX : STEP_KEY;
+	    for (c = s; c < s + len; c++) {
+		if ('0' > *c || '9' < *c) {
+		    step->type = STEP_KEY;
+		    break;
+		}
+		step->index = step->index * 10 + (*c - '0');
 	    }
-	    memcpy(stack, doc->where_path, sizeof(Leaf) * (cnt + 1));
-	    lp = stack + cnt;
 	}
-	return get_leaf(stack, lp, path);
+	s += len;
+	if ('/' == *s) {
+	    s++;
+	}
     }
-    return leaf;
 }
 
-static Leaf
-get_leaf(Leaf *stack, Leaf *lp, const char *path) {
-    Leaf	leaf = *lp;
+static Path
+arg_path(VALUE rpath, Path tmp, PathStep steps) {
+    if (oj_doc_path_class == rb_obj_class(rpath)) {
+	return (Path)DATA_PTR(rpath);
+    }
+    Check_Type(rpath, T_STRING);
+    path_compile(tmp, StringValuePtr(rpath), steps, MAX_STACK);
 
-    if (MAX_STACK <= lp - stack) {
+    return tmp;
+}
+
+static Leaf
+get_doc_leaf(Doc doc, Where w, Path path) {
+    Leaf	leaf = *w->where;
+
+    if (0 != doc->data && 0 != path) {
+	Leaf	stack[MAX_STACK];
+	Leaf	*lp = path_base(doc, w, path, stack);
+
+	return get_leaf(doc, stack, lp, path->steps, path->end);
+    }
+    return leaf;
+}
+
+// Fills the stack with the leaves a path starts from and returns the top.
+static Leaf*
+path_base(Doc doc, Where w, Path path, Leaf *stack) {
+    size_t	cnt;
+
+    if (path->absolute || w->where == w->where_path) {
+	*stack = doc->data;
+	return stack;
+    }
+    cnt = w->where - w->where_path;
+    if (MAX_STACK <= cnt) {
 	rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
     }
-    if ('\0' != *path) {
-	if ('.' == *path && '.' == *(path + 1)) {
-	    path += 2;
-	    if ('/' == *path) {
-		path++;
-	    }
-	    if (stack < lp) {
-		leaf = get_leaf(stack, lp - 1, path);
-	    } else {
-		return 0;
+    memcpy(stack, w->where_path, sizeof(Leaf) * (cnt + 1));
+    return stack + cnt;
+}
+
+inline static int
+step_eq(PathStep a, PathStep b) {
+    if (a->type != b->type) {
+	return 0;
+    }
+    switch (a->type) {
+    case STEP_INDEX:	return a->index == b->index;
+    case STEP_KEY:	return a->hash == b->hash && a->klen == b->klen && 0 == memcmp(a->key, b->key, a->klen);
+    default:		return 1;
+    }
+}
+
+static Leaf
+get_shared_leaf(Doc doc, Path path, Shared shared) {
+    Leaf	stack[MAX_STACK];
+    Leaf	*lp;
+    PathStep	step = path->steps;
+    size_t	n = 0;
+
+    if (0 == doc->data) {
+	return 0;
+    }
+    lp = path_base(doc, &doc->loc, path, stack);
+    if (0 != shared->prev && shared->prev->absolute == path->absolute) {
+	PathStep	ps = shared->prev->steps;
+
+	for (; n < shared->cnt && step < path->end && step_eq(step, ps); n++, step++, ps++) {
+	    lp++;
+	    *lp = shared->prefix[n];
+	}
+    }
+    shared->cnt = n;
+    shared->prev = path;
+    for (; step < path->end && STEP_UP != step->type; step++) {
+	Leaf	leaf = *lp;
+	Leaf	e;
+
+	if (COL_VAL != leaf->value_type || 0 == leaf_elements(doc, leaf)) {
+	    break;
+	}
+	if (MAX_STACK - 1 <= lp - stack) {
+	    rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+	}
+	if (0 == (e = find_child(doc, leaf, step))) {
+	    return 0;
+	}
+	lp++;
+	*lp = e;
+	shared->prefix[shared->cnt++] = e;
+    }
+    return get_leaf(doc, stack, lp, step, path->end);
+}
+
+static void
+build_index(Doc doc, Leaf leaf) {
+    Leaf	first = leaf->elements->next;
+    Leaf	e = first;
+    ChildIndex	ci;
+    size_t	cnt = 0;
+
+    leaf->indexed = No;
+    if (T_ARRAY == leaf->rtype) {
+	// the last element holds the largest index
+	cnt = leaf->elements->index;
+    } else {
+	do {
+	    cnt++;
+	    e = e->next;
+	} while (e != first && INDEX_MIN > cnt);
+	if (INDEX_MIN <= cnt) {
+	    for (; e != first; e = e->next) {
+		cnt++;
 	    }
-	} else if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
-	    Leaf	first = leaf->elements->next;
-	    Leaf	e = first;
-	    int		type = leaf->rtype;
+	}
+    }
+    if (INDEX_MIN > cnt) {
+	return;
+    }
+    if (0 == doc->indexes) {
+	doc->indexes = st_init_numtable();
+    }
+    ci = ALLOC(struct _ChildIndex);
+    if (T_ARRAY == leaf->rtype) {
+	Leaf	*sp;
 
-	    leaf = 0;
-	    if (T_ARRAY == type) {
-		int	cnt = 0;
+	ci->mask = cnt;
+	ci->slots = ALLOC_N(Leaf, cnt);
+	sp = ci->slots;
+	do {
+	    *sp++ = e;
+	    e = e->next;
+	} while (e != first);
+    } else {
+	size_t	size = INDEX_MIN;
 
-		for (; '0' <= *path && *path <= '9'; path++) {
-		    cnt = cnt * 10 + (*path - '0');
+	while (size < cnt * 2) {
+	    size <<= 1;
+	}
+	ci->mask = size - 1;
+	ci->slots = ALLOC_N(Leaf, size);
+	memset(ci->slots, 0, sizeof(Leaf) * size);
+	do {
+	    size_t	klen = oj_leaf_key_len(e);
+	    size_t	h = key_hash(e->key, klen) & ci->mask;
+	    Leaf	*sp;
+
+	    // the first of any duplicate keys is kept to match a linear search
+	    for (sp = ci->slots + h; 0 != *sp; h = (h + 1) & ci->mask, sp = ci->slots + h) {
+		if (klen == oj_leaf_key_len(*sp) && 0 == memcmp(e->key, (*sp)->key, klen)) {
+		    break;
 		}
-		if ('/' == *path) {
-		    path++;
+	    }
+	    if (0 == *sp) {
+		*sp = e;
+	    }
+	    e = e->next;
+	} while (e != first);
+    }
+    st_insert(doc->indexes, (st_data_t)leaf, (st_data_t)ci);
+    leaf->indexed = Yes;
+}
+
+// Returns true if the key of a hash member is the key of the step.
+inline static int
+key_match(PathStep step, Leaf leaf) {
+    if (0 != strncmp(step->key, leaf->key, step->klen)) {
+	return 0;
+    }
+    if (KEY_SPAN & leaf->span) {
+	// a key left in the text ends at a quote that can not be in the key
+	return '"' == leaf->key[step->klen] && 0 == memchr(step->key, '"', step->klen);
+    }
+    return '\0' == leaf->key[step->klen];
+}
+
+// Returns the child of a collection leaf that matches the step or 0.
+static Leaf
+find_child(Doc doc, Leaf leaf, PathStep step) {
+    Leaf	first;
+    Leaf	e;
+
+    if (NotSet == leaf->indexed) {
+	build_index(doc, leaf);
+    }
+    if (Yes == leaf->indexed) {
+	st_data_t	ci;
+
+	if (st_lookup(doc->indexes, (st_data_t)leaf, &ci)) {
+	    ChildIndex	index = (ChildIndex)ci;
+
+	    if (T_ARRAY == leaf->rtype) {
+		size_t	i = (0 == step->index) ? 0 : step->index - 1;
+
+		if (STEP_INDEX != step->type || index->mask <= i) {
+		    return 0;
 		}
-		do {
-		    if (1 >= cnt) {
-			lp++;
-			*lp = e;
-			leaf = get_leaf(stack, lp, path);
-			break;
+		return index->slots[i];
+	    } else {
+		size_t	h = step->hash & index->mask;
+		Leaf	*sp;
+
+		for (sp = index->slots + h; 0 != *sp; h = (h + 1) & index->mask, sp = index->slots + h) {
+		    if (key_match(step, *sp)) {
+			return *sp;
 		    }
-		    cnt--;
-		    e = e->next;
-		} while (e != first);
-	    } else if (T_HASH == type) {
-		const char	*key = path;
-		const char	*slash = strchr(path, '/');
-		int		klen;
-
-		if (0 == slash) {
-		    klen = (int)strlen(key);
-		    path += klen;
-		} else {
-		    klen = (int)(slash - key);
-		    path += klen + 1;
 		}
-		do {
-		    if (0 == strncmp(key, e->key, klen) && '\0' == e->key[klen]) {
-			lp++;
-			*lp = e;
-			leaf = get_leaf(stack, lp, path);
-			break;
-		    }
-		    e = e->next;
-		} while (e != first);
+		return 0;
+	    }
+	}
+    }
+    first = leaf->elements->next;
+    e = first;
+    if (T_ARRAY == leaf->rtype) {
+	size_t	cnt = step->index;
+
+	if (STEP_INDEX != step->type) {
+	    return 0;
+	}
+	do {
+	    if (1 >= cnt) {
+		return e;
+	    }
+	    cnt--;
+	    e = e->next;
+	} while (e != first);
+    } else if (T_HASH == leaf->rtype) {
+	do {
+	    if (key_match(step, e)) {
+		return e;
+	    }
+	    e = e->next;
+	} while (e != first);
+    }
+    return 0;
+}
+
+static Leaf
+get_leaf(Doc doc, Leaf *stack, Leaf *lp, PathStep step, PathStep end) {
+    Leaf	leaf = *lp;
+
+    if (MAX_STACK <= lp - stack) {
+	rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+    }
+    if (step < end) {
+	if (STEP_UP == step->type) {
+	    if (stack < lp) {
+		leaf = get_leaf(doc, stack, lp - 1, step + 1, end);
+	    } else {
+		return 0;
+	    }
+	} else if (COL_VAL == leaf->value_type && 0 != leaf_elements(doc, leaf)) {
+	    Leaf	e = find_child(doc, leaf, step);
+
+	    leaf = 0;
+	    if (0 != e) {
+		lp++;
+		*lp = e;
+		leaf = get_leaf(doc, stack, lp, step + 1, end);
 	    }
 	}
     }
@@ -934,22 +1986,22 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 }
 
 static void
-each_leaf(Doc doc, VALUE self) {
-    if (COL_VAL == (*doc->where)->value_type) {
-	if (0 != (*doc->where)->elements) {
-	    Leaf	first = (*doc->where)->elements->next;
+each_leaf(Doc doc, Where w, VALUE self) {
+    if (COL_VAL == (*w->where)->value_type) {
+	if (0 != leaf_elements(doc, *w->where)) {
+	    Leaf	first = (*w->where)->elements->next;
 	    Leaf	e = first;
 
-	    doc->where++;
-	    if (MAX_STACK <= doc->where - doc->where_path) {
+	    w->where++;
+	    if (MAX_STACK <= w->where - w->where_path) {
 		rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
 	    }
 	    do {
-		*doc->where = e;
-		each_leaf(doc, self);
+		*w->where = e;
+		each_leaf(doc, w, self);
 		e = e->next;
 	    } while (e != first);
-	    doc->where--;
+	    w->where--;
 	}
     } else {
 	rb_yield(self);
@@ -957,90 +2009,43 @@ each_leaf(Doc doc, VALUE self) {
 }
 
 static int
-move_step(Doc doc, const char *path, int loc) {
-    if (MAX_STACK <= doc->where - doc->where_path) {
+move_step(Doc doc, Where w, PathStep step, PathStep end, int loc) {
+    if (MAX_STACK <= w->where - w->where_path) {
 	rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
     }
-    if ('\0' == *path) {
+    if (end <= step) {
 	loc = 0;
     } else {
 	Leaf	leaf;
 
-	if (0 == doc->where || 0 == (leaf = *doc->where)) {
-	    printf("*** Internal error at %s\n", path);
+	if (0 == w->where || 0 == (leaf = *w->where)) {
+	    printf("*** Internal error at %s\n", step->key);
 	    return loc;
 	}
-	if ('.' == *path && '.' == *(path + 1)) {
-	    Leaf	init = *doc->where;
+	if (STEP_UP == step->type) {
+	    Leaf	init = *w->where;
 
-	    path += 2;
-	    if (doc->where == doc->where_path) {
+	    if (w->where == w->where_path) {
 		return loc;
 	    }
-	    if ('/' == *path) {
-		path++;
-	    }
-	    *doc->where = 0;
-	    doc->where--;
-	    loc = move_step(doc, path, loc + 1);
+	    *w->where = 0;
+	    w->where--;
+	    loc = move_step(doc, w, step + 1, end, loc + 1);
 	    if (0 != loc) {
-		*doc->where = init;
-		doc->where++;
+		w->where++;
+		*w->where = init;
 	    }
-	} else if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
-	    Leaf	first = leaf->elements->next;
-	    Leaf	e = first;
-
-	    if (T_ARRAY == leaf->rtype) {
-		int	cnt = 0;
-
-		for (; '0' <= *path && *path <= '9'; path++) {
-		    cnt = cnt * 10 + (*path - '0');
-		}
-		if ('/' == *path) {
-		    path++;
-		} else if ('\0' != *path) {
-		    return loc;
+	} else if (COL_VAL == leaf->value_type && 0 != leaf_elements(doc, leaf)) {
+	    Leaf	e = find_child(doc, leaf, step);
+
+	    if (0 != e) {
+		w->where++;
+		*w->where = e;
+		loc = move_step(doc, w, step + 1, end, loc + 1);
+		if (0 != loc) {
+		    *w->where = 0;
+		    w->where--;
 		}
-		do {
-		    if (1 >= cnt) {
-			doc->where++;
-			*doc->where = e;
-			loc = move_step(doc, path, loc + 1);
-			if (0 != loc) {
-			    *doc->where = 0;
-			    doc->where--;
-			}
-			break;
-		    }
-		    cnt--;
-		    e = e->next;
-		} while (e != first);
-	    } else if (T_HASH == leaf->rtype) {
-		const char	*key = path;
-		const char	*slash = strchr(path, '/');
-		int		klen;
-
-		if (0 == slash) {
-		    klen = (int)strlen(key);
-		    path += klen;
-		} else {
-		    klen = (int)(slash - key);
-		    path += klen + 1;
-		}
-		do {
-		    if (0 == strncmp(key, e->key, klen) && '\0' == e->key[klen]) {
-			doc->where++;
-			*doc->where = e;
-			loc = move_step(doc, path, loc + 1);
-			if (0 != loc) {
-			    *doc->where = 0;
-			    doc->where--;
-			}
-			break;
-		    }
-		    e = e->next;
-		} while (e != first);
 	    }
 	}
     }
@@ -1050,7 +2055,7 @@ move_step(Doc doc, const char *path, int loc) {
 static void
 each_value(Doc doc, Leaf leaf) {
     if (COL_VAL == leaf->value_type) {
-	if (0 != leaf->elements) {
+	if (0 != leaf_elements(doc, leaf)) {
 	    Leaf	first = leaf->elements->next;
 	    Leaf	e = first;
 
@@ -1066,14 +2071,28 @@ each_value(Doc doc, Leaf leaf) {
 
 // doc functions
 
-/* call-seq: open(json) { |doc| ... } => Object
+/* call-seq: open(json, options={}) { |doc| ... } => Object
  *
  * Parses a JSON document String and then yields to the provided block if one
  * is given with an instance of the Oj::Doc as the single yield parameter. If
  * a block is not given then an Oj::Doc instance is returned and must be
  * closed with a call to the #close() method when no longer needed.
  *
+ * With the :memoize option set to true, an Array or Hash built for a
+ * container is frozen, along with the Strings in it, and is returned again
+ * each time the same container is fetched.
+ *
+ * A frozen String is not copied. It is parsed in place and kept by the
+ * document, with strings that have escapes unescaped when parsed.
+ *
+ * With the :tape option set to true, the document is checked and the
+ * position of each Array and Hash recorded but the members of a container
+ * are only built when first used. Containers that are never used cost no
+ * more than their place on the tape and unused ones are dumped straight from
+ * the text.
+ *
  * @param [String] json JSON document string
+ * @param [Hash] options :memoize to keep frozen containers, :tape to build containers when used
  * @yieldparam [Oj::Doc] doc parsed JSON document
  * @yieldreturn [Object] returns the result of the yield as the result of the method call
  * @example
@@ -1084,15 +2103,41 @@ each_value(Doc doc, Leaf leaf) {
  *   doc.close()
  */
 static VALUE
-doc_open(VALUE clas, VALUE str) {
+doc_open(int argc, VALUE *argv, VALUE clas) {
+    struct _Source	src;
     char	*json;
     size_t	len;
     VALUE	obj;
+    VALUE	str;
     int		given = rb_block_given_p();
     int		allocate;
+    int		memoize;
+    int		tape;
+
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "wrong number of arguments (%d for 1..2)", argc);
+    }
+    str = *argv;
+    memoize = bool_opt((2 == argc) ? argv[1] : Qnil, "memoize");
+    tape = bool_opt((2 == argc) ? argv[1] : Qnil, "tape");
 
     Check_Type(str, T_STRING);
     len = RSTRING_LEN(str) + 1;
+    if (TAPE_MAX <= len) {
+	tape = 0;
+    }
+    if (OBJ_FROZEN(str) && '\0' == RSTRING_PTR(str)[len - 1]) {
+	// A frozen String can not change so it is parsed in place, without
+	// writing to it, and kept by the Doc.
+	src_init(&src, 0, len, 0);
+	src.text = RSTRING_PTR(str);
+	src.lazy = 1;
+	src.tape = tape;
+	src.orig_str = str;
+	src.memoize = memoize;
+
+	return parse_json(clas, &src, given);
+    }
     allocate = (SMALL_XML < len || !given);
     if (allocate) {
 	json = ALLOC_N(char, len);
@@ -1100,21 +2145,342 @@ doc_open(VALUE clas, VALUE str) {
 	json = ALLOCA_N(char, len);
     }
     memcpy(json, StringValuePtr(str), len);
-    obj = parse_json(clas, json, given, allocate);
+    src_init(&src, json, len, allocate);
+    src.memoize = memoize;
+    if (tape) {
+	// containers are parsed again when built so the copy is left as is
+	src.lazy = 1;
+	src.tape = 1;
+    } else if (RAW_MIN < len) {
+	// the parse is destructive so the frozen String, which usually shares
+	// the buffer of the original, is kept for dumping unchanged containers
+	src.orig_str = rb_str_new_frozen(str);
+    }
+    obj = parse_json(clas, &src, given);
     if (given && allocate) {
 	xfree(json);
     }
     return obj;
 }
 
-/* call-seq: open_file(filename) { |doc| ... } => Object
+#if HAS_MMAP
+// Maps a file copy-on-write so only the pages the parser writes to are copied
+// and the rest stay shared with the page cache. The terminating '\0' comes
+// from the zero filled tail of the last page so a file that ends exactly on a
+// page boundary is not mapped.
+static char*
+map_file(FILE *f, size_t len) {
+    long	page = sysconf(_SC_PAGESIZE);
+    char	*json;
+
+    if (0 >= page || 0 == len % page) {
+	return 0;
+    }
+    json = (char*)mmap(0, len + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+    if (MAP_FAILED == (void*)json) {
+	return 0;
+    }
+    return json;
+}
+
+// A second, read only, mapping of the file keeps the unmodified text around
+// for dumping without using more memory than the page cache already holds.
+static char*
+map_orig(FILE *f, size_t len) {
+    char	*orig = (char*)mmap(0, len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+
+    if (MAP_FAILED == (void*)orig) {
+	return 0;
+    }
+    return orig;
+}
+#endif
+
+static void
+src_init(Source src, char *json, size_t tlen, int allocated) {
+    src->json = json;
+    src->text = json;
+    src->tlen = tlen;
+    src->mapped = 0;
+    src->allocated = allocated;
+    memset(&src->stamp, 0, sizeof(src->stamp));
+    src->stamp.size = -1;
+    src->index = 0;
+    src->memoize = 0;
+    src->lazy = 0;
+    src->tape = 0;
+    src->io = 0;
+    src->orig_str = Qnil;
+    src->orig = 0;
+    src->orig_mapped = 0;
+}
+
+// Reads the true or false options common to open() and open_file().
+static int
+bool_opt(VALUE ropts, const char *name) {
+    VALUE	v;
+
+    if (Qnil == ropts) {
+	return 0;
+    }
+    Check_Type(ropts, T_HASH);
+    v = rb_hash_aref(ropts, ID2SYM(rb_intern(name)));
+
+    return (Qnil != v && Qfalse != v);
+}
+
+static void
+index_error() {
+    rb_raise(rb_const_get_at(Oj, rb_intern("LoadError")), "Not a valid Oj::Doc index.");
+}
+
+#define HASH_MUL	0x9E3779B97F4A7C15ULL
+
+// Hashes the text of a file so an index can be checked against the text it
+// was written for. The size and modification time can stay the same when a
+// file is rewritten within the resolution of the file system timestamps.
+// Whole words are hashed so all but the last call must pass a multiple of 8
+// bytes.
+static uint64_t
+text_hash(uint64_t h, const char *s, size_t len) {
+    uint64_t	w;
+
+    for (; 8 <= len; s += 8, len -= 8) {
+	memcpy(&w, s, 8);
+	h = (((h << 29) | (h >> 35)) ^ w) * HASH_MUL;
+    }
+    if (0 < len) {
+	w = 0;
+	memcpy(&w, s, len);
+	h = (((h << 29) | (h >> 35)) ^ w ^ len) * HASH_MUL;
+    }
+    return h;
+}
+
+static uint64_t
+file_hash(FILE *f) {
+    char	buf[16384];
+    size_t	cnt;
+    uint64_t	h = 0;
+
+    fseek(f, 0, SEEK_SET);
+    while (0 < (cnt = fread(buf, 1, sizeof(buf), f))) {
+	h = text_hash(h, buf, cnt);
+	if (cnt < sizeof(buf)) {
+	    break;
+	}
+    }
+    return h;
+}
+
+// Opens a JSON file and records its size, modification time, and inode.
+static FILE*
+file_open(const char *path, FileStamp stamp) {
+    FILE	*f;
+    struct stat	st;
+
+    if (0 == (f = fopen(path, "r"))) {
+	rb_raise(rb_eIOError, "%s", strerror(errno));
+    }
+    memset(stamp, 0, sizeof(*stamp));
+    if (0 == fstat(fileno(f), &st)) {
+	stamp->mtime = (int64_t)st.st_mtime * 1000000000LL;
+#if HAS_STAT_MTIM
+	stamp->mtime += st.st_mtim.tv_nsec;
+#elif HAS_STAT_MTIMESPEC
+	stamp->mtime += st.st_mtimespec.tv_nsec;
+#endif
+	stamp->ino = (uint64_t)st.st_ino;
+    }
+    fseek(f, 0, SEEK_END);
+    stamp->size = (int64_t)ftell(f);
+
+    return f;
+}
+
+// Sets up src to load from the index file if it exists and was written for a
+// JSON file with the same stamp. The text hash is only compared if verify is
+// set. A missing, stale, or malformed index returns 0 so the JSON is parsed
+// instead. The index is mapped only if map is set.
+static int
+index_open(Source src, const char *path, FileStamp stamp, int verify, int map) {
+    struct _IndexHead	head;
+    FILE		*f;
+    long		flen;
+    size_t		len;
+    char		*buf = 0;
+    size_t		mapped = 0;
+
+    if (0 == (f = fopen(path, "rb"))) {
+	return 0;
+    }
+    if (1 != fread(&head, sizeof(head), 1, f) ||
+	0 != memcmp(head.magic, INDEX_MAGIC, sizeof(head.magic)) ||
+	INDEX_ORDER != head.order ||
+	sizeof(struct _IndexLeaf) != head.rec_size ||
+	stamp->size != head.stamp.size ||
+	stamp->mtime != head.stamp.mtime ||
+	stamp->ino != head.stamp.ino ||
+	(verify && (0 == head.stamp.hash || stamp->hash != head.stamp.hash))) {
+	fclose(f);
+	return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    flen = ftell(f);
+    len = (size_t)flen;
+    // checked piece by piece so that nothing can wrap around
+    if (0 > flen || len < sizeof(head) || 0 == head.tlen || len - sizeof(head) < head.tlen ||
+	0 != (len - sizeof(head) - head.tlen) % sizeof(struct _IndexLeaf) ||
+	(len - sizeof(head) - head.tlen) / sizeof(struct _IndexLeaf) != head.cnt) {
+	fclose(f);
+	return 0;
+    }
+#if HAS_MMAP
+    if (map) {
+	buf = (char*)mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+	if (MAP_FAILED == (void*)buf) {
+	    buf = 0;
+	} else {
+	    mapped = len;
+	}
+    }
+#endif
+    if (0 == buf) {
+	buf = ALLOC_N(char, len);
+	fseek(f, 0, SEEK_SET);
+	if (len != fread(buf, 1, len, f)) {
+	    fclose(f);
+	    xfree(buf);
+	    return 0;
+	}
+    }
+    fclose(f);
+    // every value in the text is terminated so the last byte must be as well
+    if ('\0' != buf[len - 1]) {
+	json_free(buf, mapped);
+	return 0;
+    }
+    src_init(src, buf, head.tlen, 1);
+    src->text = buf + (len - head.tlen);
+    src->mapped = mapped;
+    src->stamp = *stamp;
+    src->stamp.hash = head.stamp.hash;
+    src->index = (IndexHead)buf;
+
+    return 1;
+}
+
+static Leaf
+index_leaf(ParseInfo pi, IndexLeaf *recp, IndexLeaf end) {
+    Doc		doc = pi->doc;
+    IndexLeaf	rec = *recp;
+    Leaf	leaf = 0;
+    uint8_t	rtype;
+    uint64_t	key;
+
+    if ((void*)&leaf < pi->stack_min) {
+	rb_raise(rb_eSysStackError, "JSON is too deeply nested");
+    }
+    if (end <= rec) {
+	index_error();
+    }
+    *recp = rec + 1;
+    rtype = (uint8_t)(rec->key & 0xFF);
+    key = rec->key >> 8;
+    switch (rtype) {
+    case T_ARRAY:
+    case T_HASH: {
+	uint64_t	i;
+	Leaf		e;
+
+	if ((uint64_t)(end - *recp) < rec->str) {
+	    index_error();
+	}
+	leaf = leaf_new(doc, rtype);
+	for (i = 1; i <= rec->str; i++) {
+	    e = index_leaf(pi, recp, end);
+	    if (T_ARRAY == rtype) {
+		e->index = i;
+	    } else if (0 == e->key) {
+		index_error();
+	    }
+	    e->parent_type = rtype;
+	    leaf_append_element(leaf, e);
+	}
+	break;
+    }
+    case T_FIXNUM:
+    case T_FLOAT:
+    case T_STRING:
+	if (doc->tlen <= rec->str) {
+	    index_error();
+	}
+	leaf = leaf_new(doc, rtype);
+	leaf->str = doc->text + rec->str;
+	break;
+    case T_NIL:
+    case T_TRUE:
+    case T_FALSE:
+	leaf = leaf_new(doc, rtype);
+	break;
+    default:
+	index_error();
+	break;
+    }
+    if (0 != key) {
+	if (doc->tlen < key) {
+	    index_error();
+	}
+	leaf->key = doc->text + key - 1;
+    }
+    doc->size++;
+
+    return leaf;
+}
+
+static Leaf
+index_load(ParseInfo pi) {
+    IndexLeaf	rec = (IndexLeaf)(pi->index + 1);
+    IndexLeaf	end = rec + pi->index->cnt;
+    Leaf	leaf = 0;
+
+    if (rec < end) {
+	leaf = index_leaf(pi, &rec, end);
+	if (rec != end) {
+	    index_error();
+	}
+    }
+    return leaf;
+}
+
+/* call-seq: open_file(filename, options={}) { |doc| ... } => Object
  *
  * Parses a JSON document from a file and then yields to the provided block if
  * one is given with an instance of the Oj::Doc as the single yield
  * parameter. If a block is not given then an Oj::Doc instance is returned and
  * must be closed with a call to the #close() method when no longer needed.
  *
+ * The file is read into memory unless the :mmap option is true. With :mmap
+ * larger files, and the index, are mapped copy-on-write where supported so
+ * processes that open the same file share the pages the parser does not
+ * modify. A mapped file must not be truncated or rewritten while the Doc is
+ * open. Reading a truncated part kills the process with a bus error and text
+ * that was rewritten can show up in values not read yet. The :mmap option is
+ * ignored with :tape, which reads values from the text when they are used.
+ *
+ * If an :index file written by #save_index() exists and the size,
+ * modification time, and inode of the JSON file are the ones it was written
+ * for then the document is loaded from the index. The index holds its own
+ * copy of the text so the JSON file is not read or parsed. A file rewritten
+ * with the same size faster than the file system timestamps change is not
+ * noticed unless the :verify option is true. With :verify the JSON file is
+ * read to compare a hash of its text but it is still not parsed. Only an
+ * index saved from a document opened with the :index option has that hash. A
+ * missing, stale, or malformed index is ignored and the file is parsed as
+ * usual. The :memoize and :tape options are the same as for #open().
+ *
  * @param [String] filename name of file that contains a JSON document
+ * @param [Hash] options :index is the name of an index file, :verify to check the index against the text, :memoize to keep frozen containers, :tape to build containers when used, :mmap to map the file
  * @yieldparam [Oj::Doc] doc parsed JSON document
  * @yieldreturn [Object] returns the result of the yield as the result of the method call
  * @example
@@ -1126,27 +2492,86 @@ doc_open(VALUE clas, VALUE str) {
  *   doc.close()
  */
 static VALUE
-doc_open_file(VALUE clas, VALUE filename) {
-    char	*path;
-    char	*json;
-    FILE	*f;
-    size_t	len;
-    VALUE	obj;
-    int		given = rb_block_given_p();
-    int		allocate;
-
-    Check_Type(filename, T_STRING);
-    path = StringValuePtr(filename);
-    if (0 == (f = fopen(path, "r"))) {
-	rb_raise(rb_eIOError, "%s", strerror(errno));
+doc_open_file(int argc, VALUE *argv, VALUE clas) {
+    struct _Source	src;
+    struct _FileStamp	stamp;
+    char		*path;
+    char		*json;
+    FILE		*f;
+    size_t		len;
+    VALUE		obj;
+    VALUE		ipath = Qnil;
+    int			given = rb_block_given_p();
+    int			allocate;
+    int			memoize = 0;
+    int			tape = 0;
+    int			map = 0;
+    int			verify = 0;
+
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "wrong number of arguments (%d for 1..2)", argc);
     }
-    fseek(f, 0, SEEK_END);
-    len = ftell(f);
-    allocate = (SMALL_XML < len || !given);
-    if (allocate) {
-	json = ALLOC_N(char, len + 1);
-    } else {
-	json = ALLOCA_N(char, len + 1);
+    Check_Type(*argv, T_STRING);
+    if (2 == argc) {
+	memoize = bool_opt(argv[1], "memoize");
+	tape = bool_opt(argv[1], "tape");
+	map = bool_opt(argv[1], "mmap");
+	verify = bool_opt(argv[1], "verify");
+	if (Qnil != (ipath = rb_hash_aref(argv[1], ID2SYM(rb_intern("index"))))) {
+	    Check_Type(ipath, T_STRING);
+	}
+    }
+    path = StringValuePtr(*argv);
+    f = file_open(path, &stamp);
+    if (Qnil != ipath) {
+	if (verify) {
+	    stamp.hash = file_hash(f);
+	}
+	// closed first so nothing is left open if loading the index raises
+	fclose(f);
+	if (index_open(&src, StringValuePtr(ipath), &stamp, verify, map)) {
+	    src.memoize = memoize;
+	    obj = parse_json(clas, &src, given);
+	    if (given) {
+		json_free(src.json, src.mapped);
+	    }
+	    return obj;
+	}
+	f = file_open(path, &stamp);
+    }
+    len = (size_t)stamp.size;
+    if (TAPE_MAX <= len) {
+	tape = 0;
+    }
+    allocate = (SMALL_XML < len || !given);
+#if HAS_MMAP
+    // The :tape option leaves strings and containers in the text until they
+    // are used so the text must not change under it and is read instead.
+    if (map && !tape && SMALL_XML < len && 0 != (json = map_file(f, len))) {
+	char	*orig = map_orig(f, len);
+
+	fclose(f);
+	src_init(&src, json, len + 1, allocate);
+	src.mapped = len + 1;
+	src.orig = orig;
+	src.orig_mapped = len;
+	src.stamp = stamp;
+	if (Qnil != ipath) {
+	    // kept for an index saved from this document
+	    src.stamp.hash = text_hash(0, json, len);
+	}
+	src.memoize = memoize;
+	obj = parse_json(clas, &src, given);
+	if (given) {
+	    json_free(json, src.mapped);
+	}
+	return obj;
+    }
+#endif
+    if (allocate) {
+	json = ALLOC_N(char, len + 1);
+    } else {
+	json = ALLOCA_N(char, len + 1);
     }
     fseek(f, 0, SEEK_SET);
     if (len != fread(json, 1, len, f)) {
@@ -1156,27 +2581,155 @@ doc_open_file(VALUE clas, VALUE filename) {
     }
     fclose(f);
     json[len] = '\0';
-    obj = parse_json(clas, json, given, allocate);
+    src_init(&src, json, len + 1, allocate);
+    src.stamp = stamp;
+    if (Qnil != ipath) {
+	src.stamp.hash = text_hash(0, json, len);
+    }
+    src.memoize = memoize;
+    src.lazy = tape;
+    src.tape = tape;
+    obj = parse_json(clas, &src, given);
     if (given && allocate) {
 	xfree(json);
     }
     return obj;
 }
 
-/* Document-method: parse
- * @see Oj::Doc.open
- */
+// Starts a new chunk with the text not parsed yet and as much again plus
+// IO_CHUNK from the IO so text carried over is only copied a few times.
+static char*
+io_fill(IoText io, Text *chunks, const char *rest, size_t rlen) {
+    Reader	r = &io->reader;
+    size_t	cap = rlen * 2 + IO_CHUNK;
+    Text	t = (Text)ALLOC_N(char, sizeof(struct _Text) + cap);
+    size_t	len = rlen;
+    char	*last;
+
+    memcpy(t->str, rest, rlen);
+    while (len < cap && !io->eof) {
+	size_t	cnt;
+
+	if (r->read_end <= r->tail && 0 != oj_reader_read(r)) {
+	    io->eof = 1;
+	    break;
+	}
+	cnt = r->read_end - r->tail;
+	if (cap - len < cnt) {
+	    cnt = cap - len;
+	}
+	memcpy(t->str + len, r->tail, cnt);
+	r->tail += cnt;
+	len += cnt;
+    }
+    t->str[len] = '\0';
+    // full so text_alloc() does not use it
+    t->len = cap;
+    t->cap = cap;
+    t->next = *chunks;
+    *chunks = t;
+    io->end = t->str + len;
+    last = oj_reader_scan(&io->scan, t->str + rlen, io->end);
+    if (io->eof) {
+	io->stop = 0;
+    } else {
+	// with no structural character the parser comes back for more at once
+	io->stop = (0 == last) ? t->str : last;
+	io->saved = *io->stop;
+	*io->stop = '\0';
+    }
+    return t->str;
+}
 
-/* call-seq: where?() => String
+static void
+io_refill(ParseInfo pi) {
+    IoText	io = pi->io;
+
+    *io->stop = io->saved;
+    pi->s = io_fill(io, &pi->doc->texts, io->stop, io->end - io->stop);
+    // errors are reported relative to the current chunk
+    pi->str = pi->s;
+}
+
+typedef struct _OpenIo {
+    VALUE	clas;
+    Source	src;
+    int		given;
+} *OpenIo;
+
+static VALUE
+open_io_proc(VALUE x) {
+    OpenIo	oi = (OpenIo)x;
+    IoText	io = oi->src->io;
+
+    oi->src->text = io_fill(io, &io->chunks, 0, 0);
+
+    return parse_json(oi->clas, oi->src, oi->given);
+}
+
+static VALUE
+open_io_cleanup(VALUE x) {
+    IoText	io = (IoText)x;
+
+    while (0 != io->chunks) {
+	Text	t = io->chunks;
+
+	io->chunks = t->next;
+	xfree(t);
+    }
+    reader_cleanup(&io->reader);
+
+    return Qnil;
+}
+
+/* call-seq: open_io(io, options={}) { |doc| ... } => Object
  *
- * Returns a String that describes the absolute path to the current location
- * in the JSON document.
+ * Parses a JSON document from an IO and then yields to the provided block if
+ * one is given with an instance of the Oj::Doc as the single yield
+ * parameter. If a block is not given then an Oj::Doc instance is returned and
+ * must be closed with a call to the #close() method when no longer needed.
+ *
+ * The document is parsed as it is read so parsing overlaps with waiting on
+ * the IO instead of starting once all of it has arrived. The IO can be
+ * anything the other Oj parsers read from. The :memoize option is the same
+ * as for #open().
+ *
+ * @param [IO] io IO, or object that responds to readpartial() or read(), to read the JSON document from
+ * @param [Hash] options :memoize to keep frozen containers
+ * @yieldparam [Oj::Doc] doc parsed JSON document
+ * @yieldreturn [Object] returns the result of the yield as the result of the method call
+ * @example
+ *   Oj::Doc.open_io(StringIO.new('[1,2,3]')) { |doc| doc.size() }  #=> 4
  */
 static VALUE
-doc_where(VALUE self) {
-    Doc	doc = self_doc(self);
+doc_open_io(int argc, VALUE *argv, VALUE clas) {
+    struct _IoText	io;
+    struct _Source	src;
+    struct _OpenIo	oi;
+
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "wrong number of arguments (%d for 1..2)", argc);
+    }
+    memset(&io, 0, sizeof(io));
+    src_init(&src, 0, 0, 0);
+    src.memoize = bool_opt((2 == argc) ? argv[1] : Qnil, "memoize");
+    src.io = &io;
+    oi.clas = clas;
+    oi.src = &src;
+    oi.given = rb_block_given_p();
+    oj_reader_init(&io.reader, *argv, 0);
+    oj_reader_grow(&io.reader, IO_CHUNK);
+
+    return rb_ensure(open_io_proc, (VALUE)&oi, open_io_cleanup, (VALUE)&io);
+}
 
-    if (0 == *doc->where_path || doc->where == doc->where_path) {
+/* Document-method: parse
+ * @see Oj::Doc.open
+ */
+
+static VALUE
+loc_where(Where w) {
+    if (0 == *w->where_path || w->where == w->where_path) {
 	return oj_slash_string;
     } else {
 	Leaf	*lp;
@@ -1185,20 +2738,23 @@ doc_where(VALUE self) {
 	char	*path;
 	char	*p;
 
-	for (lp = doc->where_path; lp <= doc->where; lp++) {
+	for (lp = w->where_path; lp <= w->where; lp++) {
 	    leaf = *lp;
 	    if (T_HASH == leaf->parent_type) {
-		size += strlen((*lp)->key) + 1;
+		size += oj_leaf_key_len(*lp) + 1;
 	    } else if (T_ARRAY == leaf->parent_type) {
 		size += ((*lp)->index < 100) ? 3 : 11;
 	    }
 	}
 	path = ALLOCA_N(char, size);
 	p = path;
-	for (lp = doc->where_path; lp <= doc->where; lp++) {
+	for (lp = w->where_path; lp <= w->where; lp++) {
 	    leaf = *lp;
 	    if (T_HASH == leaf->parent_type) {
-		p = stpcpy(p, (*lp)->key);
+		size_t	len = oj_leaf_key_len(*lp);
+
+		memcpy(p, (*lp)->key, len);
+		p += len;
 	    } else if (T_ARRAY == leaf->parent_type) {
 		p = ulong_fill(p, (*lp)->index);
 	    }
@@ -1209,6 +2765,30 @@ doc_where(VALUE self) {
     }
 }
 
+/* call-seq: where?() => String
+ *
+ * Returns a String that describes the absolute path to the current location
+ * in the JSON document.
+ */
+static VALUE
+doc_where(VALUE self) {
+    return loc_where(&self_doc(self)->loc);
+}
+
+static VALUE
+loc_local_key(Where w) {
+    Leaf	leaf = *w->where;
+    VALUE	key = Qnil;
+
+    if (T_HASH == leaf->parent_type) {
+	key = rb_str_new(leaf->key, oj_leaf_key_len(leaf));
+	key = oj_encode(key);
+    } else if (T_ARRAY == leaf->parent_type) {
+	key = LONG2NUM(leaf->index);
+    }
+    return key;
+}
+
 /* call-seq: local_key() => String, Fixnum, nil
  *
  * Returns the final key to the current location.
@@ -1219,371 +2799,2970 @@ doc_where(VALUE self) {
  */
 static VALUE
 doc_local_key(VALUE self) {
-    Doc		doc = self_doc(self);
-    Leaf	leaf = *doc->where;
-    VALUE	key = Qnil;
+    return loc_local_key(&self_doc(self)->loc);
+}
 
-    if (T_HASH == leaf->parent_type) {
-	key = rb_str_new2(leaf->key);
-	key = oj_encode(key);
-    } else if (T_ARRAY == leaf->parent_type) {
-	key = LONG2NUM(leaf->index);
+static VALUE
+loc_home(Doc doc, Where w) {
+    *w->where_path = doc->data;
+    w->where = w->where_path;
+
+    return oj_slash_string;
+}
+
+/* call-seq: home() => nil
+ *
+ * Moves the document marker or location to the hoot or home position. The
+ * same operation can be performed with a Oj::Doc.move('/').
+ * @example
+ *   Oj::Doc.open('[1,2,3]') { |doc| doc.move('/2'); doc.home(); doc.where? }  #=> '/'
+ */
+static VALUE
+doc_home(VALUE self) {
+    Doc	doc = self_doc(self);
+
+    return loc_home(doc, &doc->loc);
+}
+
+static VALUE
+loc_type(Doc doc, Where w, int argc, VALUE *argv) {
+    Leaf		leaf;
+    Path		path = 0;
+    struct _Path	tmp;
+    struct _PathStep	steps[MAX_STACK];
+    VALUE		type = Qnil;
+
+    if (1 <= argc) {
+	path = arg_path(*argv, &tmp, steps);
+    }
+    if (0 != (leaf = get_doc_leaf(doc, w, path))) {
+	switch (leaf->rtype) {
+	case T_NIL:	type = rb_cNilClass;	break;
+	case T_TRUE:	type = rb_cTrueClass;	break;
+	case T_FALSE:	type = rb_cFalseClass;	break;
+	case T_STRING:	type = rb_cString;	break;
+	case T_FIXNUM:	type = rb_cFixnum;	break;
+	case T_FLOAT:	type = rb_cFloat;	break;
+	case T_ARRAY:	type = rb_cArray;	break;
+	case T_HASH:	type = rb_cHash;	break;
+	default:				break;
+	}
+    }
+    return type;
+}
+
+/* call-seq: type(path=nil) => Class
+ *
+ * Returns the Class of the data value at the location identified by the path
+ * or the current location if the path is nil or not provided. This method
+ * does not create the Ruby Object at the location specified so the overhead
+ * is low.
+ * @param [String|Oj::Doc::Path] path path to the location to get the type of if provided
+ * @example
+ *   Oj::Doc.open('[1,2]') { |doc| doc.type() }	     #=> Array
+ *   Oj::Doc.open('[1,2]') { |doc| doc.type('/1') }  #=> Fixnum
+ */
+static VALUE
+doc_type(int argc, VALUE *argv, VALUE self) {
+    Doc	doc = self_doc(self);
+
+    return loc_type(doc, &doc->loc, argc, argv);
+}
+
+static VALUE
+loc_fetch(Doc doc, Where w, int argc, VALUE *argv) {
+    Leaf		leaf;
+    VALUE		val = Qnil;
+    Path		path = 0;
+    struct _Path	tmp;
+    struct _PathStep	steps[MAX_STACK];
+
+    if (1 <= argc) {
+	path = arg_path(*argv, &tmp, steps);
+	if (2 == argc) {
+	    val = argv[1];
+	}
+    }
+    if (0 != (leaf = get_doc_leaf(doc, w, path))) {
+	val = leaf_value(doc, leaf);
+    }
+    return val;
+}
+
+/* call-seq: fetch(path=nil) => nil, true, false, Fixnum, Float, String, Array, Hash
+ *
+ * Returns the value at the location identified by the path or the current
+ * location if the path is nil or not provided. This method will create and
+ * return an Array or Hash if that is the type of Object at the location
+ * specified. This is more expensive than navigating to the leaves of the JSON
+ * document.
+ * @param [String|Oj::Doc::Path] path path to the location to get the type of if provided
+ * @example
+ *   Oj::Doc.open('[1,2]') { |doc| doc.fetch() }      #=> [1, 2]
+ *   Oj::Doc.open('[1,2]') { |doc| doc.fetch('/1') }  #=> 1
+ */
+static VALUE
+doc_fetch(int argc, VALUE *argv, VALUE self) {
+    Doc	doc = self_doc(self);
+
+    return loc_fetch(doc, &doc->loc, argc, argv);
+}
+
+static VALUE
+shared_fetch(Shared shared, VALUE rpath) {
+    Leaf	leaf;
+    Path	path;
+
+    // the previous path may be in the other tmp so alternate between them
+    shared->cur = !shared->cur;
+    path = arg_path(rpath, &shared->tmp[shared->cur], shared->steps[shared->cur]);
+    if (0 == (leaf = get_shared_leaf(shared->doc, path, shared))) {
+	return shared->dflt;
+    }
+    return leaf_value(shared->doc, leaf);
+}
+
+/* call-seq: fetch_many(paths, default=nil) => Array
+ *
+ * Returns the values at each of the paths in a single call. Leading path
+ * elements shared with the previous path are only looked up once so listing
+ * paths grouped by their common prefix is fastest.
+ * @param [Array] paths Array of String or Oj::Doc::Path locations
+ * @param [Object] default value to return for each path that is not found
+ * @example
+ *   Oj::Doc.open('{"a":{"b":1,"c":2}}') { |doc| doc.fetch_many(['/a/b', '/a/c', '/x']) }  #=> [1, 2, nil]
+ */
+static VALUE
+doc_fetch_many(int argc, VALUE *argv, VALUE self) {
+    struct _Shared	shared;
+    long		i;
+    long		cnt;
+
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "wrong number of arguments (%d for 1..2)", argc);
+    }
+    Check_Type(*argv, T_ARRAY);
+    shared.doc = self_doc(self);
+    shared.prev = 0;
+    shared.cnt = 0;
+    shared.cur = 0;
+    shared.dflt = (2 == argc) ? argv[1] : Qnil;
+    cnt = RARRAY_LEN(*argv);
+    shared.result = rb_ary_new2(cnt);
+    for (i = 0; i < cnt; i++) {
+	rb_ary_push(shared.result, shared_fetch(&shared, rb_ary_entry(*argv, i)));
+    }
+    return shared.result;
+}
+
+static int
+fetch_hash_cb(VALUE key, VALUE rpath, VALUE x) {
+    Shared	shared = (Shared)x;
+
+    rb_hash_aset(shared->result, key, shared_fetch(shared, rpath));
+
+    return ST_CONTINUE;
+}
+
+/* call-seq: fetch_hash(paths, default=nil) => Hash
+ *
+ * Returns a Hash with the keys of the paths Hash and the values found at each
+ * of the corresponding paths, resolved the same way as #fetch_many.
+ * @param [Hash] paths names mapped to String or Oj::Doc::Path locations
+ * @param [Object] default value to use for each path that is not found
+ * @example
+ *   Oj::Doc.open('{"a":{"b":1,"c":2}}') { |doc| doc.fetch_hash(:b => '/a/b', :c => '/a/c') }  #=> {:b=>1, :c=>2}
+ */
+static VALUE
+doc_fetch_hash(int argc, VALUE *argv, VALUE self) {
+    struct _Shared	shared;
+
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "wrong number of arguments (%d for 1..2)", argc);
+    }
+    Check_Type(*argv, T_HASH);
+    shared.doc = self_doc(self);
+    shared.prev = 0;
+    shared.cnt = 0;
+    shared.cur = 0;
+    shared.dflt = (2 == argc) ? argv[1] : Qnil;
+    shared.result = rb_hash_new();
+    rb_hash_foreach(*argv, fetch_hash_cb, (VALUE)&shared);
+
+    return shared.result;
+}
+
+static void
+query_error(const char *msg, const char *seg) {
+    rb_raise(rb_eArgError, "%s in query segment '%s'.", msg, seg);
+}
+
+static char*
+skip_space(char *s) {
+    for (; ' ' == *s || '\t' == *s; s++) {
+    }
+    return s;
+}
+
+// Compiles the contents of a [?...] filter. The relative path is terminated
+// in place once the operator following it has been read.
+static PathStep
+filter_compile(QStep qs, char *s, const char *seg, PathStep ps, PathStep psend) {
+    char	*rel = skip_space(s);
+    char	*rend;
+
+    for (s = rel; '\0' != *s && ' ' != *s && '\t' != *s && 0 == strchr("=!<>", *s); s++) {
+    }
+    rend = s;
+    s = skip_space(s);
+    qs->op = 0;
+    if ('\0' != *s) {
+	switch (*s++) {
+	case '=':
+	    qs->op = '=';
+	    if ('=' == *s) {
+		s++;
+	    }
+	    break;
+	case '!':
+	    if ('=' != *s++) {
+		query_error("expected !=", seg);
+	    }
+	    qs->op = '!';
+	    break;
+	case '<':
+	    if ('=' == *s) {
+		s++;
+		qs->op = 'l';
+	    } else {
+		qs->op = '<';
+	    }
+	    break;
+	case '>':
+	    if ('=' == *s) {
+		s++;
+		qs->op = 'g';
+	    } else {
+		qs->op = '>';
+	    }
+	    break;
+	default:
+	    query_error("expected a comparison", seg);
+	    break;
+	}
+	s = skip_space(s);
+	if ('"' == *s || '\'' == *s) {
+	    char	*q = strchr(s + 1, *s);
+
+	    if (0 == q) {
+		query_error("string not terminated", seg);
+	    }
+	    qs->ltype = T_STRING;
+	    qs->str = s + 1;
+	    qs->slen = q - s - 1;
+	    s = q + 1;
+	} else if (0 == strncmp(s, "true", 4)) {
+	    qs->ltype = T_TRUE;
+	    s += 4;
+	} else if (0 == strncmp(s, "false", 5)) {
+	    qs->ltype = T_FALSE;
+	    s += 5;
+	} else if (0 == strncmp(s, "null", 4)) {
+	    qs->ltype = T_NIL;
+	    s += 4;
+	} else {
+	    char	*end;
+
+	    qs->ltype = T_FLOAT;
+	    qs->num = strtod(s, &end);
+	    if (end == s) {
+		query_error("expected a value", seg);
+	    }
+	    s = end;
+	}
+	if ('\0' != *skip_space(s)) {
+	    query_error("unexpected characters", seg);
+	}
+    }
+    if (rel == rend) {
+	query_error("expected a path", seg);
+    }
+    *rend = '\0';
+    qs->rel.steps = ps;
+    qs->rel.end = ps;
+    if (0 != strcmp("@", rel)) {
+	PathStep	step;
+
+	path_compile(&qs->rel, rel, ps, psend - ps);
+	for (step = qs->rel.steps; step < qs->rel.end; step++) {
+	    if (STEP_UP == step->type) {
+		query_error("'..' is not allowed in a filter", seg);
+	    }
+	}
+    }
+    return qs->rel.end;
+}
+
+static void
+slice_compile(QStep qs, char *s, const char *seg) {
+    char	*end;
+
+    qs->first = 1;
+    qs->last = -1;
+    s = skip_space(s);
+    if (':' != *s) {
+	qs->first = strtol(s, &end, 10);
+	if (end == s || 0 == qs->first) {
+	    query_error("expected a non-zero index", seg);
+	}
+	s = skip_space(end);
+	if ('\0' == *s) {
+	    qs->last = qs->first;
+	    return;
+	}
+	if (':' != *s) {
+	    query_error("expected :", seg);
+	}
+    }
+    s = skip_space(s + 1);
+    if ('\0' != *s) {
+	qs->last = strtol(s, &end, 10);
+	if (end == s || 0 == qs->last) {
+	    query_error("expected a non-zero index", seg);
+	}
+	if ('\0' != *skip_space(end)) {
+	    query_error("unexpected characters", seg);
+	}
+    }
+}
+
+// Compiles a query in place, the string is modified, and returns the end of
+// the steps.
+static QStep
+query_compile(char *s, QStep qs, PathStep ps) {
+    QStep	qend = qs + MAX_STACK;
+    PathStep	psend = ps + MAX_STACK;
+
+    if ('/' == *s) {
+	s++;
+    }
+    while ('\0' != *s) {
+	char	*seg = s;
+	char	*end;
+	char	*next;
+
+	if ('[' == *s) {
+	    // a filter path may include a '/' and a literal may include anything
+	    char	q = 0;
+
+	    for (end = s + 1; '\0' != *end && (0 != q || ']' != *end); end++) {
+		if (0 != q) {
+		    if (q == *end) {
+			q = 0;
+		    }
+		} else if ('"' == *end || '\'' == *end) {
+		    q = *end;
+		}
+	    }
+	    if (']' != *end) {
+		query_error("expected ]", seg);
+	    }
+	    *end++ = '\0';
+	    if ('\0' != *end && '/' != *end) {
+		query_error("expected / after ]", seg);
+	    }
+	} else if (0 == (end = strchr(s, '/'))) {
+	    end = s + strlen(s);
+	}
+	next = ('\0' == *end) ? end : end + 1;
+	*end = '\0';
+	s = next;
+	if ('\0' == *seg) {
+	    continue;
+	}
+	if (qend <= qs) {
+	    rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Query too deep. Limit is %d levels.", MAX_STACK);
+	}
+	if ('[' == *seg) {
+	    if ('?' == seg[1]) {
+		qs->step.type = STEP_FILTER;
+		ps = filter_compile(qs, seg + 2, seg, ps, psend);
+	    } else {
+		qs->step.type = STEP_SLICE;
+		slice_compile(qs, seg + 1, seg);
+	    }
+	} else if (0 == strcmp("*", seg)) {
+	    qs->step.type = STEP_ANY;
+	} else if (0 == strcmp("**", seg)) {
+	    qs->step.type = STEP_DESCEND;
+	} else {
+	    struct _Path	one;
+
+	    path_compile(&one, seg, &qs->step, 1);
+	}
+	qs++;
+    }
+    return qs;
+}
+
+static int
+query_test(Doc doc, QStep qs, Leaf leaf) {
+    PathStep	ps;
+    int		c = 0;
+
+    for (ps = qs->rel.steps; ps < qs->rel.end; ps++) {
+	if (COL_VAL != leaf->value_type || 0 == leaf_elements(doc, leaf) || 0 == (leaf = find_child(doc, leaf, ps))) {
+	    return 0;
+	}
+    }
+    if (0 == qs->op) {
+	return 1;
+    }
+    switch (qs->ltype) {
+    case T_FLOAT: {
+	double	d;
+
+	if (T_FIXNUM != leaf->rtype && T_FLOAT != leaf->rtype) {
+	    return '!' == qs->op;
+	}
+	d = (STR_VAL == leaf->value_type) ? strtod(leaf->str, 0) : rb_num2dbl(leaf->value);
+	c = (d < qs->num) ? -1 : (d > qs->num) ? 1 : 0;
+	break;
+    }
+    case T_STRING: {
+	const char	*str;
+	size_t		len;
+
+	if (T_STRING != leaf->rtype) {
+	    return '!' == qs->op;
+	}
+	if (STR_VAL == leaf->value_type) {
+	    str = leaf->str;
+	    len = oj_leaf_str_len(leaf);
+	} else {
+	    str = RSTRING_PTR(leaf->value);
+	    len = RSTRING_LEN(leaf->value);
+	}
+	if (0 == (c = memcmp(str, qs->str, (len < qs->slen) ? len : qs->slen))) {
+	    c = (len < qs->slen) ? -1 : (len > qs->slen) ? 1 : 0;
+	}
+	break;
+    }
+    default:
+	if (leaf->rtype != qs->ltype) {
+	    return '!' == qs->op;
+	}
+	break;
+    }
+    switch (qs->op) {
+    case '=':	return 0 == c;
+    case '!':	return 0 != c;
+    case '<':	return 0 > c;
+    case 'l':	return 0 >= c;
+    case '>':	return 0 < c;
+    case 'g':	return 0 <= c;
+    default:	return 0;
+    }
+}
+
+static void
+query_eval(Query q, Leaf *stack, Leaf *lp, QStep qs) {
+    Leaf	leaf = *lp;
+    Leaf	first;
+    Leaf	e;
+    long	i;
+
+    if (q->end <= qs) {
+	q->match(q, leaf);
+	return;
+    }
+    if (STEP_UP == qs->step.type) {
+	if (stack < lp) {
+	    query_eval(q, stack, lp - 1, qs + 1);
+	}
+	return;
+    }
+    if (STEP_DESCEND == qs->step.type) {
+	query_eval(q, stack, lp, qs + 1);
+    }
+    if (COL_VAL != leaf->value_type || 0 == leaf_elements(q->doc, leaf)) {
+	return;
+    }
+    if (MAX_STACK - 1 <= lp - stack) {
+	rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+    }
+    if (STEP_KEY == qs->step.type || STEP_INDEX == qs->step.type) {
+	if (0 != (e = find_child(q->doc, leaf, &qs->step))) {
+	    lp[1] = e;
+	    query_eval(q, stack, lp + 1, qs + 1);
+	}
+	return;
+    }
+    first = leaf->elements->next;
+    e = first;
+    if (STEP_SLICE == qs->step.type) {
+	long	cnt = (long)leaf->elements->index; // the last element has the count
+	long	from = (0 > qs->first) ? cnt + 1 + qs->first : qs->first;
+	long	to = (0 > qs->last) ? cnt + 1 + qs->last : qs->last;
+
+	if (T_ARRAY != leaf->rtype) {
+	    return;
+	}
+	for (i = 1; i <= to && i <= cnt; i++, e = e->next) {
+	    if (from <= i) {
+		lp[1] = e;
+		query_eval(q, stack, lp + 1, qs + 1);
+	    }
+	}
+	return;
+    }
+    do {
+	switch (qs->step.type) {
+	case STEP_ANY:
+	    lp[1] = e;
+	    query_eval(q, stack, lp + 1, qs + 1);
+	    break;
+	case STEP_DESCEND:
+	    lp[1] = e;
+	    query_eval(q, stack, lp + 1, qs);
+	    break;
+	case STEP_FILTER:
+	    if (query_test(q->doc, qs, e)) {
+		lp[1] = e;
+		query_eval(q, stack, lp + 1, qs + 1);
+	    }
+	    break;
+	default:
+	    break;
+	}
+	e = e->next;
+    } while (e != first);
+}
+
+static void
+query_collect(Query q, Leaf leaf) {
+    VALUE	v = leaf_value(q->doc, leaf);
+
+    if (Qnil == q->result) {
+	rb_yield(v);
+    } else {
+	rb_ary_push(q->result, v);
+    }
+}
+
+// Compiles and evaluates a query, calling the match function of q for each
+// match.
+static void
+query_run(Query q, VALUE self, VALUE rquery) {
+    struct _Path	base;
+    QStep		qsteps;
+    PathStep		psteps;
+    Leaf		stack[MAX_STACK];
+    Leaf		*lp;
+    volatile VALUE	buf;
+    char		*s;
+
+    q->doc = self_doc(self);
+    Check_Type(rquery, T_STRING);
+    // compiled in place so work on a copy
+    buf = rb_str_new(RSTRING_PTR(rquery), RSTRING_LEN(rquery));
+    s = RSTRING_PTR(buf);
+    qsteps = ALLOCA_N(struct _QStep, MAX_STACK);
+    psteps = ALLOCA_N(struct _PathStep, MAX_STACK);
+    base.absolute = ('/' == *s);
+    q->end = query_compile(s, qsteps, psteps);
+    if (0 != q->doc->data) {
+	lp = path_base(q->doc, &q->doc->loc, &base, stack);
+	query_eval(q, stack, lp, qsteps);
+    }
+}
+
+/* call-seq: query(query) { |value| ... } => Array
+ *
+ * Returns the values that match a query, or yields each one if a block is
+ * given. A query is a path that may also include these segments:
+ * - '*' matches every member of an Array or Hash
+ * - '**' matches the current location and everything below it
+ * - '[2:4]' matches Array elements 2 through 4, either bound can be left off
+ *   and negative values count back from the end so '[-1]' is the last element
+ * - '[?price > 10]' matches the members of an Array or Hash for which the
+ *   path relative to the member, '@' for the member itself, holds a value
+ *   that compares to the number, quoted string, true, false, or null with one
+ *   of ==, !=, <, <=, >, or >=. With no comparison the path must exist.
+ * @param [String] query query to match
+ * @yieldparam [Object] value each matching value
+ * @example
+ *   Oj::Doc.open('{"items":[{"price":5,"id":1},{"price":12,"id":2}]}') { |doc|
+ *       doc.query('/items/[?price > 10]/id')
+ *   }
+ *   #=> [2]
+ */
+static VALUE
+doc_query(VALUE self, VALUE rquery) {
+    struct _Query	q;
+
+    q.match = query_collect;
+    q.result = rb_block_given_p() ? Qnil : rb_ary_new();
+    query_run(&q, self, rquery);
+
+    return q.result;
+}
+
+static void
+agg_match(Query q, Leaf leaf) {
+    Agg		agg = (Agg)q->ctx;
+    double	d;
+
+    agg->total++;
+    if (T_FIXNUM == leaf->rtype) {
+	VALUE	big = Qnil;
+	int64_t	n = 0;
+
+	if (STR_VAL == leaf->value_type) {
+	    const char	*s = leaf->str;
+	    int		neg = ('-' == *s);
+
+	    if (neg || '+' == *s) {
+		s++;
+	    }
+	    for (; '0' <= *s && *s <= '9'; s++) {
+		n = n * 10 + (*s - '0');
+		if (NUM_MAX <= n) {
+		    big = rb_cstr_to_inum(leaf->str, 10, 0);
+		    break;
+		}
+	    }
+	    if (neg) {
+		n = -n;
+	    }
+	} else if (FIXNUM_P(leaf->value)) {
+	    n = NUM2LL(leaf->value);
+	} else {
+	    big = leaf->value;
+	}
+	if (Qnil == big) {
+	    if ((0 < n && INT64_MAX - n < agg->isum) || (0 > n && INT64_MIN - n > agg->isum)) {
+		big = rb_ll2inum(agg->isum);
+		agg->isum = 0;
+	    }
+	    agg->isum += n;
+	    d = (double)n;
+	} else {
+	    d = rb_num2dbl(big);
+	}
+	if (Qnil != big) {
+	    agg->ibig = (Qnil == agg->ibig) ? big : rb_funcall(agg->ibig, '+', 1, big);
+	}
+    } else if (T_FLOAT == leaf->rtype) {
+	d = (STR_VAL == leaf->value_type) ? strtod(leaf->str, 0) : rb_num2dbl(leaf->value);
+	agg->fsum += d;
+	agg->has_float = 1;
+    } else {
+	return;
+    }
+    if (0 == agg->cnt || d < agg->minv) {
+	agg->min = leaf;
+	agg->minv = d;
+    }
+    if (0 == agg->cnt || d > agg->maxv) {
+	agg->max = leaf;
+	agg->maxv = d;
+    }
+    agg->cnt++;
+}
+
+static void
+aggregate(Agg agg, VALUE self, VALUE rquery) {
+    struct _Query	q;
+
+    memset(agg, 0, sizeof(struct _Agg));
+    agg->ibig = Qnil;
+    q.match = agg_match;
+    q.ctx = agg;
+    query_run(&q, self, rquery);
+}
+
+static VALUE
+agg_isum(Agg agg) {
+    if (Qnil == agg->ibig) {
+	return LL2NUM(agg->isum);
+    }
+    return rb_funcall(agg->ibig, '+', 1, LL2NUM(agg->isum));
+}
+
+/* call-seq: count(query) => Fixnum
+ *
+ * Returns the number of values matching a query without building them.
+ * @param [String] query query as described for #query()
+ * @example
+ *   Oj::Doc.open('[1,2,"x"]') { |doc| doc.count('/[:]') }  #=> 3
+ */
+static VALUE
+doc_count(VALUE self, VALUE rquery) {
+    struct _Agg	agg;
+
+    aggregate(&agg, self, rquery);
+
+    return LONG2NUM(agg.total);
+}
+
+/* call-seq: sum(query) => Numeric
+ *
+ * Returns the sum of the numbers matching a query, ignoring other values. The
+ * numbers are read directly from the document. The sum is an Integer unless
+ * one of the numbers is a Float.
+ * @param [String] query query as described for #query()
+ * @example
+ *   Oj::Doc.open('{"orders":[{"total":3},{"total":4}]}') { |doc| doc.sum('/orders/[:]/total') }  #=> 7
+ */
+static VALUE
+doc_sum(VALUE self, VALUE rquery) {
+    struct _Agg	agg;
+
+    aggregate(&agg, self, rquery);
+    if (agg.has_float) {
+	return rb_float_new(agg.fsum + rb_num2dbl(agg_isum(&agg)));
+    }
+    return agg_isum(&agg);
+}
+
+/* call-seq: min(query) => Numeric
+ *
+ * Returns the smallest of the numbers matching a query or nil if none match.
+ * @param [String] query query as described for #query()
+ */
+static VALUE
+doc_min(VALUE self, VALUE rquery) {
+    struct _Agg	agg;
+
+    aggregate(&agg, self, rquery);
+    if (0 == agg.cnt) {
+	return Qnil;
+    }
+    return leaf_value(self_doc(self), agg.min);
+}
+
+/* call-seq: max(query) => Numeric
+ *
+ * Returns the largest of the numbers matching a query or nil if none match.
+ * @param [String] query query as described for #query()
+ */
+static VALUE
+doc_max(VALUE self, VALUE rquery) {
+    struct _Agg	agg;
+
+    aggregate(&agg, self, rquery);
+    if (0 == agg.cnt) {
+	return Qnil;
+    }
+    return leaf_value(self_doc(self), agg.max);
+}
+
+/* call-seq: avg(query) => Float
+ *
+ * Returns the average of the numbers matching a query or nil if none match.
+ * @param [String] query query as described for #query()
+ */
+static VALUE
+doc_avg(VALUE self, VALUE rquery) {
+    struct _Agg	agg;
+
+    aggregate(&agg, self, rquery);
+    if (0 == agg.cnt) {
+	return Qnil;
+    }
+    return rb_float_new((agg.fsum + rb_num2dbl(agg_isum(&agg))) / (double)agg.cnt);
+}
+
+static const char*
+doc_text(Doc doc, const char *str, size_t len) {
+    char	*t = text_alloc(doc, len + 1);
+
+    memcpy(t, str, len);
+    t[len] = '\0';
+
+    return t;
+}
+
+// Keeps the Ruby value of a leaf alive for as long as the leaf holds it. A
+// later edit of the same leaf replaces the entry.
+static void
+doc_keep(Doc doc, Leaf leaf, VALUE v) {
+    if (0 == doc->keep) {
+	doc->keep = st_init_numtable();
+    }
+    st_insert(doc->keep, (st_data_t)leaf, (st_data_t)v);
+}
+
+// Releases the Ruby values held by a leaf and its members.
+static void
+drop_kept(Doc doc, Leaf leaf) {
+    st_data_t	key = (st_data_t)leaf;
+
+    if (0 == doc->keep || 0 == doc->keep->num_entries) {
+	return;
+    }
+    if (RUBY_VAL == leaf->value_type) {
+	st_delete(doc->keep, &key, 0);
+    } else if (COL_VAL == leaf->value_type && 0 != leaf->elements && !(DEFERRED & leaf->span)) {
+	Leaf	first = leaf->elements->next;
+	Leaf	e = first;
+
+	do {
+	    drop_kept(doc, e);
+	    e = e->next;
+	} while (e != first);
+    }
+}
+
+// Drops the child index of a container whose members are changing.
+static void
+drop_index(Doc doc, Leaf leaf) {
+    st_data_t	key = (st_data_t)leaf;
+    st_data_t	ci;
+
+    if (Yes == leaf->indexed && 0 != doc->indexes && st_delete(doc->indexes, &key, &ci)) {
+	free_index_cb(key, ci, 0);
+    }
+    leaf->indexed = NotSet;
+}
+
+// Drops the memoized values and text spans of the containers on the stack
+// down to lp.
+static void
+drop_cached(Doc doc, Leaf *stack, Leaf *lp) {
+    for (; stack <= lp; stack++) {
+	st_data_t	key = (st_data_t)*stack;
+	st_data_t	span;
+
+	if (0 != doc->frozen) {
+	    st_delete(doc->frozen, &key, 0);
+	}
+	if (0 != doc->spans && st_delete(doc->spans, &key, &span)) {
+	    xfree((Span)span);
+	}
+    }
+}
+
+static unsigned long
+leaf_count(Doc doc, Leaf leaf) {
+    unsigned long	cnt = 1;
+
+    if (DEFERRED & leaf->span) {
+	return doc->tape[leaf->jump].cnt & ~JUMP_PLAIN;
+    }
+    if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
+	Leaf	first = leaf->elements->next;
+	Leaf	e = first;
+
+	do {
+	    cnt += leaf_count(doc, e);
+	    e = e->next;
+	} while (e != first);
+    }
+    return cnt;
+}
+
+static void	leaf_set_value(Doc doc, Leaf leaf, VALUE value);
+
+typedef struct _Edit {
+    Doc		doc;
+    Leaf	leaf;
+} *Edit;
+
+static Leaf
+member_new(Doc doc, Leaf parent, VALUE value) {
+    Leaf	e = leaf_new(doc, T_NIL);
+
+    leaf_set_value(doc, e, value);
+    e->parent_type = parent->rtype;
+
+    return e;
+}
+
+static int
+set_member_cb(VALUE key, VALUE value, VALUE x) {
+    Edit	edit = (Edit)x;
+    Leaf	e;
+
+    if (T_SYMBOL == rb_type(key)) {
+	key = rb_sym_to_s(key);
+    } else if (T_STRING != rb_type(key)) {
+	rb_raise(rb_eTypeError, "Hash keys must be Strings or Symbols.");
+    }
+    e = member_new(edit->doc, edit->leaf, value);
+    e->key = doc_text(edit->doc, RSTRING_PTR(key), RSTRING_LEN(key));
+    leaf_append_element(edit->leaf, e);
+
+    return ST_CONTINUE;
+}
+
+// Replaces the value of a leaf, keeping its place in the parent, with leaves
+// built from a Ruby value.
+static void
+leaf_set_value(Doc doc, Leaf leaf, VALUE value) {
+    drop_cached(doc, &leaf, &leaf);
+    drop_kept(doc, leaf);
+    leaf->span &= ~(STR_SPAN | DEFERRED);
+    if (NotSet != leaf->indexed) {
+	drop_index(doc, leaf);
+    }
+    switch (rb_type(value)) {
+    case T_NIL:
+    case T_TRUE:
+    case T_FALSE:
+	leaf->rtype = rb_type(value);
+	break;
+    case T_FIXNUM:
+    case T_BIGNUM:
+	leaf->rtype = T_FIXNUM;
+	break;
+    case T_FLOAT:
+	leaf->rtype = T_FLOAT;
+	break;
+    case T_SYMBOL:
+	value = rb_sym_to_s(value);
+	// fall through
+    case T_STRING:
+	value = rb_str_new_frozen(value);
+	leaf->rtype = T_STRING;
+	break;
+    case T_ARRAY: {
+	long	i;
+	long	cnt = RARRAY_LEN(value);
+	Leaf	e;
+
+	leaf->rtype = T_ARRAY;
+	leaf->value_type = COL_VAL;
+	leaf->elements = 0;
+	doc->size++;
+	for (i = 0; i < cnt; i++) {
+	    e = member_new(doc, leaf, rb_ary_entry(value, i));
+	    e->index = i + 1;
+	    leaf_append_element(leaf, e);
+	}
+	return;
+    }
+    case T_HASH: {
+	struct _Edit	edit;
+
+	leaf->rtype = T_HASH;
+	leaf->value_type = COL_VAL;
+	leaf->elements = 0;
+	doc->size++;
+	edit.doc = doc;
+	edit.leaf = leaf;
+	rb_hash_foreach(value, set_member_cb, (VALUE)&edit);
+	return;
+    }
+    default:
+	rb_raise(rb_eTypeError, "Can not set a %s in an Oj::Doc.", rb_class2name(rb_obj_class(value)));
+	break;
+    }
+    if (!SPECIAL_CONST_P(value)) {
+	doc_keep(doc, leaf, value);
+    }
+    leaf->value = value;
+    leaf->value_type = RUBY_VAL;
+    doc->size++;
+}
+
+// Resolves all but the last step of a path, leaving the parent on top of the
+// stack, and returns the last step.
+static PathStep
+edit_target(Doc doc, Path path, Leaf *stack, Leaf **lpp) {
+    Leaf	*lp;
+    PathStep	step;
+    PathStep	last = path->end - 1;
+
+    if (0 == doc->data || path->end <= path->steps) {
+	rb_raise(rb_eArgError, "Can not edit the root of a document.");
+    }
+    if (STEP_UP == last->type) {
+	rb_raise(rb_eArgError, "The path %s does not end with a key or index.", path->str);
+    }
+    lp = path_base(doc, &doc->loc, path, stack);
+    for (step = path->steps; step < last; step++) {
+	if (STEP_UP == step->type) {
+	    if (stack == lp) {
+		lp = 0;
+		break;
+	    }
+	    lp--;
+	} else {
+	    Leaf	e;
+
+	    if (COL_VAL != (*lp)->value_type || 0 == leaf_elements(doc, *lp) || 0 == (e = find_child(doc, *lp, step))) {
+		lp = 0;
+		break;
+	    }
+	    if (MAX_STACK - 1 <= lp - stack) {
+		rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+	    }
+	    lp++;
+	    *lp = e;
+	}
+    }
+    if (0 == lp || COL_VAL != (*lp)->value_type) {
+	rb_raise(rb_eArgError, "Failed to locate the parent of %s.", path->str);
+    }
+    *lpp = lp;
+
+    return last;
+}
+
+// Renumbers the members of an Array after one is added or removed.
+static void
+renumber(Leaf leaf) {
+    if (0 != leaf->elements) {
+	Leaf	first = leaf->elements->next;
+	Leaf	e = first;
+	size_t	i = 1;
+
+	do {
+	    e->index = i++;
+	    e = e->next;
+	} while (e != first);
+    }
+}
+
+/* call-seq: set(path, value) => Object
+ *
+ * Sets the value at a location in the document. An existing value is
+ * replaced, a missing key is added to an Object, and an index one past the
+ * end of an Array appends to it. The value may be nil, true, false, an
+ * Integer, Float, String, Symbol, or an Array or Hash of those.
+ * @param [String|Oj::Doc::Path] path location to set
+ * @param [Object] value value to set
+ * @example
+ *   Oj::Doc.open('{"a":1}') { |doc| doc.set('/b', [2]); doc.dump }  #=> '{"a":1,"b":[2]}'
+ */
+static VALUE
+doc_set(VALUE self, VALUE rpath, VALUE value) {
+    Doc			doc = self_doc(self);
+    Path		path;
+    struct _Path	tmp;
+    struct _PathStep	steps[MAX_STACK];
+    Leaf		stack[MAX_STACK];
+    Leaf		*lp;
+    Leaf		parent;
+    Leaf		e = 0;
+    PathStep		last;
+
+    path = arg_path(rpath, &tmp, steps);
+    last = edit_target(doc, path, stack, &lp);
+    parent = *lp;
+    drop_cached(doc, stack, lp);
+    doc->edited = 1;
+    if (0 != leaf_elements(doc, parent)) {
+	e = find_child(doc, parent, last);
+    }
+    if (0 != e) {
+	doc->size -= leaf_count(doc, e);
+	leaf_set_value(doc, e, value);
+	return value;
+    }
+    if (T_ARRAY == parent->rtype) {
+	size_t	cnt = (0 == leaf_elements(doc, parent)) ? 0 : parent->elements->index;
+
+	if (STEP_INDEX != last->type || cnt + 1 != last->index) {
+	    rb_raise(rb_eArgError, "Failed to locate %s.", path->str);
+	}
+	e = member_new(doc, parent, value);
+	e->index = cnt + 1;
+    } else {
+	e = member_new(doc, parent, value);
+	e->key = doc_text(doc, last->key, last->klen);
+    }
+    drop_index(doc, parent);
+    leaf_append_element(parent, e);
+
+    return value;
+}
+
+/* call-seq: delete(path) => Object
+ *
+ * Removes the value at a location in the document and returns it, or nil if
+ * there was nothing to remove. Array elements after it move down by one.
+ * @param [String|Oj::Doc::Path] path location to remove
+ * @example
+ *   Oj::Doc.open('{"a":1,"b":2}') { |doc| doc.delete('/a'); doc.dump }  #=> '{"b":2}'
+ */
+static VALUE
+doc_delete(VALUE self, VALUE rpath) {
+    Doc			doc = self_doc(self);
+    Path		path;
+    struct _Path	tmp;
+    struct _PathStep	steps[MAX_STACK];
+    Leaf		stack[MAX_STACK];
+    Leaf		*lp;
+    Leaf		*wp;
+    Leaf		parent;
+    Leaf		e;
+    Leaf		prev;
+    PathStep		last;
+    VALUE		value;
+
+    path = arg_path(rpath, &tmp, steps);
+    last = edit_target(doc, path, stack, &lp);
+    parent = *lp;
+    if (0 == leaf_elements(doc, parent) || 0 == (e = find_child(doc, parent, last))) {
+	return Qnil;
+    }
+    value = leaf_value(doc, e);
+    drop_cached(doc, stack, lp);
+    drop_index(doc, parent);
+    drop_kept(doc, e);
+    doc->edited = 1;
+    for (prev = e; e != prev->next; prev = prev->next) {
+    }
+    if (prev == e) {
+	parent->elements = 0;
+    } else {
+	prev->next = e->next;
+	if (parent->elements == e) {
+	    parent->elements = prev;
+	}
+    }
+    if (T_ARRAY == parent->rtype) {
+	renumber(parent);
+    }
+    doc->size -= leaf_count(doc, e);
+    // the current location can not be in the removed branch
+    for (wp = doc->loc.where_path + 1; wp <= doc->loc.where; wp++) {
+	if (*wp == e) {
+	    doc->loc.where = wp - 1;
+	    break;
+	}
+    }
+    return value;
+}
+
+/* call-seq: insert(path, value) => Object
+ *
+ * Inserts a value into an Array before the element at the index of the path,
+ * or at the end if the index is one past the last element. For an Object
+ * this is the same as #set().
+ * @param [String|Oj::Doc::Path] path location to insert at
+ * @param [Object] value value to insert
+ * @example
+ *   Oj::Doc.open('[1,3]') { |doc| doc.insert('/2', 2); doc.dump }  #=> '[1,2,3]'
+ */
+static VALUE
+doc_insert(VALUE self, VALUE rpath, VALUE value) {
+    Doc			doc = self_doc(self);
+    Path		path;
+    struct _Path	tmp;
+    struct _PathStep	steps[MAX_STACK];
+    Leaf		stack[MAX_STACK];
+    Leaf		*lp;
+    Leaf		parent;
+    Leaf		e;
+    PathStep		last;
+    size_t		cnt;
+
+    path = arg_path(rpath, &tmp, steps);
+    last = edit_target(doc, path, stack, &lp);
+    parent = *lp;
+    if (T_ARRAY != parent->rtype) {
+	return doc_set(self, rpath, value);
+    }
+    cnt = (0 == leaf_elements(doc, parent)) ? 0 : parent->elements->index;
+    if (STEP_INDEX != last->type || 0 == last->index || cnt + 1 < last->index) {
+	rb_raise(rb_eArgError, "Failed to locate %s.", path->str);
+    }
+    drop_cached(doc, stack, lp);
+    drop_index(doc, parent);
+    doc->edited = 1;
+    e = member_new(doc, parent, value);
+    if (cnt < last->index) {
+	leaf_append_element(parent, e);
+    } else {
+	Leaf	prev = parent->elements; // the last element is before the first
+
+	for (; prev->next->index < last->index; prev = prev->next) {
+	}
+	e->next = prev->next;
+	prev->next = e;
+    }
+    renumber(parent);
+
+    return value;
+}
+
+static VALUE
+loc_each_leaf(Doc doc, Where w, int argc, VALUE *argv, VALUE self) {
+    if (rb_block_given_p()) {
+	Leaf			save_path[MAX_STACK];
+	Path			path = 0;
+	struct _Path		tmp;
+	struct _PathStep	steps[MAX_STACK];
+	size_t			wlen;
+
+	wlen = w->where - w->where_path;
+	if (0 < wlen) {
+	    memcpy(save_path, w->where_path, sizeof(Leaf) * (wlen + 1));
+	}
+	if (1 <= argc) {
+	    path = arg_path(*argv, &tmp, steps);
+	    if (path->absolute) {
+		w->where = w->where_path;
+	    }
+	    if (0 != move_step(doc, w, path->steps, path->end, 1)) {
+		if (0 < wlen) {
+		    memcpy(w->where_path, save_path, sizeof(Leaf) * (wlen + 1));
+		}
+		w->where = w->where_path + wlen;
+		return Qnil;
+	    }
+	}
+	each_leaf(doc, w, self);
+	if (0 < wlen) {
+	    memcpy(w->where_path, save_path, sizeof(Leaf) * (wlen + 1));
+	}
+	w->where = w->where_path + wlen;
+    }
+    return Qnil;
+}
+
+/* call-seq: each_leaf(path=nil) => nil
+ *
+ * Yields to the provided block for each leaf node with the identified
+ * location of the JSON document as the root. The parameter passed to the
+ * block on yield is the Doc instance after moving to the child location.
+ * @param [String|Oj::Doc::Path] path if provided it identified the top of the branch to process the leaves of
+ * @yieldparam [Doc] Doc at the child location
+ * @example
+ *   Oj::Doc.open('[3,[2,1]]') { |doc|
+ *       result = {}
+ *       doc.each_leaf() { |d| result[d.where?] = d.fetch() }
+ *       result
+ *   }
+ *   #=> ["/1" => 3, "/2/1" => 2, "/2/2" => 1]
+ */
+static VALUE
+doc_each_leaf(int argc, VALUE *argv, VALUE self) {
+    Doc	doc = self_doc(self);
+
+    return loc_each_leaf(doc, &doc->loc, argc, argv, self);
+}
+
+static VALUE
+loc_move(Doc doc, Where w, VALUE str) {
+    Path		path;
+    struct _Path	tmp;
+    struct _PathStep	steps[MAX_STACK];
+    int			loc;
+
+    path = arg_path(str, &tmp, steps);
+    if (path->absolute) {
+	w->where = w->where_path;
+    }
+    if (0 != (loc = move_step(doc, w, path->steps, path->end, 1))) {
+	rb_raise(rb_eArgError, "Failed to locate element %d of the path %s.", loc, path->str);
+    }
+    return Qnil;
+}
+
+/* call-seq: move(path) => nil
+ *
+ * Moves the document marker to the path specified. The path can an absolute
+ * path or a relative path.
+ * @param [String|Oj::Doc::Path] path path to the location to move to
+ * @example
+ *   Oj::Doc.open('{"one":[1,2]') { |doc| doc.move('/one/2'); doc.where? }  #=> "/one/2"
+ */
+static VALUE
+doc_move(VALUE self, VALUE str) {
+    Doc	doc = self_doc(self);
+
+    return loc_move(doc, &doc->loc, str);
+}
+
+static VALUE
+loc_each_child(Doc doc, Where w, int argc, VALUE *argv, VALUE self) {
+    if (rb_block_given_p()) {
+	Leaf			save_path[MAX_STACK];
+	Path			path = 0;
+	struct _Path		tmp;
+	struct _PathStep	steps[MAX_STACK];
+	size_t			wlen;
+
+	wlen = w->where - w->where_path;
+	if (0 < wlen) {
+	    memcpy(save_path, w->where_path, sizeof(Leaf) * (wlen + 1));
+	}
+	if (1 <= argc) {
+	    path = arg_path(*argv, &tmp, steps);
+	    if (path->absolute) {
+		w->where = w->where_path;
+	    }
+	    if (0 != move_step(doc, w, path->steps, path->end, 1)) {
+		if (0 < wlen) {
+		    memcpy(w->where_path, save_path, sizeof(Leaf) * (wlen + 1));
+		}
+		w->where = w->where_path + wlen;
+		return Qnil;
+	    }
+	}
+	if (COL_VAL == (*w->where)->value_type && 0 != leaf_elements(doc, *w->where)) {
+	    Leaf	first = (*w->where)->elements->next;
+	    Leaf	e = first;
+
+	    w->where++;
+	    do {
+		*w->where = e;
+		rb_yield(self);
+		e = e->next;
+	    } while (e != first);
+	}
+	if (0 < wlen) {
+	    memcpy(w->where_path, save_path, sizeof(Leaf) * (wlen + 1));
+	}
+	w->where = w->where_path + wlen;
+    }
+    return Qnil;
+}
+
+/* call-seq: each_child(path=nil) { |doc| ... } => nil
+ *
+ * Yields to the provided block for each immediate child node with the
+ * identified location of the JSON document as the root. The parameter passed
+ * to the block on yield is the Doc instance after moving to the child
+ * location.
+ * @param [String|Oj::Doc::Path] path if provided it identified the top of the branch to process the chilren of
+ * @yieldparam [Doc] Doc at the child location
+ * @example
+ *   Oj::Doc.open('[3,[2,1]]') { |doc|
+ *       result = []
+ *       doc.each_value('/2') { |doc| result << doc.where? }
+ *       result
+ *   }
+ *   #=> ["/2/1", "/2/2"]
+ */
+static VALUE
+doc_each_child(int argc, VALUE *argv, VALUE self) {
+    Doc	doc = self_doc(self);
+
+    return loc_each_child(doc, &doc->loc, argc, argv, self);
+}
+
+static VALUE
+loc_each_value(Doc doc, Where w, int argc, VALUE *argv) {
+    if (rb_block_given_p()) {
+	Path			path = 0;
+	struct _Path		tmp;
+	struct _PathStep	steps[MAX_STACK];
+	Leaf			leaf;
+
+	if (1 <= argc) {
+	    path = arg_path(*argv, &tmp, steps);
+	}
+	if (0 != (leaf = get_doc_leaf(doc, w, path))) {
+	    each_value(doc, leaf);
+	}
+    }
+    return Qnil;
+}
+
+/* call-seq: each_value(path=nil) { |val| ... } => nil
+ *
+ * Yields to the provided block for each leaf value in the identified location
+ * of the JSON document. The parameter passed to the block on yield is the
+ * value of the leaf. Only those leaves below the element specified by the
+ * path parameter are processed.
+ * @param [String|Oj::Doc::Path] path if provided it identified the top of the branch to process the leaf values of
+ * @yieldparam [Object] val each leaf value
+ * @example
+ *   Oj::Doc.open('[3,[2,1]]') { |doc|
+ *       result = []
+ *       doc.each_value() { |v| result << v }
+ *       result
+ *   }
+ *   #=> [3, 2, 1]
+ *   
+ *   Oj::Doc.open('[3,[2,1]]') { |doc|
+ *       result = []
+ *       doc.each_value('/2') { |v| result << v }
+ *       result
+ *   }
+ *   #=> [2, 1]
+ */
+static VALUE
+doc_each_value(int argc, VALUE *argv, VALUE self) {
+    Doc	doc = self_doc(self);
+
+    return loc_each_value(doc, &doc->loc, argc, argv);
+}
+
+typedef struct _RawCtx {
+    Doc		doc;
+    int		raw;	// the unmodified text can be used
+} *RawCtx;
+
+// Copies compact containers that have not been edited straight from the
+// unmodified text. Deferred containers are copied the same way or built so
+// they can be dumped.
+static const char*
+leaf_raw(void *ctx, Leaf leaf, size_t *lenp) {
+    Doc		doc = ((RawCtx)ctx)->doc;
+    int		raw = ((RawCtx)ctx)->raw;
+    const char	*text;
+    st_data_t	v;
+    Span	span;
+
+    if (DEFERRED & leaf->span) {
+	Jump	j = doc->tape + leaf->jump;
+
+	if (raw && (JUMP_PLAIN & j->cnt)) {
+	    *lenp = j->end - j->start;
+	    return doc->text + j->start;
+	}
+	leaf_expand(doc, leaf);
+    }
+    if (!raw || 0 == doc->spans || !st_lookup(doc->spans, (st_data_t)leaf, &v)) {
+	return 0;
+    }
+    span = (Span)v;
+    *lenp = span->len;
+    if (Qnil != doc->orig_str) {
+	text = RSTRING_PTR(doc->orig_str);
+    } else if (0 != doc->orig) {
+	text = doc->orig;
+    } else {
+	text = doc->text; // parsed without writing to it
+    }
+    return text + span->off;
+}
+
+static VALUE
+loc_dump(Doc doc, Where w, int argc, VALUE *argv) {
+    Leaf		leaf;
+    Path		path = 0;
+    struct _Path	tmp;
+    struct _PathStep	steps[MAX_STACK];
+    const char		*filename = 0;
+
+    if (1 <= argc) {
+	if (Qnil != *argv) {
+	    path = arg_path(*argv, &tmp, steps);
+	}
+	if (2 <= argc) {
+	    Check_Type(argv[1], T_STRING);
+	    filename = StringValuePtr(argv[1]);
+	}
+    }
+    if (0 != (leaf = get_doc_leaf(doc, w, path))) {
+	struct _RawCtx	ctx;
+	LeafRaw		raw = 0;
+	VALUE		rjson;
+
+	// the unmodified text is only the same as the dump when compact
+	ctx.doc = doc;
+	ctx.raw = (0 == oj_default_options.indent && JSONEsc == oj_default_options.escape_mode);
+	if ((ctx.raw && 0 != doc->spans) || 0 != doc->tape) {
+	    raw = leaf_raw;
+	}
+	if (0 == filename) {
+	    char	buf[4096];
+	    struct _Out out;
+
+	    out.buf = buf;
+	    out.end = buf + sizeof(buf) - 10;
+	    out.allocated = 0;
+	    oj_dump_leaf_to_json(leaf, &oj_default_options, &out, raw, &ctx);
+	    rjson = rb_str_new2(out.buf);
+	    if (out.allocated) {
+		xfree(out.buf);
+	    }
+	} else {
+	    oj_write_leaf_to_file(leaf, filename, &oj_default_options, raw, &ctx);
+	    rjson = Qnil;
+	}
+	return rjson;
+    }
+    return Qnil;
+}
+
+/* call-seq: dump(path=nil) => String
+ *
+ * Dumps the document or nodes to a new JSON document. It uses the default
+ * options for generating the JSON.
+ * @param [String|Oj::Doc::Path] path if provided it identified the top of the branch to dump to JSON
+ * @param [String] filename if provided it is the filename to write the output to
+ * @example
+ *   Oj::Doc.open('[3,[2,1]]') { |doc|
+ *       doc.dump('/2')
+ *   }
+ *   #=> "[2,1]"
+ */
+static VALUE
+doc_dump(int argc, VALUE *argv, VALUE self) {
+    Doc	doc = self_doc(self);
+
+    return loc_dump(doc, &doc->loc, argc, argv);
+}
+
+typedef struct _IndexOut {
+    Doc		doc;
+    FILE	*f;
+    uint64_t	cnt;
+    char	*extra;	    // text for values that are not in the doc text
+    size_t	elen;
+    size_t	ecap;
+} *IndexOut;
+
+// Returns the text offset of a terminated string, appending it to the extra
+// text if it is not already in the doc text.
+static uint64_t
+index_text(IndexOut out, const char *str, size_t len) {
+    Doc		doc = out->doc;
+    uint64_t	off;
+
+    // spans in text parsed in place are not terminated so they are copied
+    if (doc->text <= str && str < doc->text + doc->tlen && '\0' == str[len]) {
+	return str - doc->text;
+    }
+    if (out->ecap < out->elen + len + 1) {
+	out->ecap = (out->ecap + len + 1) * 2;
+	if (0 == out->extra) {
+	    out->extra = ALLOC_N(char, out->ecap);
+	} else {
+	    REALLOC_N(out->extra, char, out->ecap);
+	}
+    }
+    off = doc->tlen + out->elen;
+    memcpy(out->extra + out->elen, str, len);
+    out->elen += len;
+    out->extra[out->elen++] = '\0';
+
+    return off;
+}
+
+static void
+index_write_leaf(IndexOut out, Leaf leaf) {
+    struct _IndexLeaf	rec;
+
+    memset(&rec, 0, sizeof(rec));
+    if (T_HASH == leaf->parent_type) {
+	rec.key = (index_text(out, leaf->key, oj_leaf_key_len(leaf)) + 1) << 8;
+    }
+    rec.key |= leaf->rtype;
+    switch (leaf->rtype) {
+    case T_ARRAY:
+    case T_HASH:
+	if (0 != leaf_elements(out->doc, leaf)) {
+	    Leaf	first = leaf->elements->next;
+	    Leaf	e = first;
+
+	    do {
+		rec.str++;
+		e = e->next;
+	    } while (e != first);
+	}
+	break;
+    case T_FIXNUM:
+    case T_FLOAT:
+    case T_STRING:
+	if (STR_VAL == leaf->value_type) {
+	    rec.str = index_text(out, leaf->str, oj_leaf_str_len(leaf));
+	} else if (T_STRING == leaf->rtype) {
+	    rec.str = index_text(out, RSTRING_PTR(leaf->value), RSTRING_LEN(leaf->value));
+	} else if (T_FLOAT == leaf->rtype) {
+	    char	buf[32];
+	    double	d = rb_num2dbl(leaf->value);
+
+	    if (isinf(d)) {
+		strcpy(buf, (0.0 < d) ? "1e999" : "-1e999");
+	    } else {
+		snprintf(buf, sizeof(buf), "%0.17g", d);
+	    }
+	    rec.str = index_text(out, buf, strlen(buf));
+	} else {
+	    volatile VALUE	rstr = rb_funcall(leaf->value, rb_intern("to_s"), 0);
+
+	    rec.str = index_text(out, RSTRING_PTR(rstr), RSTRING_LEN(rstr));
+	}
+	break;
+    default:
+	break;
+    }
+    fwrite(&rec, sizeof(rec), 1, out->f);
+    out->cnt++;
+    if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
+	Leaf	first = leaf->elements->next;
+	Leaf	e = first;
+
+	do {
+	    index_write_leaf(out, e);
+	    e = e->next;
+	} while (e != first);
+    }
+}
+
+/* call-seq: save_index(filename) => nil
+ *
+ * Writes the parsed structure of a document opened with #open_file() to an
+ * index file. Passing that file as the :index option of #open_file() loads the
+ * document without parsing as long as the JSON file has not changed. The
+ * index includes the text of the document so it is about the size of the JSON
+ * plus 16 bytes per leaf. A document changed with #set(), #delete(), or
+ * #insert() no longer matches the file and raises an ArgumentError.
+ * @param [String] filename name of the index file to write
+ * @example
+ *   Oj::Doc.open_file('big.json') { |doc| doc.save_index('big.json.idx') }
+ *   Oj::Doc.open_file('big.json', :index => 'big.json.idx') { |doc| doc.fetch('/1') }
+ */
+static VALUE
+doc_save_index(VALUE self, VALUE filename) {
+    Doc			doc = self_doc(self);
+    struct _IndexHead	head;
+    struct _IndexOut	out;
+    const char		*path;
+    char		*tmp;
+    int			err;
+
+    if (0 > doc->stamp.size) {
+	rb_raise(rb_eArgError, "Only documents opened with Oj::Doc.open_file can be indexed.");
+    }
+    if (doc->edited) {
+	rb_raise(rb_eArgError, "An edited document no longer matches its file and can not be indexed.");
+    }
+    Check_Type(filename, T_STRING);
+    path = StringValuePtr(filename);
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, INDEX_MAGIC, sizeof(head.magic));
+    head.order = INDEX_ORDER;
+    head.rec_size = sizeof(struct _IndexLeaf);
+    head.stamp = doc->stamp;
+    // Written to a temporary file and renamed so a document or another process
+    // that has the old index mapped is not affected.
+    tmp = ALLOCA_N(char, strlen(path) + 5);
+    sprintf(tmp, "%s.tmp", path);
+    if (0 == (out.f = fopen(tmp, "wb"))) {
+	rb_raise(rb_eIOError, "%s", strerror(errno));
+    }
+    out.doc = doc;
+    out.cnt = 0;
+    out.extra = 0;
+    out.elen = 0;
+    out.ecap = 0;
+    fwrite(&head, sizeof(head), 1, out.f); // rewritten once the counts are known
+    if (0 != doc->data) {
+	index_write_leaf(&out, doc->data);
+    }
+    fwrite(doc->text, 1, doc->tlen, out.f);
+    if (0 < out.elen) {
+	fwrite(out.extra, 1, out.elen, out.f);
+    }
+    xfree(out.extra);
+    head.cnt = out.cnt;
+    head.tlen = doc->tlen + out.elen;
+    fseek(out.f, 0, SEEK_SET);
+    fwrite(&head, sizeof(head), 1, out.f);
+    err = ferror(out.f);
+    if (0 != fclose(out.f) || 0 != err) {
+	remove(tmp);
+	rb_raise(rb_eIOError, "Failed to write %s.", path);
+    }
+#if IS_WINDOWS
+    remove(path);
+#endif
+    if (0 != rename(tmp, path)) {
+	err = errno;
+	remove(tmp);
+	rb_raise(rb_eIOError, "%s", strerror(err));
+    }
+    return Qnil;
+}
+
+/* call-seq: size() => Fixnum
+ *
+ * Returns the number of nodes in the JSON document where a node is any one of
+ * the basic JSON components.
+ * @return Returns the size of the JSON document.
+ * @example
+ *   Oj::Doc.open('[1,2,3]') { |doc| doc.size() }  #=> 4
+ */
+static VALUE
+doc_size(VALUE self) {
+    return ULONG2NUM(((Doc)DATA_PTR(self))->size);
+}
+
+/* call-seq: close() => nil
+ *
+ * Closes an open document. No further calls to the document will be valid
+ * after closing.
+ * @example
+ *   doc = Oj::Doc.open('[1,2,3]')
+ *   doc.size()  #=> 4
+ *   doc.close()
+ */
+static VALUE
+doc_close(VALUE self) {
+    Doc		doc = self_doc(self);
+
+    rb_gc_unregister_address(&doc->self);
+    DATA_PTR(doc->self) = 0;
+    if (0 != doc) {
+	json_free(doc->json, doc->mapped);
+	doc_free(doc);
+	doc_release(doc);
+    }
+    return Qnil;
+}
+static void
+path_free(void *ptr) {
+    Path	path = (Path)ptr;
+
+    if (0 != path) {
+	xfree((char*)path->str);
+	xfree(path->steps);
+	xfree(path);
+    }
+}
+
+/* Document-method: Oj::Doc::Path.new
+ *   call-seq: new(path) => Oj::Doc::Path
+ *
+ * Compiles a path into steps once so that it can be passed to any Doc method
+ * that takes a path without being parsed again on each call.
+ * @param [String] path path to compile
+ * @example
+ *   price = Oj::Doc::Path.new('/items/3/price')
+ *   Oj::Doc.open(json) { |doc| doc.fetch(price) }
+ */
+static VALUE
+path_new(VALUE clas, VALUE rpath) {
+    Path	path;
+    char	*str;
+    const char	*s;
+    size_t	len;
+    size_t	cnt = 1;
+
+    Check_Type(rpath, T_STRING);
+    s = StringValuePtr(rpath);
+    len = strlen(s);
+    for (str = (char*)s; '\0' != *str; str++) {
+	if ('/' == *str) {
+	    cnt++;
+	}
+    }
+    if (MAX_STACK < cnt) {
+	rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+    }
+    str = ALLOC_N(char, len + 1);
+    memcpy(str, s, len + 1);
+    path = ALLOC(struct _Path);
+    path->steps = ALLOC_N(struct _PathStep, cnt);
+    path_compile(path, str, path->steps, cnt);
+
+    return Data_Wrap_Struct(clas, 0, path_free, path);
+}
+
+/* call-seq: to_s() => String
+ *
+ * Returns the path String the Path was compiled from.
+ */
+static VALUE
+path_to_s(VALUE self) {
+    return rb_str_new2(((Path)DATA_PTR(self))->str);
+}
+
+// A Cursor only reads the leaves of the Doc. Those are only changed, such as
+// when a value is built or a child index is added, while the GVL is held so
+// threads can each have a Cursor on the same Doc.
+typedef struct _Cursor {
+    VALUE		doc;
+    struct _Where	loc;
+} *Cursor;
+
+static void
+mark_cursor_cb(void *ptr) {
+    if (0 != ptr) {
+	rb_gc_mark(((Cursor)ptr)->doc);
+    }
+}
+
+static void
+cursor_free(void *ptr) {
+    xfree(ptr);
+}
+
+static VALUE
+cursor_new(Doc doc, VALUE rdoc, Where from, int argc, VALUE *argv) {
+    Cursor	c = ALLOC(struct _Cursor);
+    size_t	depth = from->where - from->where_path;
+    VALUE	self;
+
+    c->doc = rdoc;
+    memcpy(c->loc.where_path, from->where_path, sizeof(Leaf) * (depth + 1));
+    c->loc.where = c->loc.where_path + depth;
+    self = Data_Wrap_Struct(oj_doc_cursor_class, mark_cursor_cb, cursor_free, c);
+    if (1 <= argc && Qnil != *argv) {
+	loc_move(doc, &c->loc, *argv);
+    }
+    return self;
+}
+
+static Cursor
+self_cursor(VALUE self, Doc *docp) {
+    Cursor	c = (Cursor)DATA_PTR(self);
+
+    *docp = self_doc(c->doc);
+
+    return c;
+}
+
+/* call-seq: cursor(path=nil) => Oj::Doc::Cursor
+ *
+ * Returns a new Cursor at the current location of the document or at the
+ * path if one is provided. A Cursor has its own location so any number of
+ * them can move over the same document, even from different threads, without
+ * changing the location of the document or of each other. Cursors do not
+ * follow the location of values deleted from the document.
+ * @param [String|Oj::Doc::Path] path location to start the Cursor at
+ * @example
+ *   Oj::Doc.open('{"a":[1,2],"b":3}') { |doc|
+ *     c = doc.cursor('/a')
+ *     c.move('2')
+ *     [c.where?, doc.where?]
+ *   }
+ *   #=> ["/a/2", "/"]
+ */
+static VALUE
+doc_cursor(int argc, VALUE *argv, VALUE self) {
+    Doc	doc = self_doc(self);
+
+    return cursor_new(doc, self, &doc->loc, argc, argv);
+}
+
+/* call-seq: cursor(path=nil) => Oj::Doc::Cursor
+ *
+ * Returns a new Cursor starting at the location of this one.
+ * @see Oj::Doc#cursor
+ */
+static VALUE
+cursor_cursor(int argc, VALUE *argv, VALUE self) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return cursor_new(doc, c->doc, &c->loc, argc, argv);
+}
+
+/* call-seq: doc() => Oj::Doc
+ *
+ * Returns the document the Cursor moves over.
+ */
+static VALUE
+cursor_doc(VALUE self) {
+    return ((Cursor)DATA_PTR(self))->doc;
+}
+
+/* call-seq: where?() => String
+ * @see Oj::Doc#where?
+ */
+static VALUE
+cursor_where(VALUE self) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return loc_where(&c->loc);
+}
+
+/* call-seq: local_key() => String, Fixnum, nil
+ * @see Oj::Doc#local_key
+ */
+static VALUE
+cursor_local_key(VALUE self) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return loc_local_key(&c->loc);
+}
+
+/* call-seq: home() => nil
+ * @see Oj::Doc#home
+ */
+static VALUE
+cursor_home(VALUE self) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return loc_home(doc, &c->loc);
+}
+
+/* call-seq: type(path=nil) => Class
+ * @see Oj::Doc#type
+ */
+static VALUE
+cursor_type(int argc, VALUE *argv, VALUE self) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return loc_type(doc, &c->loc, argc, argv);
+}
+
+/* call-seq: fetch(path=nil, default=nil) => nil, true, false, Fixnum, Float, String, Array, Hash
+ * @see Oj::Doc#fetch
+ */
+static VALUE
+cursor_fetch(int argc, VALUE *argv, VALUE self) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return loc_fetch(doc, &c->loc, argc, argv);
+}
+
+/* call-seq: each_leaf(path=nil) { |cursor| ... } => nil
+ * @see Oj::Doc#each_leaf
+ */
+static VALUE
+cursor_each_leaf(int argc, VALUE *argv, VALUE self) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return loc_each_leaf(doc, &c->loc, argc, argv, self);
+}
+
+/* call-seq: move(path) => nil
+ * @see Oj::Doc#move
+ */
+static VALUE
+cursor_move(VALUE self, VALUE str) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return loc_move(doc, &c->loc, str);
+}
+
+/* call-seq: each_child(path=nil) { |cursor| ... } => nil
+ * @see Oj::Doc#each_child
+ */
+static VALUE
+cursor_each_child(int argc, VALUE *argv, VALUE self) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return loc_each_child(doc, &c->loc, argc, argv, self);
+}
+
+/* call-seq: each_value(path=nil) { |val| ... } => nil
+ * @see Oj::Doc#each_value
+ */
+static VALUE
+cursor_each_value(int argc, VALUE *argv, VALUE self) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return loc_each_value(doc, &c->loc, argc, argv);
+}
+
+/* call-seq: dump(path=nil, filename=nil) => String
+ * @see Oj::Doc#dump
+ */
+static VALUE
+cursor_dump(int argc, VALUE *argv, VALUE self) {
+    Doc		doc;
+    Cursor	c = self_cursor(self, &doc);
+
+    return loc_dump(doc, &c->loc, argc, argv);
+}
+
+// JSON comparison
+
+#define NUM_DIGITS	64
+
+// A JSON number reduced to a sign, its significant digits, and a power of ten
+// so numbers with the same value compare equal however they are written.
+typedef struct _Num {
+    int		neg;
+    int		len;
+    long	exp;
+    char	digits[NUM_DIGITS];
+} *Num;
+
+typedef struct _Same {
+    VALUE	b;
+    Doc		da;
+    Doc		db;
+    int		parsed;
+} *Same;
+
+typedef struct _Diff {
+    Doc		a;
+    Doc		b;
+    VALUE	patch;
+    VALUE	path;	// JSON Pointer to the current location
+    VALUE	other;	// String parsed for b or Qnil
+    int		parsed;
+} *Diff;
+
+// Returns 0 if there are too many digits to keep.
+static int
+num_norm(Num n, const char *s, const char *end) {
+    long	exp = 0;
+    int		frac = 0;
+
+    n->neg = 0;
+    n->len = 0;
+    if (s < end && ('-' == *s || '+' == *s)) {
+	n->neg = ('-' == *s);
+	s++;
+    }
+    for (; s < end; s++) {
+	if ('.' == *s) {
+	    frac = 1;
+	    continue;
+	}
+	if ('0' > *s || '9' < *s) {
+	    break;
+	}
+	if (frac) {
+	    exp--;
+	}
+	if (0 == n->len && '0' == *s) {
+	    continue;
+	}
+	if (NUM_DIGITS <= n->len) {
+	    return 0;
+	}
+	n->digits[n->len++] = *s;
+    }
+    if (s < end && ('e' == *s || 'E' == *s)) {
+	long	e = 0;
+	int	neg = 0;
+
+	s++;
+	if (s < end && ('-' == *s || '+' == *s)) {
+	    neg = ('-' == *s);
+	    s++;
+	}
+	for (; s < end && '0' <= *s && *s <= '9'; s++) {
+	    if (100000000 > e) {
+		e = e * 10 + (*s - '0');
+	    }
+	}
+	exp += neg ? -e : e;
+    }
+    for (; 0 < n->len && '0' == n->digits[n->len - 1]; n->len--) {
+	exp++;
+    }
+    if (0 == n->len) {
+	n->neg = 0;
+	exp = 0;
+    }
+    n->exp = exp;
+
+    return 1;
+}
+
+static int
+num_eq(Leaf a, Leaf b) {
+    struct _Num	na;
+    struct _Num	nb;
+
+    if (num_norm(&na, a->str, a->str + oj_leaf_str_len(a)) &&
+	num_norm(&nb, b->str, b->str + oj_leaf_str_len(b))) {
+	return (na.neg == nb.neg && na.len == nb.len && na.exp == nb.exp && 0 == memcmp(na.digits, nb.digits, na.len));
+    }
+    // the text of a number ends at a character that stops strtod()
+    return strtod(a->str, 0) == strtod(b->str, 0);
+}
+
+static const char*
+leaf_str_text(Leaf leaf, size_t *lenp) {
+    if (RUBY_VAL == leaf->value_type) {
+	*lenp = RSTRING_LEN(leaf->value);
+	return RSTRING_PTR(leaf->value);
+    }
+    *lenp = oj_leaf_str_len(leaf);
+
+    return leaf->str;
+}
+
+static void
+key_step(PathStep step, Leaf leaf) {
+    step->type = STEP_KEY;
+    step->key = leaf->key;
+    step->klen = oj_leaf_key_len(leaf);
+    step->hash = key_hash(step->key, step->klen);
+    step->index = 0;
+}
+
+static int
+leaf_eq(Doc da, Leaf a, Doc db, Leaf b) {
+    if (0 == a || 0 == b) {
+	return a == b;
+    }
+    switch (a->rtype) {
+    case T_NIL:
+    case T_TRUE:
+    case T_FALSE:
+	return a->rtype == b->rtype;
+    case T_FIXNUM:
+    case T_FLOAT:
+	if (T_FIXNUM != b->rtype && T_FLOAT != b->rtype) {
+	    return 0;
+	}
+	if (STR_VAL == a->value_type && STR_VAL == b->value_type) {
+	    return num_eq(a, b);
+	}
+	return Qtrue == rb_equal(leaf_value(da, a), leaf_value(db, b));
+    case T_STRING: {
+	const char	*sa;
+	const char	*sb;
+	size_t		alen;
+	size_t		blen;
+
+	if (T_STRING != b->rtype) {
+	    return 0;
+	}
+	sa = leaf_str_text(a, &alen);
+	sb = leaf_str_text(b, &blen);
+
+	return alen == blen && 0 == memcmp(sa, sb, alen);
+    }
+    case T_ARRAY: {
+	Leaf	la;
+	Leaf	lb;
+	Leaf	ea;
+	Leaf	eb;
+
+	if (T_ARRAY != b->rtype) {
+	    return 0;
+	}
+	la = leaf_elements(da, a);
+	lb = leaf_elements(db, b);
+	if (0 == la || 0 == lb) {
+	    return la == lb;
+	}
+	// the last element has the count
+	if (la->index != lb->index) {
+	    return 0;
+	}
+	for (ea = la->next, eb = lb->next; 1; ea = ea->next, eb = eb->next) {
+	    if (!leaf_eq(da, ea, db, eb)) {
+		return 0;
+	    }
+	    if (ea == la) {
+		break;
+	    }
+	}
+	return 1;
+    }
+    case T_HASH: {
+	struct _PathStep	step;
+	Leaf			la;
+	Leaf			lb;
+	Leaf			e;
+	size_t			na = 0;
+	size_t			nb = 0;
+
+	if (T_HASH != b->rtype) {
+	    return 0;
+	}
+	la = leaf_elements(da, a);
+	lb = leaf_elements(db, b);
+	if (0 == la || 0 == lb) {
+	    return la == lb;
+	}
+	e = lb;
+	do {
+	    nb++;
+	    e = e->next;
+	} while (e != lb);
+	e = la;
+	do {
+	    e = e->next;
+	    na++;
+	    key_step(&step, e);
+	    if (!leaf_eq(da, e, db, find_child(db, b, &step))) {
+		return 0;
+	    }
+	} while (e != la);
+
+	return na == nb;
+    }
+    default:
+	break;
+    }
+    return 0;
+}
+
+static VALUE
+protect_tmp_proc(VALUE x) {
+    ParseInfo	pi = (ParseInfo)x;
+
+    pi->doc->data = read_next(pi);
+    *pi->doc->loc.where = pi->doc->data;
+    pi->doc->loc.where = pi->doc->loc.where_path;
+
+    return Qnil;
+}
+
+// Parses a String into a Doc that is only used from C and never seen by
+// Ruby. The String is read in place when terminated and must not change
+// while the Doc is used. The Doc is freed on error.
+static void
+tmp_doc_parse(Doc doc, VALUE str) {
+    struct _ParseInfo	pi;
+    size_t		len;
+    char		*json;
+    int			ex = 0;
+
+    Check_Type(str, T_STRING);
+    doc_init(doc);
+    len = RSTRING_LEN(str) + 1;
+    json = RSTRING_PTR(str);
+    if ('\0' != json[len - 1]) {
+	json = text_alloc(doc, len);
+	memcpy(json, RSTRING_PTR(str), len - 1);
+	json[len - 1] = '\0';
+    }
+    doc->text = json;
+    doc->tlen = len;
+    if (0xEF == (uint8_t)*json && 0xBB == (uint8_t)json[1] && 0xBF == (uint8_t)json[2]) {
+	json += 3;
+    }
+    pi.str = json;
+    pi.s = json;
+    pi.doc = doc;
+    pi.index = 0;
+    pi.irregular = 0;
+    pi.spans = 0;
+    pi.lazy = 1;
+    pi.tape = 0;
+    pi.next_jump = 0;
+    pi.io = 0;
+    pi.stack_min = parse_stack_min(&pi);
+    rb_protect(protect_tmp_proc, (VALUE)&pi, &ex);
+    if (0 != ex) {
+	doc_free(doc);
+	rb_jump_tag(ex);
+    }
+}
+
+static VALUE
+same_proc(VALUE x) {
+    Same	s = (Same)x;
+
+    tmp_doc_parse(s->db, s->b);
+    s->parsed = 1;
+
+    return leaf_eq(s->da, s->da->data, s->db, s->db->data) ? Qtrue : Qfalse;
+}
+
+static VALUE
+same_cleanup(VALUE x) {
+    Same	s = (Same)x;
+
+    doc_free(s->da);
+    if (s->parsed) {
+	doc_free(s->db);
+    }
+    return Qnil;
+}
+
+/* Document-method: same_json?
+ * call-seq: same_json?(a, b) => true or false
+ *
+ * Returns true if two JSON documents have the same data. Whitespace, the
+ * order of Object members, and how numbers are written are ignored so 1,
+ * 1.0, and 10e-1 are the same. The documents are compared without creating
+ * any Ruby objects.
+ * @param [String] a JSON document
+ * @param [String] b JSON document
+ * @example
+ *   Oj.same_json?('{"a":1,"b":[2.0]}', '{ "b":[2], "a":1 }')  #=> true
+ */
+static VALUE
+same_json(VALUE self, VALUE a, VALUE b) {
+    struct _Doc		da;
+    struct _Doc		db;
+    struct _Same	s;
+
+    tmp_doc_parse(&da, a);
+    s.b = b;
+    s.da = &da;
+    s.db = &db;
+    s.parsed = 0;
+
+    return rb_ensure(same_proc, (VALUE)&s, same_cleanup, (VALUE)&s);
+}
+
+static void
+diff_op(Diff d, const char *op, Leaf value) {
+    VALUE	h = rb_hash_new();
+
+    rb_hash_aset(h, rb_str_new2("op"), rb_str_new2(op));
+    rb_hash_aset(h, rb_str_new2("path"), oj_encode(rb_str_dup(d->path)));
+    if ('r' != *op || 'e' != op[1] || 'm' != op[2]) { // all but remove
+	rb_hash_aset(h, rb_str_new2("value"), (0 == value) ? Qnil : leaf_value(d->b, value));
+    }
+    rb_ary_push(d->patch, h);
+}
+
+static void
+diff_path_key(Diff d, Leaf leaf) {
+    const char	*key = leaf->key;
+    const char	*end = key + oj_leaf_key_len(leaf);
+    const char	*k;
+
+    rb_str_cat(d->path, "/", 1);
+    for (k = key; k < end; k++) {
+	if ('~' == *k || '/' == *k) {
+	    rb_str_cat(d->path, key, k - key);
+	    rb_str_cat(d->path, ('~' == *k) ? "~0" : "~1", 2);
+	    key = k + 1;
+	}
+    }
+    rb_str_cat(d->path, key, end - key);
+}
+
+static void
+diff_path_index(Diff d, size_t i) {
+    char	buf[32];
+    char	*end = ulong_fill(buf + 1, i);
+
+    *buf = '/';
+    rb_str_cat(d->path, buf, end - buf);
+}
+
+// Adds the operations that change a into b. Array members past the shorter
+// Array are added in order or removed from the end so the indexes in the
+// patch are right when applied one after another.
+static void
+diff_leaf(Diff d, Leaf a, Leaf b) {
+    long	plen = RSTRING_LEN(d->path);
+
+    if (COL_VAL != a->value_type || COL_VAL != b->value_type || a->rtype != b->rtype) {
+	if (!leaf_eq(d->a, a, d->b, b)) {
+	    diff_op(d, "replace", b);
+	}
+    } else if (T_HASH == a->rtype) {
+	struct _PathStep	step;
+	Leaf			la = leaf_elements(d->a, a);
+	Leaf			lb = leaf_elements(d->b, b);
+	Leaf			e;
+	Leaf			m;
+
+	if (0 != la) {
+	    e = la;
+	    do {
+		e = e->next;
+		key_step(&step, e);
+		m = (0 == lb) ? 0 : find_child(d->b, b, &step);
+		diff_path_key(d, e);
+		if (0 == m) {
+		    diff_op(d, "remove", 0);
+		} else {
+		    diff_leaf(d, e, m);
+		}
+		rb_str_set_len(d->path, plen);
+	    } while (e != la);
+	}
+	if (0 != lb) {
+	    e = lb;
+	    do {
+		e = e->next;
+		key_step(&step, e);
+		if (0 == la || 0 == find_child(d->a, a, &step)) {
+		    diff_path_key(d, e);
+		    diff_op(d, "add", e);
+		    rb_str_set_len(d->path, plen);
+		}
+	    } while (e != lb);
+	}
+    } else {
+	Leaf	la = leaf_elements(d->a, a);
+	Leaf	lb = leaf_elements(d->b, b);
+	size_t	na = (0 == la) ? 0 : la->index;
+	size_t	nb = (0 == lb) ? 0 : lb->index;
+	Leaf	ea = (0 == la) ? 0 : la->next;
+	Leaf	eb = (0 == lb) ? 0 : lb->next;
+	size_t	i;
+
+	for (i = 0; i < na && i < nb; i++, ea = ea->next, eb = eb->next) {
+	    diff_path_index(d, i);
+	    diff_leaf(d, ea, eb);
+	    rb_str_set_len(d->path, plen);
+	}
+	for (; i < nb; i++, eb = eb->next) {
+	    diff_path_index(d, i);
+	    diff_op(d, "add", eb);
+	    rb_str_set_len(d->path, plen);
+	}
+	for (i = na; nb < i; i--) {
+	    diff_path_index(d, i - 1);
+	    diff_op(d, "remove", 0);
+	    rb_str_set_len(d->path, plen);
+	}
+    }
+}
+
+static VALUE
+diff_proc(VALUE x) {
+    Diff	d = (Diff)x;
+
+    if (Qnil != d->other) {
+	tmp_doc_parse(d->b, d->other);
+	d->parsed = 1;
+    }
+    if (0 == d->a->data || 0 == d->b->data) {
+	if (d->a->data != d->b->data) {
+	    diff_op(d, "replace", d->b->data);
+	}
+    } else {
+	diff_leaf(d, d->a->data, d->b->data);
+    }
+    return d->patch;
+}
+
+static VALUE
+diff_cleanup(VALUE x) {
+    Diff	d = (Diff)x;
+
+    if (d->parsed) {
+	doc_free(d->b);
+    }
+    return Qnil;
+}
+
+/* call-seq: diff(other) => Array
+ *
+ * Returns a JSON Patch (RFC 6902) as an Array of Hashes that changes this
+ * document into the other one. Values are only created for what is added or
+ * replaced and, as with Oj.same_json?(), how numbers are written and the
+ * order of Object members do not count as changes. Array members are compared
+ * by position.
+ * @param [Oj::Doc|String] other document or JSON to compare with
+ * @example
+ *   Oj::Doc.open('{"a":1,"b":[1,2]}') { |doc| doc.diff('{"a":2,"b":[1]}') }
+ *   #=> [{"op"=>"replace", "path"=>"/a", "value"=>2}, {"op"=>"remove", "path"=>"/b/1"}]
+ */
+static VALUE
+doc_diff(VALUE self, VALUE other) {
+    struct _Doc		tmp;
+    struct _Diff	d;
+
+    d.a = self_doc(self);
+    d.patch = rb_ary_new();
+    d.path = rb_str_new(0, 0);
+    d.parsed = 0;
+    if (rb_obj_is_kind_of(other, oj_doc_class)) {
+	d.b = self_doc(other);
+	d.other = Qnil;
+    } else {
+	Check_Type(other, T_STRING);
+	d.b = &tmp;
+	d.other = other;
+    }
+    return rb_ensure(diff_proc, (VALUE)&d, diff_cleanup, (VALUE)&d);
+}
+
+// Oj::Store
+
+// One value of a Store. Values are in document order, a container first and
+// then each of its members, and all offsets are from the start of the block
+// the Store is in so nothing in it points to the Ruby heap.
+typedef struct _StoreLeaf {
+    uint64_t	str;	    // text offset of a value or member count of a container
+    uint64_t	key;	    // text offset of the key plus one, or 0, shifted over the rtype
+    uint64_t	after;	    // value past this one and its members
+    uint64_t	len;	    // length of a value or first slot plus one of a container
+} *StoreLeaf;
+
+typedef struct _Store {
+    char	*base;	    // block holding the leaves, slots, and text
+    size_t	size;
+    int		mapped;	    // base was mapped and not allocated
+    StoreLeaf	leaves;
+    uint64_t	*slots;	    // child indexes of the larger containers
+    char	*text;
+    uint64_t	cnt;
+} *Store;
+
+typedef struct _StoreBuild {
+    Store	store;
+    uint64_t	cnt;
+    uint64_t	scnt;
+    uint64_t	tlen;
+} *StoreBuild;
+
+// Arrays get a slot per member and objects an open addressed table of twice
+// the member count preceded by the mask.
+static uint64_t
+store_slot_cnt(Leaf leaf, uint64_t n) {
+    uint64_t	size = 2;
+
+    if (INDEX_MIN > n) {
+	return 0;
+    }
+    if (T_ARRAY == leaf->rtype) {
+	return n;
+    }
+    while (size < n * 2) {
+	size <<= 1;
+    }
+    return size + 1;
+}
+
+static void
+store_count(StoreBuild b, Leaf leaf) {
+    b->cnt++;
+    if (T_HASH == leaf->parent_type) {
+	b->tlen += oj_leaf_key_len(leaf) + 1;
+    }
+    if (COL_VAL == leaf->value_type) {
+	uint64_t	n = 0;
+
+	if (0 != leaf->elements) {
+	    Leaf	first = leaf->elements->next;
+	    Leaf	e = first;
+
+	    do {
+		store_count(b, e);
+		n++;
+		e = e->next;
+	    } while (e != first);
+	}
+	b->scnt += store_slot_cnt(leaf, n);
+    } else if (STR_VAL == leaf->value_type) {
+	b->tlen += oj_leaf_str_len(leaf) + 1;
+    } else if (RUBY_VAL == leaf->value_type && T_NIL != leaf->rtype && T_TRUE != leaf->rtype && T_FALSE != leaf->rtype) {
+	rb_raise(rb_const_get_at(Oj, rb_intern("Error")), "Oj::Store can only be built from an unused Oj::Doc.");
+    }
+}
+
+static uint64_t
+store_text(StoreBuild b, const char *str, size_t len) {
+    uint64_t	off = b->tlen;
+
+    memcpy(b->store->text + off, str, len);
+    b->store->text[off + len] = '\0';
+    b->tlen += len + 1;
+
+    return off;
+}
+
+static uint64_t
+store_fill(StoreBuild b, Leaf leaf) {
+    Store	s = b->store;
+    uint64_t	i = b->cnt++;
+    StoreLeaf	sl = s->leaves + i;
+
+    sl->key = 0;
+    sl->str = 0;
+    sl->len = 0;
+    if (T_HASH == leaf->parent_type) {
+	sl->key = (store_text(b, leaf->key, oj_leaf_key_len(leaf)) + 1) << 8;
+    }
+    sl->key |= leaf->rtype;
+    if (COL_VAL == leaf->value_type) {
+	uint64_t	n = 0;
+	uint64_t	scnt;
+
+	if (0 != leaf->elements) {
+	    Leaf	first = leaf->elements->next;
+	    Leaf	e = first;
+
+	    do {
+		n++;
+		e = e->next;
+	    } while (e != first);
+	}
+	sl->str = n;
+	if (0 < (scnt = store_slot_cnt(leaf, n))) {
+	    sl->len = b->scnt + 1;
+	    b->scnt += scnt;
+	    memset(s->slots + sl->len - 1, 0, sizeof(uint64_t) * scnt);
+	    if (T_HASH == leaf->rtype) {
+		s->slots[sl->len - 1] = scnt - 2; // the mask
+	    }
+	}
+	if (0 != leaf->elements) {
+	    Leaf	first = leaf->elements->next;
+	    Leaf	e = first;
+	    uint64_t	cnt = 0;
+	    uint64_t	ci;
+
+	    do {
+		ci = store_fill(b, e);
+		if (0 != sl->len) {
+		    uint64_t	*slots = s->slots + sl->len - 1;
+
+		    if (T_ARRAY == leaf->rtype) {
+			slots[cnt] = ci;
+		    } else {
+			uint64_t	mask = *slots;
+			size_t		klen = oj_leaf_key_len(e);
+			uint64_t	h = key_hash(e->key, klen) & mask;
+
+			for (slots++; 0 != slots[h]; h = (h + 1) & mask) {
+			}
+			slots[h] = ci + 1;
+		    }
+		}
+		cnt++;
+		e = e->next;
+	    } while (e != first);
+	}
+    } else if (STR_VAL == leaf->value_type) {
+	sl->len = oj_leaf_str_len(leaf);
+	sl->str = store_text(b, leaf->str, sl->len);
+    }
+    sl->after = b->cnt;
+
+    return i;
+}
+
+static void
+store_free(void *ptr) {
+    Store	s = (Store)ptr;
+
+    if (0 != s) {
+#if HAS_MMAP
+	if (s->mapped) {
+	    munmap(s->base, s->size);
+	} else {
+	    xfree(s->base);
+	}
+#else
+	xfree(s->base);
+#endif
+	xfree(s);
+    }
+}
+
+static VALUE
+store_build(VALUE x) {
+    Doc			doc = (Doc)x;
+    struct _StoreBuild	b;
+    Store		s;
+
+    memset(&b, 0, sizeof(b));
+    store_count(&b, doc->data);
+    s = ALLOC(struct _Store);
+    s->cnt = b.cnt;
+    s->size = sizeof(struct _StoreLeaf) * b.cnt + sizeof(uint64_t) * b.scnt + b.tlen;
+    s->mapped = 0;
+#if HAS_MMAP
+    // A private anonymous mapping is not touched by malloc or the GC once
+    // filled in so forked processes keep sharing it.
+    s->base = (char*)mmap(0, s->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (MAP_FAILED == (void*)s->base) {
+	s->base = ALLOC_N(char, s->size);
+    } else {
+	s->mapped = 1;
     }
-    return key;
+#else
+    s->base = ALLOC_N(char, s->size);
+#endif
+    s->leaves = (StoreLeaf)s->base;
+    s->slots = (uint64_t*)(s->leaves + b.cnt);
+    s->text = (char*)(s->slots + b.scnt);
+    b.store = s;
+    b.cnt = 0;
+    b.scnt = 0;
+    b.tlen = 0;
+    store_fill(&b, doc->data);
+#if HAS_MMAP
+    if (s->mapped) {
+	mprotect(s->base, s->size, PROT_READ);
+    }
+#endif
+    return Data_Wrap_Struct(oj_store_class, 0, store_free, s);
 }
 
-/* call-seq: home() => nil
+static VALUE
+store_from_doc(VALUE rdoc) {
+    return rb_ensure(store_build, (VALUE)self_doc(rdoc), doc_close, rdoc);
+}
+
+/* call-seq: load(filename) => Oj::Store
  *
- * Moves the document marker or location to the hoot or home position. The
- * same operation can be performed with a Oj::Doc.move('/').
+ * Parses a JSON file into a read only Oj::Store. The Store is kept in one
+ * block of memory outside the Ruby heap and holds no Ruby objects so the GC
+ * never writes to it. Processes forked after the load keep sharing its pages
+ * instead of each getting a copy.
+ * @param [String] filename name of file that contains a JSON document
  * @example
- *   Oj::Doc.open('[1,2,3]') { |doc| doc.move('/2'); doc.home(); doc.where? }  #=> '/'
+ *   store = Oj::Store.load('reference.json')
+ *   store.fetch('/countries/US/name')  #=> "United States"
  */
 static VALUE
-doc_home(VALUE self) {
-    Doc	doc = self_doc(self);
-
-    *doc->where_path = doc->data;
-    doc->where = doc->where_path;
-
-    return oj_slash_string;
+store_load(VALUE clas, VALUE filename) {
+    return store_from_doc(rb_funcall(oj_doc_class, rb_intern("open_file"), 1, filename));
 }
 
-/* call-seq: type(path=nil) => Class
+/* call-seq: parse(json) => Oj::Store
  *
- * Returns the Class of the data value at the location identified by the path
- * or the current location if the path is nil or not provided. This method
- * does not create the Ruby Object at the location specified so the overhead
- * is low.
- * @param [String] path path to the location to get the type of if provided
- * @example
- *   Oj::Doc.open('[1,2]') { |doc| doc.type() }	     #=> Array
- *   Oj::Doc.open('[1,2]') { |doc| doc.type('/1') }  #=> Fixnum
+ * Parses a JSON document String into a read only Oj::Store.
+ * @see Oj::Store.load
+ * @param [String] json JSON document string
  */
 static VALUE
-doc_type(int argc, VALUE *argv, VALUE self) {
-    Doc		doc = self_doc(self);
-    Leaf	leaf;
-    const char	*path = 0;
-    VALUE	type = Qnil;
+store_parse(VALUE clas, VALUE json) {
+    return store_from_doc(rb_funcall(oj_doc_class, rb_intern("open"), 1, json));
+}
 
-    if (1 <= argc) {
-	Check_Type(*argv, T_STRING);
-	path = StringValuePtr(*argv);
-    }
-    if (0 != (leaf = get_doc_leaf(doc, path))) {
-	switch (leaf->rtype) {
-	case T_NIL:	type = rb_cNilClass;	break;
-	case T_TRUE:	type = rb_cTrueClass;	break;
-	case T_FALSE:	type = rb_cFalseClass;	break;
-	case T_STRING:	type = rb_cString;	break;
-	case T_FIXNUM:	type = rb_cFixnum;	break;
-	case T_FLOAT:	type = rb_cFloat;	break;
-	case T_ARRAY:	type = rb_cArray;	break;
-	case T_HASH:	type = rb_cHash;	break;
-	default:				break;
-	}
+static Store
+self_store(VALUE self) {
+    Store	s = (Store)DATA_PTR(self);
+
+    if (0 == s) {
+	rb_raise(rb_eIOError, "Store already closed.");
     }
-    return type;
+    return s;
 }
 
-/* call-seq: fetch(path=nil) => nil, true, false, Fixnum, Float, String, Array, Hash
- *
- * Returns the value at the location identified by the path or the current
- * location if the path is nil or not provided. This method will create and
- * return an Array or Hash if that is the type of Object at the location
- * specified. This is more expensive than navigating to the leaves of the JSON
- * document.
- * @param [String] path path to the location to get the type of if provided
- * @example
- *   Oj::Doc.open('[1,2]') { |doc| doc.fetch() }      #=> [1, 2]
- *   Oj::Doc.open('[1,2]') { |doc| doc.fetch('/1') }  #=> 1
- */
-static VALUE
-doc_fetch(int argc, VALUE *argv, VALUE self) {
-    Doc		doc;
-    Leaf	leaf;
-    VALUE	val = Qnil;
-    const char	*path = 0;
+static StoreLeaf
+store_child(Store s, StoreLeaf sl, PathStep step) {
+    uint8_t	rtype = (uint8_t)sl->key;
+    StoreLeaf	e;
+    uint64_t	n;
 
-    doc = self_doc(self);
-    if (1 <= argc) {
-	Check_Type(*argv, T_STRING);
-	path = StringValuePtr(*argv);
-	if (2 == argc) {
-	    val = argv[1];
+    if (T_ARRAY == rtype) {
+	if (STEP_INDEX != step->type || 0 == step->index || sl->str < step->index) {
+	    return 0;
+	}
+	if (0 != sl->len) {
+	    return s->leaves + s->slots[sl->len - 1 + step->index - 1];
+	}
+	for (e = sl + 1, n = 1; n < step->index; n++) {
+	    e = s->leaves + e->after;
 	}
+	return e;
     }
-    if (0 != (leaf = get_doc_leaf(doc, path))) {
-	val = leaf_value(doc, leaf);
+    if (T_HASH != rtype) {
+	return 0;
     }
-    return val;
+    if (0 != sl->len) {
+	uint64_t	*slots = s->slots + sl->len - 1;
+	uint64_t	mask = *slots;
+	uint64_t	h = step->hash & mask;
+
+	for (slots++; 0 != slots[h]; h = (h + 1) & mask) {
+	    const char	*key;
+
+	    e = s->leaves + slots[h] - 1;
+	    key = s->text + (e->key >> 8) - 1;
+	    if (0 == strncmp(step->key, key, step->klen) && '\0' == key[step->klen]) {
+		return e;
+	    }
+	}
+	return 0;
+    }
+    for (e = sl + 1, n = 0; n < sl->str; n++, e = s->leaves + e->after) {
+	const char	*key = s->text + (e->key >> 8) - 1;
+
+	if (0 == strncmp(step->key, key, step->klen) && '\0' == key[step->klen]) {
+	    return e;
+	}
+    }
+    return 0;
 }
 
-/* call-seq: each_leaf(path=nil) => nil
- *
- * Yields to the provided block for each leaf node with the identified
- * location of the JSON document as the root. The parameter passed to the
- * block on yield is the Doc instance after moving to the child location.
- * @param [String] path if provided it identified the top of the branch to process the leaves of
- * @yieldparam [Doc] Doc at the child location
- * @example
- *   Oj::Doc.open('[3,[2,1]]') { |doc|
- *       result = {}
- *       doc.each_leaf() { |d| result[d.where?] = d.fetch() }
- *       result
- *   }
- *   #=> ["/1" => 3, "/2/1" => 2, "/2/2" => 1]
- */
-static VALUE
-doc_each_leaf(int argc, VALUE *argv, VALUE self) {
-    if (rb_block_given_p()) {
-	Leaf		save_path[MAX_STACK];
-	Doc		doc = self_doc(self);
-	const char	*path = 0;
-	size_t		wlen;
+// Paths are always from the top of a Store since it has no location.
+static StoreLeaf
+store_get(Store s, int argc, VALUE *argv) {
+    StoreLeaf		stack[MAX_STACK];
+    StoreLeaf		*lp = stack;
+    Path		path;
+    PathStep		step;
+    struct _Path	tmp;
+    struct _PathStep	steps[MAX_STACK];
+
+    *lp = s->leaves;
+    if (1 > argc || Qnil == *argv) {
+	return *lp;
+    }
+    path = arg_path(*argv, &tmp, steps);
+    for (step = path->steps; step < path->end; step++) {
+	if (STEP_UP == step->type) {
+	    if (stack == lp) {
+		return 0;
+	    }
+	    lp--;
+	    continue;
+	}
+	if (MAX_STACK - 1 <= lp - stack) {
+	    rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+	}
+	if (0 == (lp[1] = store_child(s, *lp, step))) {
+	    return 0;
+	}
+	lp++;
+    }
+    return *lp;
+}
 
-	wlen = doc->where - doc->where_path;
-	if (0 < wlen) {
-	    memcpy(save_path, doc->where_path, sizeof(Leaf) * (wlen + 1));
+static VALUE
+store_value(Store s, StoreLeaf sl) {
+    struct _Leaf	leaf;
+    VALUE		v;
+    StoreLeaf		e;
+    uint64_t		n;
+
+    switch ((uint8_t)sl->key) {
+    case T_NIL:		return Qnil;
+    case T_TRUE:	return Qtrue;
+    case T_FALSE:	return Qfalse;
+    case T_STRING:
+	return oj_encode(rb_str_new(s->text + sl->str, sl->len));
+    case T_FIXNUM:
+    case T_FLOAT:
+	// a span is converted without writing to the read only text
+	leaf_init(&leaf, (uint8_t)sl->key);
+	leaf.str = s->text + sl->str;
+	leaf.span = STR_SPAN;
+	leaf.value_type = STR_VAL;
+	if (T_FIXNUM == leaf.rtype) {
+	    leaf_fixnum_value(&leaf);
+	} else {
+	    leaf_float_value(&leaf);
 	}
-	if (1 <= argc) {
-	    Check_Type(*argv, T_STRING);
-	    path = StringValuePtr(*argv);
-	    if ('/' == *path) {
-		doc->where = doc->where_path;
-		path++;
-	    }
-	    if (0 != move_step(doc, path, 1)) {
-		if (0 < wlen) {
-		    memcpy(doc->where_path, save_path, sizeof(Leaf) * (wlen + 1));
-		}
-		return Qnil;
-	    }
+	return leaf.value;
+    case T_ARRAY:
+	v = rb_ary_new2(sl->str);
+	for (e = sl + 1, n = 0; n < sl->str; n++, e = s->leaves + e->after) {
+	    rb_ary_push(v, store_value(s, e));
 	}
-	each_leaf(doc, self);
-	if (0 < wlen) {
-	    memcpy(doc->where_path, save_path, sizeof(Leaf) * (wlen + 1));
+	return v;
+    case T_HASH:
+	v = rb_hash_new();
+	for (e = sl + 1, n = 0; n < sl->str; n++, e = s->leaves + e->after) {
+	    const char	*key = s->text + (e->key >> 8) - 1;
+
+	    rb_hash_aset(v, oj_encode(rb_str_new2(key)), store_value(s, e));
 	}
+	return v;
+    default:
+	break;
     }
+    rb_raise(rb_const_get_at(Oj, rb_intern("Error")), "Unexpected type %02x.", (uint8_t)sl->key);
+
     return Qnil;
 }
 
-/* call-seq: move(path) => nil
+/* call-seq: fetch(path=nil, default=nil) => nil, true, false, Fixnum, Float, String, Array, Hash
  *
- * Moves the document marker to the path specified. The path can an absolute
- * path or a relative path.
- * @param [String] path path to the location to move to
+ * Returns the value at the location identified by the path or the whole
+ * document if the path is nil. A new Ruby value is built on each call. If
+ * there is no value at the path the default is returned.
+ * @param [String|Oj::Doc::Path] path path to the value, always from the top
+ * @param [Object] default value to return if the path does not exist
  * @example
- *   Oj::Doc.open('{"one":[1,2]') { |doc| doc.move('/one/2'); doc.where? }  #=> "/one/2"
+ *   Oj::Store.parse('{"a":[1,2]}').fetch('/a/2')  #=> 2
  */
 static VALUE
-doc_move(VALUE self, VALUE str) {
-    Doc		doc = self_doc(self);
-    const char	*path;
-    int		loc;
+store_fetch(int argc, VALUE *argv, VALUE self) {
+    Store	s = self_store(self);
+    StoreLeaf	sl;
 
-    Check_Type(str, T_STRING);
-    path = StringValuePtr(str);
-    if ('/' == *path) {
-	doc->where = doc->where_path;
-	path++;
+    if (2 < argc) {
+	rb_raise(rb_eArgError, "wrong number of arguments (%d for 0..2)", argc);
     }
-    if (0 != (loc = move_step(doc, path, 1))) {
-	rb_raise(rb_eArgError, "Failed to locate element %d of the path %s.", loc, path);
+    if (0 == (sl = store_get(s, argc, argv))) {
+	return (2 == argc) ? argv[1] : Qnil;
     }
-    return Qnil;
+    return store_value(s, sl);
 }
 
-/* call-seq: each_child(path=nil) { |doc| ... } => nil
+/* call-seq: type(path=nil) => Class
  *
- * Yields to the provided block for each immediate child node with the
- * identified location of the JSON document as the root. The parameter passed
- * to the block on yield is the Doc instance after moving to the child
- * location.
- * @param [String] path if provided it identified the top of the branch to process the chilren of
- * @yieldparam [Doc] Doc at the child location
- * @example
- *   Oj::Doc.open('[3,[2,1]]') { |doc|
- *       result = []
- *       doc.each_value('/2') { |doc| result << doc.where? }
- *       result
- *   }
- *   #=> ["/2/1", "/2/2"]
+ * Returns the Class of the value at the path without building it.
+ * @param [String|Oj::Doc::Path] path path to the value, always from the top
  */
 static VALUE
-doc_each_child(int argc, VALUE *argv, VALUE self) {
-    if (rb_block_given_p()) {
-	Leaf		save_path[MAX_STACK];
-	Doc		doc = self_doc(self);
-	const char	*path = 0;
-	size_t		wlen;
-
-	wlen = doc->where - doc->where_path;
-	if (0 < wlen) {
-	    memcpy(save_path, doc->where_path, sizeof(Leaf) * (wlen + 1));
-	}
-	if (1 <= argc) {
-	    Check_Type(*argv, T_STRING);
-	    path = StringValuePtr(*argv);
-	    if ('/' == *path) {
-		doc->where = doc->where_path;
-		path++;
-	    }
-	    if (0 != move_step(doc, path, 1)) {
-		if (0 < wlen) {
-		    memcpy(doc->where_path, save_path, sizeof(Leaf) * (wlen + 1));
-		}
-		return Qnil;
-	    }
-	}
-	if (COL_VAL == (*doc->where)->value_type && 0 != (*doc->where)->elements) {
-	    Leaf	first = (*doc->where)->elements->next;
-	    Leaf	e = first;
-
-	    doc->where++;
-	    do {
-		*doc->where = e;
-		rb_yield(self);
-		e = e->next;
-	    } while (e != first);
-	}
-	if (0 < wlen) {
-	    memcpy(doc->where_path, save_path, sizeof(Leaf) * (wlen + 1));
+store_type(int argc, VALUE *argv, VALUE self) {
+    StoreLeaf	sl = store_get(self_store(self), argc, argv);
+
+    if (0 != sl) {
+	switch ((uint8_t)sl->key) {
+	case T_NIL:	return rb_cNilClass;
+	case T_TRUE:	return rb_cTrueClass;
+	case T_FALSE:	return rb_cFalseClass;
+	case T_STRING:	return rb_cString;
+	case T_FIXNUM:	return rb_cFixnum;
+	case T_FLOAT:	return rb_cFloat;
+	case T_ARRAY:	return rb_cArray;
+	case T_HASH:	return rb_cHash;
+	default:	break;
 	}
     }
     return Qnil;
 }
 
-/* call-seq: each_value(path=nil) { |val| ... } => nil
+/* call-seq: exists?(path) => true or false
  *
- * Yields to the provided block for each leaf value in the identified location
- * of the JSON document. The parameter passed to the block on yield is the
- * value of the leaf. Only those leaves below the element specified by the
- * path parameter are processed.
- * @param [String] path if provided it identified the top of the branch to process the leaf values of
- * @yieldparam [Object] val each leaf value
- * @example
- *   Oj::Doc.open('[3,[2,1]]') { |doc|
- *       result = []
- *       doc.each_value() { |v| result << v }
- *       result
- *   }
- *   #=> [3, 2, 1]
- *   
- *   Oj::Doc.open('[3,[2,1]]') { |doc|
- *       result = []
- *       doc.each_value('/2') { |v| result << v }
- *       result
- *   }
- *   #=> [2, 1]
+ * Returns true if there is a value at the path.
+ * @param [String|Oj::Doc::Path] path path to the value, always from the top
  */
 static VALUE
-doc_each_value(int argc, VALUE *argv, VALUE self) {
-    if (rb_block_given_p()) {
-	Doc		doc = self_doc(self);
-	const char	*path = 0;
-	Leaf		leaf;
-
-	if (1 <= argc) {
-	    Check_Type(*argv, T_STRING);
-	    path = StringValuePtr(*argv);
-	}
-	if (0 != (leaf = get_doc_leaf(doc, path))) {
-	    each_value(doc, leaf);
-	}
-    }
-    return Qnil;
+store_exists(VALUE self, VALUE rpath) {
+    return (0 == store_get(self_store(self), 1, &rpath)) ? Qfalse : Qtrue;
 }
 
-/* call-seq: dump(path=nil) => String
+/* call-seq: each(path=nil) { |key, value| ... } => nil
  *
- * Dumps the document or nodes to a new JSON document. It uses the default
- * options for generating the JSON.
- * @param [String] path if provided it identified the top of the branch to dump to JSON
- * @param [String] filename if provided it is the filename to write the output to
- * @example
- *   Oj::Doc.open('[3,[2,1]]') { |doc|
- *       doc.dump('/2')
- *   }
- *   #=> "[2,1]"
+ * Yields the key and value of each member of the Object at the path or the
+ * index and value of each member of an Array.
+ * @param [String|Oj::Doc::Path] path path to the container, always from the top
  */
 static VALUE
-doc_dump(int argc, VALUE *argv, VALUE self) {
-    Doc		doc = self_doc(self);
-    Leaf	leaf;
-    const char	*path = 0;
-    const char	*filename = 0;
-
-    if (1 <= argc) {
-	if (Qnil != *argv) {
-	    Check_Type(*argv, T_STRING);
-	    path = StringValuePtr(*argv);
-	}
-	if (2 <= argc) {
-	    Check_Type(argv[1], T_STRING);
-	    filename = StringValuePtr(argv[1]);
-	}
+store_each(int argc, VALUE *argv, VALUE self) {
+    Store	s = self_store(self);
+    StoreLeaf	sl = store_get(s, argc, argv);
+    StoreLeaf	e;
+    uint64_t	n;
+
+    if (0 == sl || !rb_block_given_p()) {
+	return Qnil;
     }
-    if (0 != (leaf = get_doc_leaf(doc, path))) {
-	VALUE	rjson;
-
-	if (0 == filename) {
-	    char	buf[4096];
-	    struct _Out out;
+    switch ((uint8_t)sl->key) {
+    case T_ARRAY:
+	for (e = sl + 1, n = 0; n < sl->str; n++, e = s->leaves + e->after) {
+	    rb_yield_values(2, ULONG2NUM(n + 1), store_value(s, e));
+	}
+	break;
+    case T_HASH:
+	for (e = sl + 1, n = 0; n < sl->str; n++, e = s->leaves + e->after) {
+	    const char	*key = s->text + (e->key >> 8) - 1;
 
-	    out.buf = buf;
-	    out.end = buf + sizeof(buf) - 10;
-	    out.allocated = 0;
-	    oj_dump_leaf_to_json(leaf, &oj_default_options, &out);
-	    rjson = rb_str_new2(out.buf);
-	    if (out.allocated) {
-		xfree(out.buf);
-	    }
-	} else {
-	    oj_write_leaf_to_file(leaf, filename, &oj_default_options);
-	    rjson = Qnil;
+	    rb_yield_values(2, oj_encode(rb_str_new2(key)), store_value(s, e));
 	}
-	return rjson;
+	break;
+    default:
+	break;
     }
     return Qnil;
 }
 
 /* call-seq: size() => Fixnum
  *
- * Returns the number of nodes in the JSON document where a node is any one of
- * the basic JSON components.
- * @return Returns the size of the JSON document.
- * @example
- *   Oj::Doc.open('[1,2,3]') { |doc| doc.size() }  #=> 4
+ * Returns the number of values in the Store.
  */
 static VALUE
-doc_size(VALUE self) {
-    return ULONG2NUM(((Doc)DATA_PTR(self))->size);
+store_size(VALUE self) {
+    return ULONG2NUM(self_store(self)->cnt);
 }
 
 /* call-seq: close() => nil
  *
- * Closes an open document. No further calls to the document will be valid
- * after closing.
- * @example
- *   doc = Oj::Doc.open('[1,2,3]')
- *   doc.size()  #=> 4
- *   doc.close()
+ * Releases the memory of the Store. No further calls to the Store are valid.
  */
 static VALUE
-doc_close(VALUE self) {
-    Doc		doc = self_doc(self);
+store_close(VALUE self) {
+    Store	s = self_store(self);
+
+    DATA_PTR(self) = 0;
+    store_free(s);
 
-    rb_gc_unregister_address(&doc->self);
-    DATA_PTR(doc->self) = 0;
-    if (0 != doc) {
-	xfree(doc->json);
-	doc_free(doc);
-	xfree(doc);
-    }
     return Qnil;
 }
+
 #if 0
 // hack to keep the doc generator happy
 Oj = rb_define_module("Oj");
@@ -1609,7 +5788,8 @@ Oj = rb_define_module("Oj");
  * character is the separator. Each step in the path identifies the next
  * branch to take through the document. A JSON object will expect a key string
  * while an array will expect a positive index. A .. step indicates a move up
- * the JSON document.
+ * the JSON document. Paths that are used repeatedly can be compiled once with
+ * Oj::Doc::Path.new and the Path passed in place of the String.
  * 
  * @example
  *   json = %{[
@@ -1638,19 +5818,66 @@ Oj = rb_define_module("Oj");
 void
 oj_init_doc() {
     oj_doc_class = rb_define_class_under(Oj, "Doc", rb_cObject);
-    rb_define_singleton_method(oj_doc_class, "open", doc_open, 1);
-    rb_define_singleton_method(oj_doc_class, "open_file", doc_open_file, 1);
-    rb_define_singleton_method(oj_doc_class, "parse", doc_open, 1);
+    rb_define_singleton_method(oj_doc_class, "open", doc_open, -1);
+    rb_define_singleton_method(oj_doc_class, "open_file", doc_open_file, -1);
+    rb_define_singleton_method(oj_doc_class, "open_io", doc_open_io, -1);
+    rb_define_singleton_method(oj_doc_class, "parse", doc_open, -1);
     rb_define_method(oj_doc_class, "where?", doc_where, 0);
     rb_define_method(oj_doc_class, "local_key", doc_local_key, 0);
     rb_define_method(oj_doc_class, "home", doc_home, 0);
     rb_define_method(oj_doc_class, "type", doc_type, -1);
     rb_define_method(oj_doc_class, "fetch", doc_fetch, -1);
+    rb_define_method(oj_doc_class, "fetch_many", doc_fetch_many, -1);
+    rb_define_method(oj_doc_class, "fetch_hash", doc_fetch_hash, -1);
+    rb_define_method(oj_doc_class, "query", doc_query, 1);
+    rb_define_method(oj_doc_class, "count", doc_count, 1);
+    rb_define_method(oj_doc_class, "sum", doc_sum, 1);
+    rb_define_method(oj_doc_class, "min", doc_min, 1);
+    rb_define_method(oj_doc_class, "max", doc_max, 1);
+    rb_define_method(oj_doc_class, "avg", doc_avg, 1);
+    rb_define_method(oj_doc_class, "set", doc_set, 2);
+    rb_define_method(oj_doc_class, "delete", doc_delete, 1);
+    rb_define_method(oj_doc_class, "insert", doc_insert, 2);
     rb_define_method(oj_doc_class, "each_leaf", doc_each_leaf, -1);
     rb_define_method(oj_doc_class, "move", doc_move, 1);
     rb_define_method(oj_doc_class, "each_child", doc_each_child, -1);
     rb_define_method(oj_doc_class, "each_value", doc_each_value, -1);
     rb_define_method(oj_doc_class, "dump", doc_dump, -1);
+    rb_define_method(oj_doc_class, "save_index", doc_save_index, 1);
+    rb_define_method(oj_doc_class, "diff", doc_diff, 1);
     rb_define_method(oj_doc_class, "size", doc_size, 0);
+    rb_define_method(oj_doc_class, "cursor", doc_cursor, -1);
     rb_define_method(oj_doc_class, "close", doc_close, 0);
+
+    oj_doc_path_class = rb_define_class_under(oj_doc_class, "Path", rb_cObject);
+    rb_define_singleton_method(oj_doc_path_class, "new", path_new, 1);
+    rb_define_method(oj_doc_path_class, "to_s", path_to_s, 0);
+
+    oj_doc_cursor_class = rb_define_class_under(oj_doc_class, "Cursor", rb_cObject);
+    rb_undef_alloc_func(oj_doc_cursor_class);
+    rb_define_method(oj_doc_cursor_class, "cursor", cursor_cursor, -1);
+    rb_define_method(oj_doc_cursor_class, "doc", cursor_doc, 0);
+    rb_define_method(oj_doc_cursor_class, "where?", cursor_where, 0);
+    rb_define_method(oj_doc_cursor_class, "local_key", cursor_local_key, 0);
+    rb_define_method(oj_doc_cursor_class, "home", cursor_home, 0);
+    rb_define_method(oj_doc_cursor_class, "type", cursor_type, -1);
+    rb_define_method(oj_doc_cursor_class, "fetch", cursor_fetch, -1);
+    rb_define_method(oj_doc_cursor_class, "each_leaf", cursor_each_leaf, -1);
+    rb_define_method(oj_doc_cursor_class, "move", cursor_move, 1);
+    rb_define_method(oj_doc_cursor_class, "each_child", cursor_each_child, -1);
+    rb_define_method(oj_doc_cursor_class, "each_value", cursor_each_value, -1);
+    rb_define_method(oj_doc_cursor_class, "dump", cursor_dump, -1);
+
+    rb_define_module_function(Oj, "same_json?", same_json, 2);
+
+    oj_store_class = rb_define_class_under(Oj, "Store", rb_cObject);
+    rb_undef_alloc_func(oj_store_class);
+    rb_define_singleton_method(oj_store_class, "load", store_load, 1);
+    rb_define_singleton_method(oj_store_class, "parse", store_parse, 1);
+    rb_define_method(oj_store_class, "fetch", store_fetch, -1);
+    rb_define_method(oj_store_class, "type", store_type, -1);
+    rb_define_method(oj_store_class, "exists?", store_exists, 1);
+    rb_define_method(oj_store_class, "each", store_each, -1);
+    rb_define_method(oj_store_class, "size", store_size, 0);
+    rb_define_method(oj_store_class, "close", store_close, 0);
 }
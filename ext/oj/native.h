@@ -0,0 +1,97 @@
+/* native.h
+ * Copyright (c) 2011, Peter Ohler
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __OJ_NATIVE_H__
+#define __OJ_NATIVE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ruby.h"
+
+/* Parse events can be delivered to C functions instead of a Ruby handler so
+ * another extension can take them without Ruby calls or allocations. The
+ * extension fills in a NativeHandler, leaving the events it does not want as
+ * 0, and wraps it with oj_native_handler_new(). The Object returned is then
+ * passed as the handler to Oj.sc_parse() or Oj.saj_parse().
+ *
+ * Keys and strings are passed as a pointer and length and are only valid for
+ * the call. The key is 0 for array elements and the top level value. Numbers
+ * are passed as a NumInfo with the text of the number in str and len.
+ * add_value() is called for true, false, and null with Qtrue, Qfalse, and
+ * Qnil. Nothing needs to be linked against Oj as the handler is found by the
+ * Oj::NativeHandler class name and checked with the magic and version.
+ */
+
+#define OJ_NATIVE_MAGIC		0x4F6A4E48 /* OjNH */
+#define OJ_NATIVE_VERSION	1
+
+typedef struct _NumInfo {
+    int64_t	i;
+    int64_t	num;
+    int64_t	div;
+    const char	*str;
+    size_t	len;
+    long	exp;
+    int		dec_cnt;
+    int		big;
+    int		infinity;
+    int		nan;
+    int		neg;
+    int		hasExp;
+    int		no_big;
+} *NumInfo;
+
+typedef struct _NativeHandler {
+    uint32_t	magic;		/* OJ_NATIVE_MAGIC */
+    uint32_t	version;	/* OJ_NATIVE_VERSION */
+    void	*ctx;		/* passed to each function */
+    void	(*hash_start)(void *ctx, const char *key, size_t klen);
+    void	(*hash_end)(void *ctx, const char *key, size_t klen);
+    void	(*array_start)(void *ctx, const char *key, size_t klen);
+    void	(*array_end)(void *ctx, const char *key, size_t klen);
+    void	(*add_str)(void *ctx, const char *key, size_t klen, const char *str, size_t len);
+    void	(*add_num)(void *ctx, const char *key, size_t klen, NumInfo ni);
+    void	(*add_value)(void *ctx, const char *key, size_t klen, VALUE value);
+} *NativeHandler;
+
+/* Wraps a handler so it can be passed to the Oj parsers. The handler must
+ * stay valid for as long as the Object is used. The mark and free functions
+ * are called with the handler and can be 0.
+ */
+static inline VALUE
+oj_native_handler_new(NativeHandler handler, void (*mark_func)(void*), void (*free_func)(void*)) {
+    handler->magic = OJ_NATIVE_MAGIC;
+    handler->version = OJ_NATIVE_VERSION;
+
+    return Data_Wrap_Struct(rb_path2class("Oj::NativeHandler"), mark_func, free_func, handler);
+}
+
+#endif /* __OJ_NATIVE_H__ */
@@ -67,9 +67,11 @@ ID	oj_hash_set_id;
 ID	oj_hash_start_id;
 ID	oj_iconv_id;
 ID	oj_instance_variables_id;
+ID	oj_interest_id;
 ID	oj_json_create_id;
 ID	oj_length_id;
 ID	oj_new_id;
+ID	oj_on_events_id;
 ID	oj_parse_id;
 ID	oj_pos_id;
 ID	oj_read_id;
@@ -95,6 +97,7 @@ VALUE	oj_bigdecimal_class;
 VALUE	oj_cstack_class;
 VALUE	oj_date_class;
 VALUE	oj_datetime_class;
+VALUE	oj_native_handler_class;
 VALUE	oj_parse_error_class;
 VALUE	oj_stream_writer_class;
 VALUE	oj_string_writer_class;
@@ -705,7 +708,8 @@ oj_parse_options(VALUE ropts, Options copts) {
  *
  * This parser operates on string and will attempt to load files into memory if
  * a file object is passed as the first argument. A stream input will be parsed
- * using a stream parser but others use the slightly faster string parser.
+ * using a stream parser but others use the slightly faster string parser. A
+ * gzip or zlib compressed file or stream is inflated by the stream parser.
  *
  * A block can also be provided with a single argument. That argument will be
  * the parsed JSON document. This is useful when parsing a string that includes
@@ -769,7 +773,8 @@ load(int argc, VALUE *argv, VALUE self) {
  * JSON document) an exception is raised.
  *
  * This is a stream based parser which allows a large or huge file to be loaded
- * without pulling the whole file into memory.
+ * without pulling the whole file into memory. Files compressed with gzip or
+ * zlib are detected and inflated as they are read.
  *
  * A block can also be provided with a single argument. That argument will be
  * the parsed JSON document. This is useful when parsing a string that includes
@@ -816,18 +821,18 @@ load_file(int argc, VALUE *argv, VALUE self) {
     switch (mode) {
     case StrictMode:
 	oj_set_strict_callbacks(&pi);
-	return oj_pi_sparse(argc, argv, &pi, fd);
+	return oj_pi_sparse(argc, argv, &pi, fd, 1);
     case NullMode:
     case CompatMode:
 	oj_set_compat_callbacks(&pi);
-	return oj_pi_sparse(argc, argv, &pi, fd);
+	return oj_pi_sparse(argc, argv, &pi, fd, 1);
     case ObjectMode:
     default:
 	break;
     }
     oj_set_object_callbacks(&pi);
 
-    return oj_pi_sparse(argc, argv, &pi, fd);
+    return oj_pi_sparse(argc, argv, &pi, fd, 1);
 }
 
 /* call-seq: safe_load(doc)
@@ -865,7 +870,7 @@ safe_load(VALUE self, VALUE doc) {
  * @param [IO|String] io IO Object to read from
  */
 
-/* call-seq: sc_parse(handler, io)
+/* call-seq: sc_parse(handler, io, options={})
  *
  * Parses an IO stream or file containing a JSON document. Raises an exception
  * if the JSON is malformed. This is a callback parser (Simple Callback Parser)
@@ -874,8 +879,29 @@ safe_load(VALUE self, VALUE doc) {
  * callback parser is slightly more efficient than the Saj callback parser and
  * requires less argument checking.
  *
+ * If the handler responds to on_events() the events are collected and passed
+ * to it in batches of up to :batch_size events instead, see Oj::ScHandler.
+ *
+ * If the handler responds to interest() only the keys and paths it returns are
+ * passed on, see Oj::ScHandler.
+ *
  * @param [Oj::ScHandler] handler responds to Oj::ScHandler methods
  * @param [IO|String] io IO Object to read from
+ * @param [Hash] options parse options and :batch_size, 1000 by default
+ */
+
+/* call-seq: each_element(io, path=nil, options={}) { |elem| ... } => nil
+ *
+ * Parses a JSON document with the stream parser and yields each element of
+ * the top level array, or of the array at the path provided, as soon as the
+ * element has been read. Elements are not kept after the yield so memory use
+ * does not grow with the size of the array. The path is a '/' separated list
+ * of the object keys that lead to the array such as '/data/items'.
+ *
+ * @param [IO|String] io IO Object or JSON String to read from
+ * @param [String] path keys leading to the array to iterate over
+ * @param [Hash] options parse options (same as default_options)
+ * @yieldparam [Object] elem each element of the array
  */
 
 /* call-seq: dump(obj, options) => json-string
@@ -2033,6 +2059,9 @@ void Init_oj() {
 
     rb_define_module_function(Oj, "saj_parse", oj_saj_parse, -1);
     rb_define_module_function(Oj, "sc_parse", oj_sc_parse, -1);
+    oj_native_handler_class = rb_define_class_under(Oj, "NativeHandler", rb_cObject);
+    rb_undef_alloc_func(oj_native_handler_class);
+    rb_define_module_function(Oj, "each_element", oj_each_element, -1);
 
     oj_add_value_id = rb_intern("add_value");
     oj_array_append_id = rb_intern("array_append");
@@ -2049,9 +2078,11 @@ void Init_oj() {
     oj_hash_start_id = rb_intern("hash_start");
     oj_iconv_id = rb_intern("iconv");
     oj_instance_variables_id = rb_intern("instance_variables");
+    oj_interest_id = rb_intern("interest");
     oj_json_create_id = rb_intern("json_create");
     oj_length_id = rb_intern("length");
     oj_new_id = rb_intern("new");
+    oj_on_events_id = rb_intern("on_events");
     oj_parse_id = rb_intern("parse");
     oj_pos_id = rb_intern("pos");
     oj_read_id = rb_intern("read");
@@ -2148,6 +2179,12 @@ void Init_oj() {
  * The Ext module is a placeholder in the mimic JSON module used for
  * compatibility only.
  */
+/* Document-class: Oj::NativeHandler
+ * 
+ * A handler for Oj.sc_parse() and Oj.saj_parse() made by another C extension
+ * that takes the parse events in C. They are created with
+ * oj_native_handler_new() from native.h and not from Ruby.
+ */
 /* Document-class: JSON::Ext::Parser
  * 
  * The JSON::Ext::Parser is a placeholder in the mimic JSON module used for
@@ -149,6 +149,11 @@ typedef struct _Options {
     char	float_fmt[7];	// float format for dumping, if empty use Ruby
 } *Options;
 
+// Returns the text of a leaf that can be copied to the output as is or 0 if
+// the leaf must be dumped.
+struct _Leaf;
+typedef const char*	(*LeafRaw)(void *ctx, struct _Leaf *leaf, size_t *lenp);
+
 typedef struct _Out {
     char	*buf;
     char	*end;
@@ -160,6 +165,8 @@ typedef struct _Out {
     Options	opts;
     uint32_t	hash_cnt;
     int		allocated;
+    LeafRaw	leaf_raw;   // only used when dumping a Leaf
+    void	*leaf_ctx;
 } *Out;
 
 typedef struct _StrWriter {
@@ -184,6 +191,15 @@ enum {
     COL_VAL  = 0x02,
     RUBY_VAL = 0x03
 };
+
+// Leaf text parsed in place is not terminated. Strings end at the closing
+// quote and numbers at the first character that is not part of the number.
+// A DEFERRED container has not been built yet and holds its tape index.
+enum {
+    KEY_SPAN = 0x01,
+    STR_SPAN = 0x02,
+    DEFERRED = 0x04
+};
     
 typedef struct _Leaf {
     struct _Leaf	*next;
@@ -195,14 +211,18 @@ typedef struct _Leaf {
 	char		*str;	   // pointer to location in json string or allocated
 	struct _Leaf	*elements; // array and hash elements
 	VALUE		value;
+	size_t		jump;	   // tape index of a DEFERRED container
     };
     uint8_t		rtype;
     uint8_t		parent_type;
     uint8_t		value_type;
+    char		indexed;   // YesNo, NotSet until the first child lookup
+    uint8_t		span;	   // KEY_SPAN and STR_SPAN flags
 } *Leaf;
 
 extern VALUE	oj_saj_parse(int argc, VALUE *argv, VALUE self);
 extern VALUE	oj_sc_parse(int argc, VALUE *argv, VALUE self);
+extern VALUE	oj_each_element(int argc, VALUE *argv, VALUE self);
 
 extern VALUE	oj_strict_parse(int argc, VALUE *argv, VALUE self);
 extern VALUE	oj_strict_sparse(int argc, VALUE *argv, VALUE self);
@@ -218,8 +238,10 @@ extern void	oj_parse_options(VALUE ropts, Options copts);
 extern void	oj_dump_obj_to_json(VALUE obj, Options copts, Out out);
 extern void	oj_write_obj_to_file(VALUE obj, const char *path, Options copts);
 extern void	oj_write_obj_to_stream(VALUE obj, VALUE stream, Options copts);
-extern void	oj_dump_leaf_to_json(Leaf leaf, Options copts, Out out);
-extern void	oj_write_leaf_to_file(Leaf leaf, const char *path, Options copts);
+extern size_t	oj_leaf_str_len(Leaf leaf);
+extern size_t	oj_leaf_key_len(Leaf leaf);
+extern void	oj_dump_leaf_to_json(Leaf leaf, Options copts, Out out, LeafRaw raw, void *ctx);
+extern void	oj_write_leaf_to_file(Leaf leaf, const char *path, Options copts, LeafRaw raw, void *ctx);
 
 extern void	oj_str_writer_push_key(StrWriter sw, const char *key);
 extern void	oj_str_writer_push_object(StrWriter sw, const char *key);
@@ -245,6 +267,10 @@ extern VALUE	oj_cstack_class;
 extern VALUE	oj_date_class;
 extern VALUE	oj_datetime_class;
 extern VALUE	oj_doc_class;
+extern VALUE	oj_doc_path_class;
+extern VALUE	oj_doc_cursor_class;
+extern VALUE	oj_native_handler_class;
+extern VALUE	oj_store_class;
 extern VALUE	oj_stream_writer_class;
 extern VALUE	oj_string_writer_class;
 extern VALUE	oj_stringio_class;
@@ -252,6 +278,8 @@ extern VALUE	oj_struct_class;
 
 extern VALUE	oj_slash_string;
 
+extern struct _NativeHandler*	oj_native_handler(VALUE handler);
+
 extern ID	oj_add_value_id;
 extern ID	oj_array_append_id;
 extern ID	oj_array_end_id;
@@ -267,9 +295,11 @@ extern ID	oj_hash_set_id;
 extern ID	oj_hash_start_id;
 extern ID	oj_iconv_id;
 extern ID	oj_instance_variables_id;
+extern ID	oj_interest_id;
 extern ID	oj_json_create_id;
 extern ID	oj_length_id;
 extern ID	oj_new_id;
+extern ID	oj_on_events_id;
 extern ID	oj_parse_id;
 extern ID	oj_pos_id;
 extern ID	oj_read_id;
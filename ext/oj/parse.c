@@ -809,8 +809,14 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
 	} else if (rb_cFile == clas && 0 == FIX2INT(rb_funcall(input, oj_pos_id, 0))) {
 	    int		fd = FIX2INT(rb_funcall(input, oj_fileno_id, 0));
 	    ssize_t	cnt;
-	    size_t	len = lseek(fd, 0, SEEK_END);
+	    size_t	len;
+	    char	magic[2];
 
+	    // compressed files are inflated by the stream parser as they are read
+	    if (sizeof(magic) == pread(fd, magic, sizeof(magic), 0) && oj_reader_compressed(magic, sizeof(magic))) {
+		return oj_pi_sparse(argc, argv, pi, 0, yieldOk);
+	    }
+	    len = lseek(fd, 0, SEEK_END);
 	    lseek(fd, 0, SEEK_SET);
 	    buf = ALLOC_N(char, len + 1);
 	    pi->json = buf;
@@ -829,7 +835,7 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
 #endif
 	} else if (rb_respond_to(input, oj_read_id)) {
 	    // use stream parser instead
-	    return oj_pi_sparse(argc, argv, pi, 0);
+	    return oj_pi_sparse(argc, argv, pi, 0, yieldOk);
 	} else {
 	    rb_raise(rb_eArgError, "strict_parse() expected a String or IO Object.");
 }
@@ -39,22 +39,7 @@
 #include "val_stack.h"
 #include "circarray.h"
 #include "reader.h"
-
-typedef struct _NumInfo {
-    int64_t	i;
-    int64_t	num;
-    int64_t	div;
-    const char	*str;
-    size_t	len;
-    long	exp;
-    int		dec_cnt;
-    int		big;
-    int		infinity;
-    int		nan;
-    int		neg;
-    int		hasExp;
-    int		no_big;
-} *NumInfo;
+#include "native.h"
 
 typedef struct _ParseInfo {
     // used for the string parser
@@ -100,6 +85,6 @@ extern void	oj_set_object_callbacks(ParseInfo pi);
 extern void	oj_set_compat_callbacks(ParseInfo pi);
 
 extern void	oj_sparse2(ParseInfo pi);
-extern VALUE	oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd);
+extern VALUE	oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd, int yieldOk);
 
 #endif /* __OJ_PARSE_H__ */
@@ -38,6 +38,9 @@
 #endif
 #include <unistd.h>
 #include <time.h>
+#if HAS_ZLIB
+#include <zlib.h>
+#endif
 
 #include "ruby.h"
 #include "oj.h"
@@ -45,6 +48,19 @@
 
 #define BUF_PAD	4
 
+#if HAS_ZLIB
+// Compressed input is read into the src reader and inflated into the buffer
+// of the reader the parser sees so only one buffer of each is ever needed.
+typedef struct _Inflate {
+    z_stream		zs;
+    struct _Reader	src;
+} *Inflate;
+
+static void		zip_start(Reader reader);
+static int		check_zip(Reader reader, int err);
+static int		read_inflate(Reader reader);
+#endif
+
 static VALUE		rescue_cb(VALUE rdr, VALUE err);
 static VALUE		io_cb(VALUE rdr);
 static VALUE		partial_io_cb(VALUE rdr);
@@ -69,6 +85,8 @@ oj_reader_init(Reader reader, VALUE io, int fd) {
     reader->line = 1;
     reader->col = 0;
     reader->free_head = 0;
+    reader->zip = 0;
+    reader->check_zip = 0;
 
     if (0 != fd) {
 	reader->read_func = read_from_fd;
@@ -103,6 +121,137 @@ oj_reader_init(Reader reader, VALUE io, int fd) {
     } else {
 	rb_raise(rb_eArgError, "parser io argument must be a String or respond to readpartial() or read().\n");
     }
+#if HAS_ZLIB
+    // Nothing is read yet so that errors come from the read in the protected
+    // parse. The first read is checked for a gzip or zlib header.
+    reader->check_zip = (0 != reader->read_func);
+#endif
+}
+
+/* Returns non-zero if the bytes start with a gzip or zlib header. A zlib
+ * header that is also the start of a number ('8' followed by a digit) is not
+ * treated as compressed.
+ */
+int
+oj_reader_compressed(const char *head, size_t len) {
+#if HAS_ZLIB
+    const uint8_t	*b = (const uint8_t*)head;
+
+    if (2 > len) {
+	return 0;
+    }
+    if (0x1F == b[0] && 0x8B == b[1]) {
+	return 1;
+    }
+    return (0x08 == (0x0F & b[0]) && 0x70 >= (0xF0 & b[0]) && '8' != b[0] &&
+	    0 == (((int)b[0] << 8) | b[1]) % 31);
+#else
+    return 0;
+#endif
+}
+
+void
+oj_reader_zip_free(Reader reader) {
+#if HAS_ZLIB
+    Inflate	zip = reader->zip;
+
+    if (0 != zip) {
+	inflateEnd(&zip->zs);
+	reader_cleanup(&zip->src);
+	xfree(zip);
+	reader->zip = 0;
+    }
+#endif
+}
+
+/* Moves what has been read but not used to a buffer of at least size so a
+ * caller that takes the input in bulk reads from the IO less often. Nothing
+ * may be protected.
+ */
+void
+oj_reader_grow(Reader reader, size_t size) {
+    size_t	cnt = reader->read_end - reader->tail;
+    char	*head;
+
+    if (0 == reader->read_func || (size_t)(reader->end - reader->head) >= size) {
+	return;
+    }
+    head = ALLOC_N(char, size + BUF_PAD);
+    memcpy(head, reader->tail, cnt);
+    if (reader->free_head) {
+	xfree((char*)reader->head);
+    }
+    reader->head = head;
+    reader->free_head = 1;
+    reader->end = head + size;
+    reader->tail = head;
+    reader->read_end = head + cnt;
+    *reader->read_end = '\0';
+    reader->pro = 0;
+    reader->str = 0;
+}
+
+/* Updates the scan state with the text read and returns the last structural
+ * character outside of a string or comment or 0 if there is none. Text up to
+ * that character can be parsed without a token being cut in two.
+ */
+char*
+oj_reader_scan(ReaderScan scan, char *s, const char *end) {
+    char	*last = 0;
+
+    for (; s < end; s++) {
+	if (scan->in_str) {
+	    if (scan->esc) {
+		scan->esc = 0;
+	    } else if ('\\' == *s) {
+		scan->esc = 1;
+	    } else if ('"' == *s) {
+		scan->in_str = 0;
+	    }
+	    continue;
+	}
+	if ('*' == scan->comment) {
+	    // same as skip_comment(), the * that starts the comment does not end it
+	    if (scan->star && '/' == *s) {
+		scan->comment = 0;
+	    }
+	    scan->star = ('*' == *s && 0 != scan->comment);
+	    continue;
+	}
+	if ('/' == scan->comment) {
+	    if ('\n' == *s || '\r' == *s || '\f' == *s) {
+		scan->comment = 0;
+	    }
+	    continue;
+	}
+	if (scan->slash) {
+	    scan->slash = 0;
+	    if ('*' == *s || '/' == *s) {
+		scan->comment = *s;
+		scan->star = 0;
+		continue;
+	    }
+	}
+	switch (*s) {
+	case '"':
+	    scan->in_str = 1;
+	    break;
+	case '/':
+	    scan->slash = 1;
+	    break;
+	case ',':
+	case ':':
+	case '[':
+	case ']':
+	case '{':
+	case '}':
+	    last = s;
+	    break;
+	default:
+	    break;
+	}
+    }
+    return last;
 }
 
 int
@@ -120,7 +269,7 @@ oj_reader_read(Reader reader) {
 	} else {
 	    shift = reader->pro - reader->head - 1; // leave one character so we can backup one
 	}
-	if (0 >= shift) { /* no space left so allocate more */
+	if (0 >= shift || (0 != reader->pro && reader->pro <= reader->head)) { /* no space left so allocate more */
 	    const char	*old = reader->head;
 	    size_t	size = reader->end - reader->head + BUF_PAD;
 	
@@ -153,6 +302,11 @@ oj_reader_read(Reader reader) {
 	}
     }
     err = reader->read_func(reader);
+#if HAS_ZLIB
+    if (reader->check_zip) {
+	err = check_zip(reader, err);
+    }
+#endif
     *(char*)reader->read_end = '\0';
 
     return err;
@@ -185,7 +339,7 @@ partial_io_cb(VALUE rbuf) {
     }
     str = StringValuePtr(rstr);
     cnt = RSTRING_LEN(rstr);
-    strcpy(reader->tail, str);
+    memcpy(reader->tail, str, cnt);
     reader->read_end = reader->tail + cnt;
 
     return Qtrue;
@@ -207,7 +361,7 @@ io_cb(VALUE rbuf) {
     str = StringValuePtr(rstr);
     cnt = RSTRING_LEN(rstr);
     //printf("*** read %lu bytes, str: '%s'\n", cnt, str);
-    strcpy(reader->tail, str);
+    memcpy(reader->tail, str, cnt);
     reader->read_end = reader->tail + cnt;
 
     return Qtrue;
@@ -237,6 +391,94 @@ read_from_fd(Reader reader) {
     return 0;
 }
 
+#if HAS_ZLIB
+// Moves the source over to the src reader along with whatever has already been
+// read and then replaces the read function with one that inflates.
+static void
+zip_start(Reader reader) {
+    Inflate	zip = ALLOC(struct _Inflate);
+    Reader	src = &zip->src;
+    size_t	cnt = reader->read_end - reader->tail;
+
+    memset(&zip->zs, 0, sizeof(zip->zs));
+    // 15 is the largest window, adding 32 detects both gzip and zlib headers
+    if (Z_OK != inflateInit2(&zip->zs, 15 + 32)) {
+	xfree(zip);
+	rb_raise(rb_eIOError, "failed to initialize zlib inflate.\n");
+    }
+    *src = *reader;
+    src->free_head = 0;
+    src->zip = 0;
+    reader->zip = zip; // freed with the reader from here on
+    src->head = src->base;
+    src->end = src->head + sizeof(src->base) - BUF_PAD;
+    if ((size_t)(src->end - src->head) < cnt) { // the reader may have been grown
+	src->head = ALLOC_N(char, cnt + BUF_PAD);
+	src->free_head = 1;
+	src->end = src->head + cnt;
+    }
+    memcpy(src->head, reader->tail, cnt);
+    src->tail = src->head;
+    src->read_end = src->head + cnt;
+    *src->read_end = '\0';
+
+    reader->read_func = read_inflate;
+    reader->tail = reader->head;
+    reader->read_end = reader->head;
+    *reader->head = '\0';
+}
+
+// A first read can be a single byte so more is read until there are the two
+// the header check needs or the input ends.
+static int
+check_zip(Reader reader, int err) {
+    char	*tail;
+
+    reader->check_zip = 0;
+    while (0 == err && 2 > reader->read_end - reader->tail) {
+	// the read functions read into the buffer at the tail
+	tail = reader->tail;
+	reader->tail = reader->read_end;
+	err = reader->read_func(reader);
+	reader->tail = tail;
+    }
+    if (oj_reader_compressed(reader->tail, reader->read_end - reader->tail)) {
+	zip_start(reader);
+	return reader->read_func(reader);
+    }
+    return (reader->tail < reader->read_end) ? 0 : err;
+}
+
+static int
+read_inflate(Reader reader) {
+    Inflate	zip = reader->zip;
+    Reader	src = &zip->src;
+    uInt	max = (uInt)(reader->end - reader->tail);
+    int		rc;
+
+    zip->zs.next_out = (Bytef*)reader->tail;
+    zip->zs.avail_out = max;
+    while (max == zip->zs.avail_out) {
+	if (src->read_end <= src->tail && 0 != oj_reader_read(src)) {
+	    return -1;
+	}
+	zip->zs.next_in = (Bytef*)src->tail;
+	zip->zs.avail_in = (uInt)(src->read_end - src->tail);
+	rc = inflate(&zip->zs, Z_NO_FLUSH);
+	src->tail = (char*)zip->zs.next_in;
+	if (Z_STREAM_END == rc) {
+	    // concatenated gzip members are read as a single stream
+	    inflateReset(&zip->zs);
+	} else if (Z_OK != rc && Z_BUF_ERROR != rc) {
+	    rb_raise(oj_parse_error_class, "invalid compressed data at line %d, column %d\n", reader->line, reader->col);
+	}
+    }
+    reader->read_end = (char*)zip->zs.next_out;
+
+    return 0;
+}
+#endif
+
 // This is only called when the end of the string is reached so just return -1.
 /*
 static int
@@ -48,10 +48,25 @@ typedef struct _Reader {
 	VALUE		io;
 	const char	*in_str;
     };
+    struct _Inflate	*zip;	/* set when the input is gzip or zlib compressed */
+    int		check_zip;	/* the first read has not been checked for compression yet */
 } *Reader;
 
+// Where a scan of the text read is, see oj_reader_scan().
+typedef struct _ReaderScan {
+    int		in_str;
+    int		esc;
+    int		comment;	// '*' in a block comment and '/' in a line comment
+    int		slash;
+    int		star;
+} *ReaderScan;
+
 extern void	oj_reader_init(Reader reader, VALUE io, int fd);
 extern int	oj_reader_read(Reader reader);
+extern void	oj_reader_grow(Reader reader, size_t size);
+extern int	oj_reader_compressed(const char *head, size_t len);
+extern void	oj_reader_zip_free(Reader reader);
+extern char*	oj_reader_scan(ReaderScan scan, char *s, const char *end);
 
 static inline char
 reader_get(Reader reader) {
@@ -153,6 +168,9 @@ reader_cleanup(Reader reader) {
 	reader->head = 0;
 	reader->free_head = 0;
     }
+    if (0 != reader->zip) {
+	oj_reader_zip_free(reader);
+    }
 }
 
 static inline int
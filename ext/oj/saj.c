@@ -43,12 +43,31 @@
 
 #include "oj.h"
 #include "encode.h"
+#include "reader.h"
+#include "native.h"
+
+#define IO_CHUNK	65536
+
+typedef struct _Key {
+    const char		*str;
+    size_t		len;
+    VALUE		copy;	/* str once copied out of the buffer or Qnil */
+    struct _Key		*prev;	/* key of the enclosing member */
+} *Key;
 
 typedef struct _ParseInfo {
-    char	*str;		/* buffer being read from */
-    char	*s;		/* current position in buffer */
+    const char	*str;		/* buffer being read from */
+    const char	*s;		/* current position in buffer */
     void	*stack_min;
     VALUE	handler;
+    VALUE	scratch;	/* unescaped strings or Qnil until needed */
+    size_t	scratch_cap;
+    Key		keys;		/* keys of the members being read */
+    NativeHandler	native;	/* C handler used instead of handler or 0 */
+    Reader	rd;		/* set when parsing as the JSON is read */
+    char	*stop;		/* where a '\0' was written or 0 at the end */
+    char	saved;		/* character at stop */
+    struct _ReaderScan	scan;
     int		has_hash_start;
     int		has_hash_end;
     int		has_array_start;
@@ -57,25 +76,25 @@ typedef struct _ParseInfo {
     int		has_error;
 } *ParseInfo;
 
-static void	read_next(ParseInfo pi, const char *key);
-static void	read_hash(ParseInfo pi, const char *key);
-static void	read_array(ParseInfo pi, const char *key);
-static void	read_str(ParseInfo pi, const char *key);
-static void	read_num(ParseInfo pi, const char *key);
-static void	read_true(ParseInfo pi, const char *key);
-static void	read_false(ParseInfo pi, const char *key);
-static void	read_nil(ParseInfo pi, const char *key);
+static void	read_next(ParseInfo pi, Key key);
+static void	read_hash(ParseInfo pi, Key key);
+static void	read_array(ParseInfo pi, Key key);
+static void	read_str(ParseInfo pi, Key key);
+static void	read_num(ParseInfo pi, Key key);
+static void	read_true(ParseInfo pi, Key key);
+static void	read_false(ParseInfo pi, Key key);
+static void	read_nil(ParseInfo pi, Key key);
 static void	next_non_white(ParseInfo pi);
-static char*	read_quoted_value(ParseInfo pi);
+static const char*	read_quoted_value(ParseInfo pi, size_t *lenp);
 static void	skip_comment(ParseInfo pi);
-
-/* This JSON parser is a single pass, destructive, callback parser. It is a
- * single pass parse since it only make one pass over the characters in the
- * JSON document string. It is destructive because it re-uses the content of
- * the string for values in the callback and places \0 characters at various
- * places to mark the end of tokens and strings. It is a callback parser like
- * a SAX parser because it uses callback when document elements are
- * encountered.
+static void	refill(ParseInfo pi);
+
+/* This JSON parser is a single pass callback parser. It is a single pass
+ * parse since it only make one pass over the characters in the JSON document
+ * string. The string is read in place and never modified. Values are made
+ * directly from the string and only strings with escaped characters are
+ * unescaped into a scratch buffer first. It is a callback parser like a SAX
+ * parser because it uses callback when document elements are encountered.
  *
  * Parsing is very tolerant. Lack of headers and even mispelled element
  * endings are passed over without raising an error. A best attempt is made in
@@ -103,7 +122,7 @@ call_error(const char *msg, ParseInfo pi, const char* file, int line) {
 
 inline static void
 next_non_white(ParseInfo pi) {
-    for (; 1; pi->s++) {
+    while (1) {
 	switch(*pi->s) {
 	case ' ':
 	case '\t':
@@ -114,38 +133,78 @@ next_non_white(ParseInfo pi) {
 	case '/':
 	    skip_comment(pi);
 	    break;
+	case '\0':
+	    if (0 != pi->rd && pi->s == pi->stop) {
+		refill(pi);
+		continue;
+	    }
+	    return;
 	default:
 	    return;
 	}
+	pi->s++;
     }
 }
 
 inline static void
-call_add_value(VALUE handler, VALUE value, const char *key) {
+call_add_value(VALUE handler, VALUE value, Key key) {
     volatile VALUE	k;
 
     if (0 == key) {
 	k = Qnil;
     } else {
-	k = rb_str_new2(key);
+	k = rb_str_new(key->str, key->len);
 	k = oj_encode(k);
     }
     rb_funcall(handler, oj_add_value_id, 2, value, k);
 }
 
 inline static void
-call_no_value(VALUE handler, ID method, const char *key) {
+call_no_value(VALUE handler, ID method, Key key) {
     volatile VALUE	k;
 
     if (0 == key) {
 	k = Qnil;
     } else {
-	k = rb_str_new2(key);
+	k = rb_str_new(key->str, key->len);
 	k = oj_encode(k);
     }
     rb_funcall(handler, method, 1, k);
 }
 
+inline static void
+native_no_value(ParseInfo pi, void (*func)(void *ctx, const char *key, size_t klen), Key key) {
+    if (0 == key) {
+	func(pi->native->ctx, 0, 0);
+    } else {
+	func(pi->native->ctx, key->str, key->len);
+    }
+}
+
+inline static void
+add_value(ParseInfo pi, VALUE value, Key key) {
+    if (0 == pi->native) {
+	call_add_value(pi->handler, value, key);
+    } else if (0 != pi->native->add_value) {
+	if (0 == key) {
+	    pi->native->add_value(pi->native->ctx, 0, 0, value);
+	} else {
+	    pi->native->add_value(pi->native->ctx, key->str, key->len, value);
+	}
+    }
+}
+
+inline static void
+add_num(ParseInfo pi, NumInfo ni, Key key) {
+    if (0 != pi->native->add_num) {
+	if (0 == key) {
+	    pi->native->add_num(pi->native->ctx, 0, 0, ni);
+	} else {
+	    pi->native->add_num(pi->native->ctx, key->str, key->len, ni);
+	}
+    }
+}
+
 static void
 skip_comment(ParseInfo pi) {
     pi->s++; /* skip first / */
@@ -185,7 +244,7 @@ skip_comment(ParseInfo pi) {
 }
 
 static void
-read_next(ParseInfo pi, const char *key) {
+read_next(ParseInfo pi, Key key) {
     VALUE	obj;
 
     if ((void*)&obj < pi->stack_min) {
@@ -236,11 +295,15 @@ read_next(ParseInfo pi, const char *key) {
 }
 
 static void
-read_hash(ParseInfo pi, const char *key) {
-    const char	*ks;
-    
+read_hash(ParseInfo pi, Key key) {
+    struct _Key		k;
+
     if (pi->has_hash_start) {
-	call_no_value(pi->handler, oj_hash_start_id, key);
+	if (0 != pi->native) {
+	    native_no_value(pi, pi->native->hash_start, key);
+	} else {
+	    call_no_value(pi->handler, oj_hash_start_id, key);
+	}
     }
     pi->s++;
     next_non_white(pi);
@@ -249,7 +312,13 @@ read_hash(ParseInfo pi, const char *key) {
     } else {
 	while (1) {
 	    next_non_white(pi);
-	    ks = read_quoted_value(pi);
+	    k.str = read_quoted_value(pi, &k.len);
+	    k.copy = Qnil;
+	    if (Qnil != pi->scratch && RSTRING_PTR(pi->scratch) == k.str) {
+		// the scratch buffer is reused by the value so keep a copy
+		k.copy = rb_str_new(k.str, k.len);
+		k.str = RSTRING_PTR(k.copy);
+	    }
 	    next_non_white(pi);
 	    if (':' == *pi->s) {
 		pi->s++;
@@ -259,7 +328,10 @@ read_hash(ParseInfo pi, const char *key) {
 		}
 		raise_error("invalid format, expected :", pi->str, pi->s);
 	    }
-	    read_next(pi, ks);
+	    k.prev = pi->keys;
+	    pi->keys = &k;
+	    read_next(pi, &k);
+	    pi->keys = k.prev;
 	    next_non_white(pi);
 	    if ('}' == *pi->s) {
 		pi->s++;
@@ -275,14 +347,22 @@ read_hash(ParseInfo pi, const char *key) {
 	}
     }
     if (pi->has_hash_end) {
-	call_no_value(pi->handler, oj_hash_end_id, key);
+	if (0 != pi->native) {
+	    native_no_value(pi, pi->native->hash_end, key);
+	} else {
+	    call_no_value(pi->handler, oj_hash_end_id, key);
+	}
     }
 }
 
 static void
-read_array(ParseInfo pi, const char *key) {
+read_array(ParseInfo pi, Key key) {
     if (pi->has_array_start) {
-	call_no_value(pi->handler, oj_array_start_id, key);
+	if (0 != pi->native) {
+	    native_no_value(pi, pi->native->array_start, key);
+	} else {
+	    call_no_value(pi->handler, oj_array_start_id, key);
+	}
     }
     pi->s++;
     next_non_white(pi);
@@ -306,17 +386,30 @@ read_array(ParseInfo pi, const char *key) {
 	}
     }
     if (pi->has_array_end) {
-	call_no_value(pi->handler, oj_array_end_id, key);
+	if (0 != pi->native) {
+	    native_no_value(pi, pi->native->array_end, key);
+	} else {
+	    call_no_value(pi->handler, oj_array_end_id, key);
+	}
     }
 }
 
 static void
-read_str(ParseInfo pi, const char *key) {
-    char	*text;
-
-    text = read_quoted_value(pi);
-    if (pi->has_add_value) {
-	VALUE	s = rb_str_new2(text);
+read_str(ParseInfo pi, Key key) {
+    const char	*text;
+    size_t	len;
+
+    text = read_quoted_value(pi, &len);
+    if (0 != pi->native) {
+	if (0 != pi->native->add_str) {
+	    if (0 == key) {
+		pi->native->add_str(pi->native->ctx, 0, 0, text, len);
+	    } else {
+		pi->native->add_str(pi->native->ctx, key->str, key->len, text, len);
+	    }
+	}
+    } else if (pi->has_add_value) {
+	VALUE	s = rb_str_new(text, len);
 
 	s = oj_encode(s);
 	call_add_value(pi->handler, s, key);
@@ -330,8 +423,8 @@ read_str(ParseInfo pi, const char *key) {
 #endif
 
 static void
-read_num(ParseInfo pi, const char *key) {
-    char	*start = pi->s;
+read_num(ParseInfo pi, Key key) {
+    const char	*start = pi->s;
     int64_t	n = 0;
     long	a = 0;
     long	div = 1;
@@ -339,6 +432,8 @@ read_num(ParseInfo pi, const char *key) {
     int		neg = 0;
     int		eneg = 0;
     int		big = 0;
+    int		dec_cnt = 0;
+    int		has_exp = 0;
 
     if ('-' == *pi->s) {
 	pi->s++;
@@ -354,7 +449,16 @@ read_num(ParseInfo pi, const char *key) {
 	    raise_error("number or other value", pi->str, pi->s);
 	}
 	pi->s += 8;
-	if (neg) {
+	if (0 != pi->native) {
+	    struct _NumInfo	ni;
+
+	    memset(&ni, 0, sizeof(ni));
+	    ni.str = start;
+	    ni.len = pi->s - start;
+	    ni.infinity = 1;
+	    ni.neg = neg;
+	    add_num(pi, &ni, key);
+	} else if (neg) {
 	    if (pi->has_add_value) {
 		call_add_value(pi->handler, rb_float_new(-OJ_INFINITY), key);
 	    }
@@ -366,6 +470,9 @@ read_num(ParseInfo pi, const char *key) {
 	return;
     }
     for (; '0' <= *pi->s && *pi->s <= '9'; pi->s++) {
+	if (0 < dec_cnt || '0' != *pi->s) {
+	    dec_cnt++;
+	}
 	if (big) {
 	    big++;
 	} else {
@@ -378,6 +485,7 @@ read_num(ParseInfo pi, const char *key) {
     if ('.' == *pi->s) {
 	pi->s++;
 	for (; '0' <= *pi->s && *pi->s <= '9'; pi->s++) {
+	    dec_cnt++;
 	    a = a * 10 + (*pi->s - '0');
 	    div *= 10;
 	    if (NUM_MAX <= div) {
@@ -386,6 +494,7 @@ read_num(ParseInfo pi, const char *key) {
 	}
     }
     if ('e' == *pi->s || 'E' == *pi->s) {
+	has_exp = 1;
 	pi->s++;
 	if ('-' == *pi->s) {
 	    pi->s++;
@@ -400,15 +509,28 @@ read_num(ParseInfo pi, const char *key) {
 	    }
 	}
     }
+    if (0 != pi->native) {
+	struct _NumInfo	ni;
+
+	memset(&ni, 0, sizeof(ni));
+	ni.str = start;
+	ni.len = pi->s - start;
+	ni.i = n;
+	ni.num = a;
+	ni.div = div;
+	ni.exp = eneg ? -e : e;
+	ni.dec_cnt = dec_cnt;
+	ni.big = big;
+	ni.neg = neg;
+	ni.hasExp = has_exp;
+	add_num(pi, &ni, key);
+	return;
+    }
     if (0 == e && 0 == a && 1 == div) {
 	if (big) {
-	    char	c = *pi->s;
-	
-	    *pi->s = '\0';
 	    if (pi->has_add_value) {
-		call_add_value(pi->handler, rb_funcall(oj_bigdecimal_class, oj_new_id, 1, rb_str_new2(start)), key);
+		call_add_value(pi->handler, rb_funcall(oj_bigdecimal_class, oj_new_id, 1, rb_str_new(start, pi->s - start)), key);
 	    }
-	    *pi->s = c;
 	} else {
 	    if (neg) {
 		n = -n;
@@ -420,13 +542,9 @@ read_num(ParseInfo pi, const char *key) {
 	return;
     } else { /* decimal */
 	if (big) {
-	    char	c = *pi->s;
-	
-	    *pi->s = '\0';
 	    if (pi->has_add_value) {
-		call_add_value(pi->handler, rb_funcall(oj_bigdecimal_class, oj_new_id, 1, rb_str_new2(start)), key);
+		call_add_value(pi->handler, rb_funcall(oj_bigdecimal_class, oj_new_id, 1, rb_str_new(start, pi->s - start)), key);
 	    }
-	    *pi->s = c;
 	} else {
 	    double	d = (double)n + (double)a / (double)div;
 
@@ -450,7 +568,7 @@ read_num(ParseInfo pi, const char *key) {
 }
 
 static void
-read_true(ParseInfo pi, const char *key) {
+read_true(ParseInfo pi, Key key) {
     pi->s++;
     if ('r' != *pi->s || 'u' != *(pi->s + 1) || 'e' != *(pi->s + 2)) {
 	if (pi->has_error) {
@@ -460,12 +578,12 @@ read_true(ParseInfo pi, const char *key) {
     }
     pi->s += 3;
     if (pi->has_add_value) {
-	call_add_value(pi->handler, Qtrue, key);
+	add_value(pi, Qtrue, key);
     }
 }
 
 static void
-read_false(ParseInfo pi, const char *key) {
+read_false(ParseInfo pi, Key key) {
     pi->s++;
     if ('a' != *pi->s || 'l' != *(pi->s + 1) || 's' != *(pi->s + 2) || 'e' != *(pi->s + 3)) {
 	if (pi->has_error) {
@@ -475,12 +593,12 @@ read_false(ParseInfo pi, const char *key) {
     }
     pi->s += 4;
     if (pi->has_add_value) {
-	call_add_value(pi->handler, Qfalse, key);
+	add_value(pi, Qfalse, key);
     }
 }
 
 static void
-read_nil(ParseInfo pi, const char *key) {
+read_nil(ParseInfo pi, Key key) {
     pi->s++;
     if ('u' != *pi->s || 'l' != *(pi->s + 1) || 'l' != *(pi->s + 2)) {
 	if (pi->has_error) {
@@ -490,12 +608,12 @@ read_nil(ParseInfo pi, const char *key) {
     }
     pi->s += 3;
     if (pi->has_add_value) {
-	call_add_value(pi->handler, Qnil, key);
+	add_value(pi, Qnil, key);
     }
 }
 
 static uint32_t
-read_hex(ParseInfo pi, char *h) {
+read_hex(ParseInfo pi, const char *h) {
     uint32_t	b = 0;
     int		i;
 
@@ -558,23 +676,51 @@ unicode_to_chars(ParseInfo pi, char *t, uint32_t code) {
 }
 
 /* Assume the value starts immediately and goes until the quote character is
- * reached again. Do not read the character after the terminating quote.
+ * reached again. Do not read the character after the terminating quote. The
+ * value is in the JSON string unless it has escaped characters in which case
+ * it is unescaped into the scratch buffer. The value is not terminated.
  */
-static char*
-read_quoted_value(ParseInfo pi) {
-    char	*value = 0;
-    char	*h = pi->s; /* head */
-    char	*t = h;	    /* tail */
+static const char*
+read_quoted_value(ParseInfo pi, size_t *lenp) {
+    const char	*value = pi->s + 1; /* skip quote character */
+    const char	*h = value; /* head */
+    const char	*e;
+    char	*t;	    /* tail */
     uint32_t	code;
-    
-    h++;	/* skip quote character */
-    t++;
-    value = h;
-    for (; '"' != *h; h++, t++) {
+
+    for (; '"' != *h && '\\' != *h; h++) {
 	if ('\0' == *h) {
 	    pi->s = h;
 	    raise_error("quoted string not terminated", pi->str, pi->s);
-	} else if ('\\' == *h) {
+	}
+    }
+    if ('"' == *h) {
+	*lenp = h - value;
+	pi->s = h + 1;
+	return value;
+    }
+    for (e = h; '"' != *e; e++) {
+	if ('\0' == *e) {
+	    pi->s = e;
+	    raise_error("quoted string not terminated", pi->str, pi->s);
+	} else if ('\\' == *e && '\0' != e[1]) {
+	    e++;
+	}
+    }
+    /* unescaped values are never longer than the escaped ones */
+    if (pi->scratch_cap < (size_t)(e - value)) {
+	pi->scratch_cap = (e - value) * 2;
+	if (Qnil == pi->scratch) {
+	    pi->scratch = rb_str_buf_new(pi->scratch_cap);
+	}
+	rb_str_resize(pi->scratch, pi->scratch_cap);
+    }
+    t = RSTRING_PTR(pi->scratch);
+    memcpy(t, value, h - value);
+    t += h - value;
+    value = RSTRING_PTR(pi->scratch);
+    for (; h < e; h++, t++) {
+	if ('\\' == *h) {
 	    h++;
 	    switch (*h) {
 	    case 'n':	*t = '\n';	break;
@@ -617,26 +763,112 @@ read_quoted_value(ParseInfo pi) {
 		raise_error("invalid escaped character", pi->str, pi->s);
 		break;
 	    }
-	} else if (t != h) {
+	} else {
 	    *t = *h;
 	}
     }
-    *t = '\0'; /* terminate value */
-    pi->s = h + 1;
+    *lenp = t - value;
+    pi->s = e + 1;
 
     return value;
 }
 
+/* Places the stop at the last structural character in the text read so the
+ * parser never reaches the end of the buffer in the middle of a token. With
+ * no structural character the parser comes right back for more.
+ */
 static void
-saj_parse(VALUE handler, char *json) {
-    volatile VALUE	obj = Qnil;
-    struct _ParseInfo	pi;
+set_stop(ParseInfo pi, char *fresh, int eof) {
+    char	*last;
 
-    if (0 == json) {
-	if (pi.has_error) {
-	    call_error("Invalid arg, xml string can not be null", &pi, __FILE__, __LINE__);
+    if (eof) {
+	pi->stop = 0;
+	return;
+    }
+    last = oj_reader_scan(&pi->scan, fresh, pi->rd->read_end);
+    pi->stop = (0 == last) ? (char*)pi->s : last;
+    pi->saved = *pi->stop;
+    *pi->stop = '\0';
+}
+
+/* Called when the parser reaches the stop. What has not been parsed yet is
+ * kept in the reader buffer, which may move, and more is read after it.
+ */
+static void
+refill(ParseInfo pi) {
+    Reader	rd = pi->rd;
+    Key		k;
+    int		eof;
+
+    // the buffer may move so keys still in use are copied out of it
+    for (k = pi->keys; 0 != k; k = k->prev) {
+	if (Qnil == k->copy) {
+	    k->copy = rb_str_new(k->str, k->len);
+	    k->str = RSTRING_PTR(k->copy);
 	}
-	raise_error("Invalid arg, xml string can not be null", json, 0);
+    }
+    *pi->stop = pi->saved;
+    rd->pro = (char*)pi->s;
+    rd->tail = rd->read_end;
+    eof = (0 != oj_reader_read(rd));
+    pi->s = rd->pro;
+    // errors are reported relative to the text kept
+    pi->str = pi->s;
+    rd->pro = 0;
+    set_stop(pi, rd->tail, eof);
+}
+
+static void
+set_handler(ParseInfo pi, VALUE handler) {
+    NativeHandler	nh = oj_native_handler(handler);
+
+    pi->handler = handler;
+    pi->native = nh;
+    if (0 != nh) {
+	pi->has_hash_start = (0 != nh->hash_start);
+	pi->has_hash_end = (0 != nh->hash_end);
+	pi->has_array_start = (0 != nh->array_start);
+	pi->has_array_end = (0 != nh->array_end);
+	pi->has_add_value = 1;
+	pi->has_error = 0;
+    } else {
+	pi->has_hash_start = rb_respond_to(handler, oj_hash_start_id);
+	pi->has_hash_end = rb_respond_to(handler, oj_hash_end_id);
+	pi->has_array_start = rb_respond_to(handler, oj_array_start_id);
+	pi->has_array_end = rb_respond_to(handler, oj_array_end_id);
+	pi->has_add_value = rb_respond_to(handler, oj_add_value_id);
+	pi->has_error = rb_respond_to(handler, oj_error_id);
+    }
+}
+
+static VALUE
+protect_parse(VALUE x) {
+    ParseInfo	pi = (ParseInfo)x;
+
+    read_next(pi, 0);
+    next_non_white(pi);
+    if ('\0' != *pi->s) {
+	if (pi->has_error) {
+	    call_error("invalid format, extra characters", pi, __FILE__, __LINE__);
+	} else {
+	    raise_error("invalid format, extra characters", pi->str, pi->s);
+	}
+    }
+    return Qnil;
+}
+
+/* The JSON String is read in place so unless frozen it is locked against
+ * changes from the handler while being parsed.
+ */
+static void
+saj_parse(VALUE handler, VALUE input) {
+    volatile VALUE	obj = input;
+    struct _ParseInfo	pi;
+    const char		*json = RSTRING_PTR(input);
+
+    if ('\0' != json[RSTRING_LEN(input)]) {
+	obj = rb_str_new(json, RSTRING_LEN(input));
+	json = RSTRING_PTR(obj);
     }
     /* skip UTF-8 BOM if present */
     if (0xEF == (uint8_t)*json && 0xBB == (uint8_t)json[1] && 0xBF == (uint8_t)json[2]) {
@@ -658,78 +890,81 @@ saj_parse(VALUE handler, char *json) {
 	}
     }
 #endif
-    pi.handler = handler;
-    pi.has_hash_start = rb_respond_to(handler, oj_hash_start_id);
-    pi.has_hash_end = rb_respond_to(handler, oj_hash_end_id);
-    pi.has_array_start = rb_respond_to(handler, oj_array_start_id);
-    pi.has_array_end = rb_respond_to(handler, oj_array_end_id);
-    pi.has_add_value = rb_respond_to(handler, oj_add_value_id);
-    pi.has_error = rb_respond_to(handler, oj_error_id);
-    read_next(&pi, 0);
-    next_non_white(&pi);
-    if ('\0' != *pi.s) {
-	if (pi.has_error) {
-	    call_error("invalid format, extra characters", &pi, __FILE__, __LINE__);
-	} else {
-	    raise_error("invalid format, extra characters", pi.str, pi.s);
+    pi.scratch = Qnil;
+    pi.scratch_cap = 0;
+    pi.keys = 0;
+    pi.rd = 0;
+    set_handler(&pi, handler);
+    if (OBJ_FROZEN(obj)) {
+	protect_parse((VALUE)&pi);
+    } else {
+	rb_str_locktmp(obj);
+	rb_ensure(protect_parse, (VALUE)&pi, rb_str_unlocktmp, obj);
+    }
+}
+
+static VALUE
+stream_cleanup(VALUE x) {
+    reader_cleanup((Reader)x);
+
+    return Qnil;
+}
+
+/* Parses as the JSON is read from the IO so only the text between the last
+ * structural character parsed and the end of what was read is kept.
+ */
+static void
+saj_parse_io(VALUE handler, VALUE io) {
+    struct _Reader	rd;
+    struct _ParseInfo	pi;
+
+    memset(&pi, 0, sizeof(pi));
+    pi.scratch = Qnil;
+#if IS_WINDOWS
+    pi.stack_min = (void*)((char*)&pi - (512 * 1024)); /* assume a 1M stack and give half to ruby */
+#else
+    {
+	struct rlimit	lim;
+
+	if (0 == getrlimit(RLIMIT_STACK, &lim)) {
+	    pi.stack_min = (void*)((char*)&lim - (lim.rlim_cur / 4 * 3)); /* let 3/4ths of the stack be used only */
 	}
     }
+#endif
+    set_handler(&pi, handler);
+    oj_reader_init(&rd, io, 0);
+    oj_reader_grow(&rd, IO_CHUNK);
+    pi.rd = &rd;
+    pi.str = rd.tail;
+    pi.s = rd.tail;
+    set_stop(&pi, rd.tail, 0);
+    rb_ensure(protect_parse, (VALUE)&pi, stream_cleanup, (VALUE)&rd);
 }
 
 /* call-seq: saj_parse(handler, io)
  *
  * Parses an IO stream or file containing an JSON document. Raises an exception
- * if the JSON is malformed.
+ * if the JSON is malformed. A String is parsed without making a copy of it. An
+ * IO is parsed as it is read so documents larger than memory can be parsed.
  * @param [Oj::Saj] handler Saj (responds to Oj::Saj methods) like handler
  * @param [IO|String] io IO Object to read from
  */
 VALUE
 oj_saj_parse(int argc, VALUE *argv, VALUE self) {
-    char	*json = 0;
-    size_t	len = 0;
-    VALUE	input = argv[1];
+    VALUE	input;
 
     if (argc < 2) {
 	rb_raise(rb_eArgError, "Wrong number of arguments to saj_parse.\n");
     }
+    input = argv[1];
     if (rb_type(input) == T_STRING) {
-	// the json string gets modified so make a copy of it
-	len = RSTRING_LEN(input) + 1;
-	json = ALLOC_N(char, len);
-	strcpy(json, StringValuePtr(input));
+	saj_parse(*argv, input);
+    } else if (oj_stringio_class == rb_obj_class(input)) {
+	saj_parse(*argv, rb_funcall2(input, oj_string_id, 0, 0));
+    } else if (rb_respond_to(input, oj_readpartial_id) || rb_respond_to(input, oj_read_id)) {
+	saj_parse_io(*argv, input);
     } else {
-	VALUE		clas = rb_obj_class(input);
-	volatile VALUE	s;
-	
-	if (oj_stringio_class == clas) {
-	    s = rb_funcall2(input, oj_string_id, 0, 0);
-	    len = RSTRING_LEN(s) + 1;
-	    json = ALLOC_N(char, len);
-	    strcpy(json, rb_string_value_cstr((VALUE*)&s));
-#if !IS_WINDOWS
-	} else if (rb_cFile == clas && 0 == FIX2INT(rb_funcall(input, oj_pos_id, 0))) {
-	    int		fd = FIX2INT(rb_funcall(input, oj_fileno_id, 0));
-	    ssize_t	cnt;
-
-	    len = lseek(fd, 0, SEEK_END);
-	    lseek(fd, 0, SEEK_SET);
-	    json = ALLOC_N(char, len + 1);
-	    if (0 >= (cnt = read(fd, json, len)) || cnt != (ssize_t)len) {
-		rb_raise(rb_eIOError, "failed to read from IO Object.");
-	    }
-	    json[len] = '\0';
-#endif
-	} else if (rb_respond_to(input, oj_read_id)) {
-	    s = rb_funcall2(input, oj_read_id, 0, 0);
-	    len = RSTRING_LEN(s) + 1;
-	    json = ALLOC_N(char, len);
-	    strcpy(json, rb_string_value_cstr((VALUE*)&s));
-	} else {
-	    rb_raise(rb_eArgError, "saj_parse() expected a String or IO Object.");
-	}
+	rb_raise(rb_eArgError, "saj_parse() expected a String or IO Object.");
     }
-    saj_parse(*argv, json);
-    xfree(json);
-
     return Qnil;
 }
@@ -182,10 +182,725 @@ array_append_value(ParseInfo pi, VALUE value) {
     rb_funcall(pi->handler, oj_array_append_id, 2, stack_peek(&pi->stack)->val, value);
 }
 
+// Native handlers, see native.h. Containers are Qundef on the stack so the
+// values added for them when they end are not passed on.
+
+/* Returns the handler if it is a NativeHandler or 0 if not. */
+NativeHandler
+oj_native_handler(VALUE handler) {
+    NativeHandler	nh;
+
+    if (T_DATA != rb_type(handler) || !rb_obj_is_kind_of(handler, oj_native_handler_class)) {
+	return 0;
+    }
+    nh = (NativeHandler)DATA_PTR(handler);
+    if (0 == nh || OJ_NATIVE_MAGIC != nh->magic) {
+	rb_raise(rb_eTypeError, "not a valid Oj::NativeHandler");
+    }
+    if (OJ_NATIVE_VERSION != nh->version) {
+	rb_raise(rb_eTypeError, "Oj::NativeHandler version %u is not supported, expected %d", nh->version, OJ_NATIVE_VERSION);
+    }
+    return nh;
+}
+
+inline static NativeHandler
+native(ParseInfo pi) {
+    return (NativeHandler)DATA_PTR(pi->handler);
+}
+
+// The key of the member a value in parent is for or 0.
+inline static const char*
+member_key(Val parent, size_t *klen) {
+    if (0 == parent || NEXT_HASH_VALUE != parent->next) {
+	*klen = 0;
+	return 0;
+    }
+    *klen = parent->klen;
+
+    return parent->key;
+}
+
+static VALUE
+native_start_hash(ParseInfo pi) {
+    const char	*key;
+    size_t	klen;
+
+    key = member_key(stack_peek(&pi->stack), &klen);
+    native(pi)->hash_start(native(pi)->ctx, key, klen);
+
+    return Qundef;
+}
+
+static void
+native_end_hash(ParseInfo pi) {
+    Val		hash = stack_peek(&pi->stack); // still on the stack
+    const char	*key;
+    size_t	klen;
+
+    key = member_key((pi->stack.head < hash) ? hash - 1 : 0, &klen);
+    native(pi)->hash_end(native(pi)->ctx, key, klen);
+}
+
+static VALUE
+native_start_array(ParseInfo pi) {
+    const char	*key;
+    size_t	klen;
+
+    key = member_key(stack_peek(&pi->stack), &klen);
+    native(pi)->array_start(native(pi)->ctx, key, klen);
+
+    return Qundef;
+}
+
+static void
+native_end_array(ParseInfo pi) {
+    const char	*key;
+    size_t	klen;
+
+    key = member_key(stack_peek(&pi->stack), &klen); // already popped
+    native(pi)->array_end(native(pi)->ctx, key, klen);
+}
+
+static VALUE
+native_noop_start(ParseInfo pi) {
+    return Qundef;
+}
+
+static void
+native_add_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
+    native(pi)->add_str(native(pi)->ctx, 0, 0, str, len);
+}
+
+static void
+native_add_num(ParseInfo pi, NumInfo ni) {
+    native(pi)->add_num(native(pi)->ctx, 0, 0, ni);
+}
+
+static void
+native_add_value(ParseInfo pi, VALUE val) {
+    if (Qundef != val) {
+	native(pi)->add_value(native(pi)->ctx, 0, 0, val);
+    }
+}
+
+static void
+native_hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *orig) {
+    native(pi)->add_str(native(pi)->ctx, kval->key, kval->klen, str, len);
+}
+
+static void
+native_hash_set_num(ParseInfo pi, Val kval, NumInfo ni) {
+    native(pi)->add_num(native(pi)->ctx, kval->key, kval->klen, ni);
+}
+
+static void
+native_hash_set_value(ParseInfo pi, Val kval, VALUE value) {
+    if (Qundef != value) {
+	native(pi)->add_value(native(pi)->ctx, kval->key, kval->klen, value);
+    }
+}
+
+static void
+set_native_callbacks(ParseInfo pi, NativeHandler nh) {
+    pi->start_hash = (0 != nh->hash_start) ? native_start_hash : native_noop_start;
+    pi->end_hash = (0 != nh->hash_end) ? native_end_hash : noop_end;
+    pi->hash_key = noop_hash_key;
+    pi->start_array = (0 != nh->array_start) ? native_start_array : native_noop_start;
+    pi->end_array = (0 != nh->array_end) ? native_end_array : noop_end;
+    pi->add_cstr = (0 != nh->add_str) ? native_add_cstr : noop_add_cstr;
+    pi->add_num = (0 != nh->add_num) ? native_add_num : noop_add_num;
+    pi->add_value = (0 != nh->add_value) ? native_add_value : noop_add_value;
+    pi->hash_set_cstr = (0 != nh->add_str) ? native_hash_set_cstr : noop_hash_set_cstr;
+    pi->hash_set_num = (0 != nh->add_num) ? native_hash_set_num : noop_hash_set_num;
+    pi->hash_set_value = (0 != nh->add_value) ? native_hash_set_value : noop_hash_set_value;
+    // array members are passed without a key
+    pi->array_append_cstr = pi->add_cstr;
+    pi->array_append_num = pi->add_num;
+    pi->array_append_value = pi->add_value;
+    pi->expect_value = 1;
+}
+
+// Handlers that respond to interest() name the keys and paths they want.
+// The callbacks are wrapped so that members that do not match, and all they
+// contain, never reach the handler.
+
+#define INTEREST_MAX	64
+#define LEVEL_INC	16
+
+typedef struct _Step {
+    const char	*key;
+    size_t	klen;
+    long	index;		// 1 based Array index or 0 if not a number
+} *Step;
+
+typedef struct _Interest {
+    Step	steps;
+    int		cnt;
+    int		anywhere;	// a key without a path matches at any depth
+} *Interest;
+
+typedef struct _Level {
+    uint64_t	alive;		// interests matched up to this container
+    uint64_t	member;		// interests matched up to the current member
+    long	cnt;		// members so far for Array indexes
+    int		full;		// the current member is wanted with all it holds
+    int		array;
+} *Level;
+
+typedef struct _Filter {
+    struct _ParseInfo	pi;	// first so the callbacks can cast their ParseInfo
+    struct _ParseInfo	target;	// the callbacks that wanted events go to
+    struct _Interest	interests[INTEREST_MAX];
+    int			icnt;
+    struct _Step	*steps;
+    Level		levels;	// levels[0] is the document itself
+    Level		top;
+    Level		end;
+    long		skip;	// depth in a member that is not wanted
+    long		full;	// depth in a member that is wanted whole
+    int			closed;	// a container ended and its value is next
+    int			argc;
+    VALUE		*argv;
+    volatile VALUE	paths;
+} *Filter;
+
+inline static int
+step_match(Step step, const char *key, size_t klen, long index) {
+    if (1 == step->klen && '*' == *step->key) {
+	return 1;
+    }
+    if (0 == key) {
+	return index == step->index;
+    }
+    return (klen == step->klen && 0 == memcmp(key, step->key, klen));
+}
+
+// Sets the member and full fields of lev for a member with a key or index.
+static void
+member_match(Filter f, Level lev, const char *key, size_t klen, long index) {
+    Interest	in = f->interests;
+    uint64_t	bit = 1;
+    uint64_t	member = 0;
+    int		pos = (int)(lev - f->levels) - 1;
+    int		full = 0;
+
+    for (; in < f->interests + f->icnt; in++, bit <<= 1) {
+	if (0 == (bit & lev->alive)) {
+	    continue;
+	}
+	if (0 > pos) { // the document
+	    if (0 == in->cnt) {
+		full = 1;
+	    }
+	    member |= bit;
+	} else if (in->anywhere) {
+	    if (0 != key && klen == in->steps->klen && 0 == memcmp(key, in->steps->key, klen)) {
+		full = 1;
+	    }
+	    member |= bit;
+	} else if (step_match(in->steps + pos, key, klen, index)) {
+	    if (pos + 1 == in->cnt) {
+		full = 1;
+	    } else {
+		member |= bit;
+	    }
+	}
+    }
+    lev->member = member;
+    lev->full = full;
+}
+
+// Hash members are matched when the key is read, everything else when the
+// value starts.
+static Level
+next_member(Filter f) {
+    Level	lev = f->top;
+
+    if (lev->array) {
+	lev->cnt++;
+	member_match(f, lev, 0, 0, lev->cnt);
+    } else if (f->levels == lev) {
+	member_match(f, lev, 0, 0, 0);
+    }
+    return lev;
+}
+
+static void
+push_level(Filter f, uint64_t alive, int array) {
+    if (f->end <= f->top + 1) {
+	long	len = f->end - f->levels;
+	long	off = f->top - f->levels;
+
+	REALLOC_N(f->levels, struct _Level, len + LEVEL_INC);
+	f->top = f->levels + off;
+	f->end = f->levels + len + LEVEL_INC;
+    }
+    f->top++;
+    f->top->alive = alive;
+    f->top->member = 0;
+    f->top->cnt = 0;
+    f->top->full = 0;
+    f->top->array = array;
+}
+
+static VALUE
+filter_start(Filter f, VALUE (*start)(ParseInfo pi), int array) {
+    Level	lev;
+
+    f->closed = 0;
+    if (0 < f->skip) {
+	f->skip++;
+	return Qnil;
+    }
+    if (0 < f->full) {
+	f->full++;
+	return start(&f->pi);
+    }
+    lev = next_member(f);
+    if (lev->full) {
+	f->full = 1;
+    } else if (0 == lev->member) {
+	f->skip = 1;
+	return Qnil;
+    } else {
+	push_level(f, lev->member, array);
+    }
+    return start(&f->pi);
+}
+
+static void
+filter_end(Filter f, void (*end)(ParseInfo pi)) {
+    f->closed = 1;
+    if (0 < f->skip) {
+	f->skip--;
+	return;
+    }
+    if (0 < f->full) {
+	f->full--;
+    } else {
+	f->top--;
+    }
+    end(&f->pi);
+}
+
+// Called for each value that is not a container start. The value of a
+// container that just ended was decided when it started.
+static int
+value_wanted(Filter f) {
+    int	closed = f->closed;
+
+    f->closed = 0;
+    if (0 < f->skip) {
+	return 0;
+    }
+    if (0 < f->full) {
+	return 1;
+    }
+    if (closed) {
+	return f->top->full || 0 != f->top->member;
+    }
+    return next_member(f)->full;
+}
+
+static VALUE
+filter_start_hash(ParseInfo pi) {
+    return filter_start((Filter)pi, ((Filter)pi)->target.start_hash, 0);
+}
+
+static void
+filter_end_hash(ParseInfo pi) {
+    filter_end((Filter)pi, ((Filter)pi)->target.end_hash);
+}
+
+static VALUE
+filter_start_array(ParseInfo pi) {
+    return filter_start((Filter)pi, ((Filter)pi)->target.start_array, 1);
+}
+
+static void
+filter_end_array(ParseInfo pi) {
+    filter_end((Filter)pi, ((Filter)pi)->target.end_array);
+}
+
+static VALUE
+filter_hash_key(ParseInfo pi, const char *key, size_t klen) {
+    Filter	f = (Filter)pi;
+
+    if (0 < f->skip) {
+	return Qundef;
+    }
+    if (0 == f->full) {
+	member_match(f, f->top, key, klen, 0);
+	if (!f->top->full && 0 == f->top->member) {
+	    return Qundef;
+	}
+    }
+    return f->target.hash_key(pi, key, klen);
+}
+
+static void
+filter_hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *orig) {
+    if (value_wanted((Filter)pi)) {
+	((Filter)pi)->target.hash_set_cstr(pi, kval, str, len, orig);
+    }
+}
+
+static void
+filter_hash_set_num(ParseInfo pi, Val kval, NumInfo ni) {
+    if (value_wanted((Filter)pi)) {
+	((Filter)pi)->target.hash_set_num(pi, kval, ni);
+    }
+}
+
+static void
+filter_hash_set_value(ParseInfo pi, Val kval, VALUE value) {
+    if (value_wanted((Filter)pi)) {
+	((Filter)pi)->target.hash_set_value(pi, kval, value);
+    }
+}
+
+static void
+filter_array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
+    if (value_wanted((Filter)pi)) {
+	((Filter)pi)->target.array_append_cstr(pi, str, len, orig);
+    }
+}
+
+static void
+filter_array_append_num(ParseInfo pi, NumInfo ni) {
+    if (value_wanted((Filter)pi)) {
+	((Filter)pi)->target.array_append_num(pi, ni);
+    }
+}
+
+static void
+filter_array_append_value(ParseInfo pi, VALUE value) {
+    if (value_wanted((Filter)pi)) {
+	((Filter)pi)->target.array_append_value(pi, value);
+    }
+}
+
+static void
+filter_add_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
+    if (value_wanted((Filter)pi)) {
+	((Filter)pi)->target.add_cstr(pi, str, len, orig);
+    }
+}
+
+static void
+filter_add_num(ParseInfo pi, NumInfo ni) {
+    if (value_wanted((Filter)pi)) {
+	((Filter)pi)->target.add_num(pi, ni);
+    }
+}
+
+static void
+filter_add_value(ParseInfo pi, VALUE value) {
+    if (value_wanted((Filter)pi)) {
+	((Filter)pi)->target.add_value(pi, value);
+    }
+}
+
+// Paths are like Oj::Doc paths, '/a/*/2' where '*' matches any member and
+// numbers are 1 based Array indexes. A key without a leading '/' matches
+// members with that key at any depth.
+static void
+set_interests(Filter f, VALUE paths) {
+    volatile VALUE	path;
+    Interest		in;
+    Step		step;
+    const char		*s;
+    const char		*end;
+    long		cnt;
+    long		i;
+    long		scnt = 0;
+
+    if (T_ARRAY != rb_type(paths)) {
+	rb_raise(rb_eTypeError, "interest must return an Array of keys and paths or nil");
+    }
+    cnt = RARRAY_LEN(paths);
+    if (INTEREST_MAX < cnt) {
+	rb_raise(rb_eArgError, "interest can not return more than %d keys and paths", INTEREST_MAX);
+    }
+    f->paths = rb_ary_new2(cnt);
+    for (i = 0; i < cnt; i++) {
+	path = rb_ary_entry(paths, i);
+	switch (rb_type(path)) {
+	case T_STRING:	path = rb_str_new_frozen(path);		break;
+	case T_SYMBOL:	path = rb_str_new_frozen(rb_sym_to_s(path));	break;
+	default:
+	    rb_raise(rb_eTypeError, "interest keys and paths must be Strings or Symbols");
+	}
+	rb_ary_push(f->paths, path);
+	scnt += RSTRING_LEN(path) + 1;
+    }
+    f->steps = ALLOC_N(struct _Step, scnt);
+    step = f->steps;
+    for (i = 0, in = f->interests; i < cnt; i++, in++) {
+	path = rb_ary_entry(f->paths, i);
+	s = RSTRING_PTR(path);
+	end = s + RSTRING_LEN(path);
+	in->steps = step;
+	in->anywhere = (s == end || '/' != *s);
+	if (in->anywhere) {
+	    step->key = s;
+	    step->klen = end - s;
+	    step->index = 0;
+	    step++;
+	    in->cnt = 1;
+	    continue;
+	}
+	for (s++; s < end; step++) {
+	    const char	*k = s;
+
+	    for (; s < end && '/' != *s; s++) {
+	    }
+	    step->key = k;
+	    step->klen = s - k;
+	    step->index = 0;
+	    for (; k < s && '0' <= *k && *k <= '9'; k++) {
+		step->index = step->index * 10 + (*k - '0');
+	    }
+	    if (k < s || 0 == step->klen) {
+		step->index = 0;
+	    }
+	    if (s < end) {
+		s++;
+	    }
+	}
+	in->cnt = (int)(step - in->steps);
+    }
+    f->icnt = (int)cnt;
+}
+
+static VALUE
+filter_run(VALUE fv) {
+    Filter	f = (Filter)fv;
+
+    f->levels = ALLOC_N(struct _Level, LEVEL_INC);
+    f->end = f->levels + LEVEL_INC;
+    f->top = f->levels;
+    memset(f->top, 0, sizeof(struct _Level));
+    f->top->alive = (INTEREST_MAX == f->icnt) ? ~(uint64_t)0 : ((uint64_t)1 << f->icnt) - 1;
+    if (T_STRING == rb_type(f->argv[1])) {
+	return oj_pi_parse(f->argc - 1, f->argv + 1, &f->pi, 0, 0, 1);
+    }
+    return oj_pi_sparse(f->argc - 1, f->argv + 1, &f->pi, 0, 1);
+}
+
+static VALUE
+filter_cleanup(VALUE fv) {
+    Filter	f = (Filter)fv;
+
+    xfree(f->steps);
+    xfree(f->levels);
+
+    return Qnil;
+}
+
+static VALUE
+filter_parse(int argc, VALUE *argv, ParseInfo pi, VALUE paths) {
+    struct _Filter	f;
+
+    f.steps = 0;
+    f.levels = 0;
+    f.skip = 0;
+    f.full = 0;
+    f.closed = 0;
+    f.argc = argc;
+    f.argv = argv;
+    f.paths = Qnil;
+    f.pi = *pi;
+    f.target = *pi;
+    f.pi.start_hash = filter_start_hash;
+    f.pi.end_hash = filter_end_hash;
+    f.pi.hash_key = filter_hash_key;
+    f.pi.hash_set_cstr = filter_hash_set_cstr;
+    f.pi.hash_set_num = filter_hash_set_num;
+    f.pi.hash_set_value = filter_hash_set_value;
+    f.pi.start_array = filter_start_array;
+    f.pi.end_array = filter_end_array;
+    f.pi.array_append_cstr = filter_array_append_cstr;
+    f.pi.array_append_num = filter_array_append_num;
+    f.pi.array_append_value = filter_array_append_value;
+    f.pi.add_cstr = filter_add_cstr;
+    f.pi.add_num = filter_add_num;
+    f.pi.add_value = filter_add_value;
+    set_interests(&f, paths);
+
+    return rb_ensure(filter_run, (VALUE)&f, filter_cleanup, (VALUE)&f);
+}
+
+// Parses the input with the callbacks set on pi, filtered if the handler
+// has an interest.
+static VALUE
+parse_input(int argc, VALUE *argv, ParseInfo pi) {
+    VALUE	paths;
+
+    if (rb_respond_to(*argv, oj_interest_id) && Qnil != (paths = rb_funcall(*argv, oj_interest_id, 0))) {
+	return filter_parse(argc, argv, pi, paths);
+    }
+    if (T_STRING == rb_type(argv[1])) {
+	return oj_pi_parse(argc - 1, argv + 1, pi, 0, 0, 1);
+    }
+    return oj_pi_sparse(argc - 1, argv + 1, pi, 0, 1);
+}
+
+// Batched events are collected by a NativeHandler and passed to the
+// on_events() method of the Ruby handler.
+
+#define BATCH_SIZE	1000
+#define KEY_CACHE_SIZE	64
+#define KEY_CACHE_MAX	32
+
+typedef struct _Batch {
+    struct _NativeHandler	nh;
+    VALUE			handler;
+    volatile VALUE		events;
+    long			size;
+    int				sym_key;
+    // keys repeat so recent ones are kept frozen and passed again
+    VALUE			keys[KEY_CACHE_SIZE];
+} *Batch;
+
+static void
+batch_push(Batch b, VALUE event) {
+    rb_ary_push(b->events, event);
+    if (b->size <= RARRAY_LEN(b->events)) {
+	VALUE	events = b->events;
+
+	// a new Array each time so the handler can keep the one it was given
+	b->events = rb_ary_new2(b->size);
+	rb_funcall(b->handler, oj_on_events_id, 1, events);
+    }
+}
+
+static VALUE
+batch_key(Batch b, const char *key, size_t klen) {
+    volatile VALUE	rkey;
+
+    VALUE		*slot;
+    uint32_t		h = (uint32_t)klen;
+    size_t		i;
+
+    if (0 == key) {
+	return Qnil;
+    }
+    if (KEY_CACHE_MAX < klen) {
+	slot = 0;
+    } else {
+	for (i = 0; i < klen; i++) {
+	    h = h * 31 + (uint8_t)key[i];
+	}
+	slot = b->keys + (h % KEY_CACHE_SIZE);
+	if (Qnil != *slot && (size_t)RSTRING_LEN(*slot) == klen && 0 == memcmp(RSTRING_PTR(*slot), key, klen)) {
+	    return b->sym_key ? rb_str_intern(*slot) : *slot;
+	}
+    }
+    rkey = oj_encode(rb_str_new(key, klen));
+    OBJ_FREEZE(rkey);
+    if (0 != slot) {
+	*slot = rkey;
+    }
+    if (b->sym_key) {
+	return rb_str_intern(rkey);
+    }
+    return rkey;
+}
+
+static void
+batch_event(Batch b, ID event, const char *key, size_t klen) {
+    batch_push(b, rb_ary_new3(2, ID2SYM(event), batch_key(b, key, klen)));
+}
+
+static void
+batch_value(Batch b, VALUE value, const char *key, size_t klen) {
+    volatile VALUE	v = value;
+
+    batch_push(b, rb_ary_new3(3, ID2SYM(oj_add_value_id), v, batch_key(b, key, klen)));
+}
+
+static void
+batch_hash_start(void *ctx, const char *key, size_t klen) {
+    batch_event((Batch)ctx, oj_hash_start_id, key, klen);
+}
+
+static void
+batch_hash_end(void *ctx, const char *key, size_t klen) {
+    batch_event((Batch)ctx, oj_hash_end_id, key, klen);
+}
+
+static void
+batch_array_start(void *ctx, const char *key, size_t klen) {
+    batch_event((Batch)ctx, oj_array_start_id, key, klen);
+}
+
+static void
+batch_array_end(void *ctx, const char *key, size_t klen) {
+    batch_event((Batch)ctx, oj_array_end_id, key, klen);
+}
+
+static void
+batch_add_str(void *ctx, const char *key, size_t klen, const char *str, size_t len) {
+    batch_value((Batch)ctx, oj_encode(rb_str_new(str, len)), key, klen);
+}
+
+static void
+batch_add_num(void *ctx, const char *key, size_t klen, NumInfo ni) {
+    batch_value((Batch)ctx, oj_num_as_value(ni), key, klen);
+}
+
+static void
+batch_add_value(void *ctx, const char *key, size_t klen, VALUE value) {
+    batch_value((Batch)ctx, value, key, klen);
+}
+
+static VALUE
+batch_parse(int argc, VALUE *argv, ParseInfo pi) {
+    struct _Batch	b;
+    volatile VALUE	wrap;
+    VALUE		size = Qnil;
+    int			i;
+
+    if (3 == argc && T_HASH == rb_type(argv[2])) {
+	size = rb_hash_lookup(argv[2], ID2SYM(rb_intern("batch_size")));
+    }
+    memset(&b, 0, sizeof(b));
+    b.nh.magic = OJ_NATIVE_MAGIC;
+    b.nh.version = OJ_NATIVE_VERSION;
+    b.nh.ctx = &b;
+    b.nh.hash_start = batch_hash_start;
+    b.nh.hash_end = batch_hash_end;
+    b.nh.array_start = batch_array_start;
+    b.nh.array_end = batch_array_end;
+    b.nh.add_str = batch_add_str;
+    b.nh.add_num = batch_add_num;
+    b.nh.add_value = batch_add_value;
+    b.handler = pi->handler;
+    b.size = (Qnil == size) ? BATCH_SIZE : NUM2LONG(size);
+    if (1 > b.size) {
+	rb_raise(rb_eArgError, ":batch_size must be greater than zero");
+    }
+    b.events = rb_ary_new2(b.size);
+    for (i = 0; i < KEY_CACHE_SIZE; i++) {
+	b.keys[i] = Qnil;
+    }
+    b.sym_key = (Yes == pi->options.sym_key);
+    wrap = Data_Wrap_Struct(oj_native_handler_class, 0, 0, &b.nh);
+    pi->handler = wrap;
+    set_native_callbacks(pi, &b.nh);
+    parse_input(argc, argv, pi);
+    DATA_PTR(wrap) = 0;
+    if (0 < RARRAY_LEN(b.events)) {
+	rb_funcall(b.handler, oj_on_events_id, 1, b.events);
+    }
+    return Qnil;
+}
+
 VALUE
 oj_sc_parse(int argc, VALUE *argv, VALUE self) {
     struct _ParseInfo	pi;
-    VALUE		input = argv[1];
+    NativeHandler	nh;
 
     pi.options = oj_default_options;
     if (3 == argc) {
@@ -198,48 +913,51 @@ oj_sc_parse(int argc, VALUE *argv, VALUE self) {
     }
     pi.handler = *argv;
 
-    pi.start_hash = rb_respond_to(pi.handler, oj_hash_start_id) ? start_hash : noop_start;
-    pi.end_hash = rb_respond_to(pi.handler, oj_hash_end_id) ? end_hash : noop_end;
-    pi.hash_key = rb_respond_to(pi.handler, oj_hash_key_id) ? hash_key : noop_hash_key;
-    pi.start_array = rb_respond_to(pi.handler, oj_array_start_id) ? start_array : noop_start;
-    pi.end_array = rb_respond_to(pi.handler, oj_array_end_id) ? end_array : noop_end;
-    if (rb_respond_to(pi.handler, oj_hash_set_id)) {
-	pi.hash_set_value = hash_set_value;
-	pi.hash_set_cstr = hash_set_cstr;
-	pi.hash_set_num = hash_set_num;
-	pi.expect_value = 1;
-    } else {
-	pi.hash_set_value = noop_hash_set_value;
-	pi.hash_set_cstr = noop_hash_set_cstr;
-	pi.hash_set_num = noop_hash_set_num;
-	pi.expect_value = 0;
-    }
-    if (rb_respond_to(pi.handler, oj_array_append_id)) {
-	pi.array_append_value = array_append_value;
-	pi.array_append_cstr = array_append_cstr;
-	pi.array_append_num = array_append_num;
-	pi.expect_value = 1;
-    } else {
-	pi.array_append_value = noop_array_append_value;
-	pi.array_append_cstr = noop_array_append_cstr;
-	pi.array_append_num = noop_array_append_num;
-	pi.expect_value = 0;
-    }
-    if (rb_respond_to(pi.handler, oj_add_value_id)) {
-	pi.add_cstr = add_cstr;
-	pi.add_num = add_num;
-	pi.add_value = add_value;
-	pi.expect_value = 1;
-    } else {
-	pi.add_cstr = noop_add_cstr;
-	pi.add_num = noop_add_num;
-	pi.add_value = noop_add_value;
-	pi.expect_value = 0;
+    if (rb_respond_to(pi.handler, oj_on_events_id)) {
+	return batch_parse(argc, argv, &pi);
     }
-
-    if (T_STRING == rb_type(input)) {
-	return oj_pi_parse(argc - 1, argv + 1, &pi, 0, 0, 1);
+    if (0 != (nh = oj_native_handler(pi.handler))) {
+	set_native_callbacks(&pi, nh);
     } else {
-	return oj_pi_sparse(argc - 1, argv + 1, &pi, 0);
+	pi.start_hash = rb_respond_to(pi.handler, oj_hash_start_id) ? start_hash : noop_start;
+	pi.end_hash = rb_respond_to(pi.handler, oj_hash_end_id) ? end_hash : noop_end;
+	pi.hash_key = rb_respond_to(pi.handler, oj_hash_key_id) ? hash_key : noop_hash_key;
+	pi.start_array = rb_respond_to(pi.handler, oj_array_start_id) ? start_array : noop_start;
+	pi.end_array = rb_respond_to(pi.handler, oj_array_end_id) ? end_array : noop_end;
+	if (rb_respond_to(pi.handler, oj_hash_set_id)) {
+	    pi.hash_set_value = hash_set_value;
+	    pi.hash_set_cstr = hash_set_cstr;
+	    pi.hash_set_num = hash_set_num;
+	    pi.expect_value = 1;
+	} else {
+	    pi.hash_set_value = noop_hash_set_value;
+	    pi.hash_set_cstr = noop_hash_set_cstr;
+	    pi.hash_set_num = noop_hash_set_num;
+	    pi.expect_value = 0;
+	}
+	if (rb_respond_to(pi.handler, oj_array_append_id)) {
+	    pi.array_append_value = array_append_value;
+	    pi.array_append_cstr = array_append_cstr;
+	    pi.array_append_num = array_append_num;
+	    pi.expect_value = 1;
+	} else {
+	    pi.array_append_value = noop_array_append_value;
+	    pi.array_append_cstr = noop_array_append_cstr;
+	    pi.array_append_num = noop_array_append_num;
+	    pi.expect_value = 0;
+	}
+	if (rb_respond_to(pi.handler, oj_add_value_id)) {
+	    pi.add_cstr = add_cstr;
+	    pi.add_num = add_num;
+	    pi.add_value = add_value;
+	    pi.expect_value = 1;
+	} else {
+	    pi.add_cstr = noop_add_cstr;
+	    pi.add_num = noop_add_num;
+	    pi.add_value = noop_add_value;
+	    pi.expect_value = 0;
+	}
     }
+
+    return parse_input(argc, argv, &pi);
 }
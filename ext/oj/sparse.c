@@ -736,7 +736,7 @@ protect_parse(VALUE pip) {
 }
 
 VALUE
-oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
+oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd, int yieldOk) {
     volatile VALUE	input;
     volatile VALUE	wrapped_stack;
     VALUE		result = Qnil;
@@ -752,7 +752,7 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     if (Qnil == input && Yes == pi->options.nilnil) {
 	return Qnil;
     }
-    if (rb_block_given_p()) {
+    if (yieldOk && rb_block_given_p()) {
 	pi->proc = Qnil;
     } else {
 	pi->proc = Qundef;
@@ -807,6 +807,7 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
 	oj_circ_array_free(pi->circ_array);
     }
     stack_cleanup(&pi->stack);
+    reader_cleanup(&pi->rd);
     if (0 != fd) {
 	close(fd);
     }
@@ -818,3 +819,187 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     }
     return result;
 }
+
+typedef struct _Step {
+    const char	*key;
+    size_t	klen;
+} *Step;
+
+// The ParseInfo must be first so the callbacks can cast back to an EachInfo.
+typedef struct _EachInfo {
+    struct _ParseInfo	pi;
+    Step		steps;
+    size_t		step_cnt;
+    long		target;	// stack depth of the array being iterated or -1
+    VALUE		(*start_array)(ParseInfo pi);
+    void		(*end_array)(ParseInfo pi);
+    void		(*array_append_cstr)(ParseInfo pi, const char *str, size_t len, const char *orig);
+    void		(*array_append_num)(ParseInfo pi, NumInfo ni);
+    void		(*array_append_value)(ParseInfo pi, VALUE value);
+} *EachInfo;
+
+static int
+each_at_path(EachInfo ei) {
+    ValStack	stack = &ei->pi.stack;
+    Step	step = ei->steps;
+    Val		v;
+
+    if (stack_size(stack) != ei->step_cnt) {
+	return 0;
+    }
+    for (v = stack->head; v < stack->tail; v++, step++) {
+	if (NEXT_HASH_VALUE != v->next || 0 == v->key || step->klen != v->klen ||
+	    0 != strncmp(step->key, v->key, step->klen)) {
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+static VALUE
+each_start_array(ParseInfo pi) {
+    EachInfo	ei = (EachInfo)pi;
+
+    if (0 > ei->target && each_at_path(ei)) {
+	ei->target = (long)stack_size(&pi->stack);
+    }
+    return ei->start_array(pi);
+}
+
+static void
+each_end_array(ParseInfo pi) {
+    EachInfo	ei = (EachInfo)pi;
+
+    // the array has already been popped off the stack
+    if ((long)stack_size(&pi->stack) == ei->target) {
+	ei->target = -1;
+    }
+    ei->end_array(pi);
+}
+
+// Called after an element has been appended with the normal callback. If the
+// parent is the target array the element is taken back off, yielded, and
+// dropped so the array never holds more than one element.
+static void
+each_yield_appended(ParseInfo pi, long len) {
+    VALUE	a = stack_peek(&pi->stack)->val;
+
+    if (T_ARRAY == rb_type(a) && len < RARRAY_LEN(a)) {
+	rb_yield(rb_ary_pop(a));
+    }
+}
+
+static long
+each_target_len(ParseInfo pi) {
+    EachInfo	ei = (EachInfo)pi;
+    Val		parent = stack_peek(&pi->stack);
+
+    if ((long)stack_size(&pi->stack) - 1 == ei->target && T_ARRAY == rb_type(parent->val)) {
+	return RARRAY_LEN(parent->val);
+    }
+    return -1;
+}
+
+static void
+each_array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
+    long	alen = each_target_len(pi);
+
+    ((EachInfo)pi)->array_append_cstr(pi, str, len, orig);
+    if (0 <= alen) {
+	each_yield_appended(pi, alen);
+    }
+}
+
+static void
+each_array_append_num(ParseInfo pi, NumInfo ni) {
+    long	alen = each_target_len(pi);
+
+    ((EachInfo)pi)->array_append_num(pi, ni);
+    if (0 <= alen) {
+	each_yield_appended(pi, alen);
+    }
+}
+
+static void
+each_array_append_value(ParseInfo pi, VALUE value) {
+    long	alen = each_target_len(pi);
+
+    ((EachInfo)pi)->array_append_value(pi, value);
+    if (0 <= alen) {
+	each_yield_appended(pi, alen);
+    }
+}
+
+VALUE
+oj_each_element(int argc, VALUE *argv, VALUE self) {
+    struct _EachInfo	ei;
+    volatile VALUE	rpath = Qnil;
+    size_t		cnt = 0;
+
+    if (1 > argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to each_element.");
+    }
+    RETURN_ENUMERATOR(self, argc, argv);
+    ei.pi.options = oj_default_options;
+    ei.pi.handler = Qnil;
+    if (3 <= argc) {
+	oj_parse_options(argv[2], &ei.pi.options);
+    }
+    if (2 <= argc && Qnil != argv[1]) {
+	Check_Type(argv[1], T_STRING);
+	rpath = argv[1];
+    }
+    ei.steps = 0;
+    if (Qnil != rpath) {
+	const char	*p = StringValuePtr(rpath);
+	const char	*end = p + RSTRING_LEN(rpath);
+	const char	*s;
+
+	for (s = p; s < end; s++) {
+	    if ('/' == *s) {
+		cnt++;
+	    }
+	}
+	ei.steps = ALLOCA_N(struct _Step, cnt + 1);
+	cnt = 0;
+	while (p < end) {
+	    for (s = p; s < end && '/' != *s; s++) {
+	    }
+	    if (s != p) {
+		ei.steps[cnt].key = p;
+		ei.steps[cnt].klen = s - p;
+		cnt++;
+	    }
+	    p = s + 1;
+	}
+    }
+    ei.step_cnt = cnt;
+    ei.target = -1;
+    switch (ei.pi.options.mode) {
+    case StrictMode:
+	oj_set_strict_callbacks(&ei.pi);
+	break;
+    case NullMode:
+    case CompatMode:
+	oj_set_compat_callbacks(&ei.pi);
+	break;
+    case ObjectMode:
+    default:
+	oj_set_object_callbacks(&ei.pi);
+	break;
+    }
+    ei.start_array = ei.pi.start_array;
+    ei.end_array = ei.pi.end_array;
+    ei.array_append_cstr = ei.pi.array_append_cstr;
+    ei.array_append_num = ei.pi.array_append_num;
+    ei.array_append_value = ei.pi.array_append_value;
+    ei.pi.start_array = each_start_array;
+    ei.pi.end_array = each_end_array;
+    ei.pi.array_append_cstr = each_array_append_cstr;
+    ei.pi.array_append_num = each_array_append_num;
+    ei.pi.array_append_value = each_array_append_value;
+
+    oj_pi_sparse(1, argv, &ei.pi, 0, 0);
+
+    return Qnil;
+}
@@ -164,7 +164,7 @@ oj_strict_parse(int argc, VALUE *argv, VALUE self) {
     if (T_STRING == rb_type(*argv)) {
 	return oj_pi_parse(argc, argv, &pi, 0, 0, 1);
     } else {
-	return oj_pi_sparse(argc, argv, &pi, 0);
+	return oj_pi_sparse(argc, argv, &pi, 0, 1);
     }
 }
 
@@ -51,6 +51,8 @@ module Oj
   #    def array_end(); end
   #    def array_append(a, value); end
   #    def add_value(value); end
+  #    def on_events(events); end
+  #    def interest(); end
   #
   # As certain elements of a JSON document are reached during parsing the
   # callbacks are called. The parser helps by keeping track of objects created
@@ -103,6 +105,27 @@ module Oj
   # add_value() callback is called. Even if only one element was ready this
   # callback returns the Ruby object that was constructed during the parsing.
   #
+  #    on_events
+  #
+  # If on_events() is public the other callbacks are not called. Instead the
+  # events are collected and passed to on_events() in Arrays of up to the
+  # :batch_size option events, 1000 by default. Each event is an Array of
+  # either [event, key] for :hash_start, :hash_end, :array_start, and
+  # :array_end or [:add_value, value, key] for values. The key is nil for array
+  # members and for the top level element. Handing over many events in one call
+  # avoids a method call for each value.
+  #
+  #    interest
+  #
+  # If interest() is public it is called once before parsing starts. It can
+  # return nil to get every callback, or an Array of the keys and paths the
+  # handler wants. Paths are like Oj::Doc paths such as '/users/*/name', where
+  # '*' matches any member and a number is a 1 based Array index. A key without
+  # a leading '/' matches members with that key at any depth. The containers on
+  # the way to a match are still passed to the handler, but other members and
+  # everything they contain are skipped without any callbacks. Up to 64 keys
+  # and paths can be given.
+  #
   class ScHandler
     # Create a new instance of the ScHandler class.
     def initialize()
@@ -138,5 +161,11 @@ module Oj
     def array_append(a, value)
     end
 
+    def on_events(events)
+    end
+
+    def interest()
+    end
+
   end # ScHandler
 end # Oj
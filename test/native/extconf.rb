@@ -0,0 +1,5 @@
+require 'mkmf'
+
+# native.h comes from the Oj source, nothing is linked against oj.so
+$CPPFLAGS += " -I#{File.expand_path('../../../ext/oj', __FILE__)}"
+create_makefile('oj_test_native')
@@ -0,0 +1,158 @@
+/* oj_test_native.c
+ * Copyright (c) 2011, Peter Ohler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of Peter Ohler nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A NativeHandler for the tests. Events are appended to an Array in the same
+// form as the Ruby handler calls recorded by the tests.
+
+#include <math.h>
+#include <string.h>
+
+#include "ruby.h"
+#include "ruby/encoding.h"
+#include "native.h"
+
+typedef struct _Recorder {
+    struct _NativeHandler	nh; // first so the handler is the Recorder
+    VALUE			events;
+} *Recorder;
+
+static VALUE
+rec_key(const char *key, size_t klen) {
+    if (0 == key) {
+	return Qnil;
+    }
+    return rb_enc_str_new(key, klen, rb_utf8_encoding());
+}
+
+static void
+rec_event(void *ctx, const char *event, const char *key, size_t klen) {
+    Recorder	r = (Recorder)ctx;
+
+    rb_ary_push(r->events, rb_ary_new3(2, ID2SYM(rb_intern(event)), rec_key(key, klen)));
+}
+
+static void
+rec_value(void *ctx, VALUE value, const char *key, size_t klen) {
+    Recorder		r = (Recorder)ctx;
+    volatile VALUE	v = value;
+
+    rb_ary_push(r->events, rb_ary_new3(3, ID2SYM(rb_intern("add_value")), v, rec_key(key, klen)));
+}
+
+static void
+rec_hash_start(void *ctx, const char *key, size_t klen) {
+    rec_event(ctx, "hash_start", key, klen);
+}
+
+static void
+rec_hash_end(void *ctx, const char *key, size_t klen) {
+    rec_event(ctx, "hash_end", key, klen);
+}
+
+static void
+rec_array_start(void *ctx, const char *key, size_t klen) {
+    rec_event(ctx, "array_start", key, klen);
+}
+
+static void
+rec_array_end(void *ctx, const char *key, size_t klen) {
+    rec_event(ctx, "array_end", key, klen);
+}
+
+static void
+rec_add_str(void *ctx, const char *key, size_t klen, const char *str, size_t len) {
+    rec_value(ctx, rb_enc_str_new(str, len, rb_utf8_encoding()), key, klen);
+}
+
+// Converts from the text so the values do not depend on how Oj splits the
+// number up.
+static void
+rec_add_num(void *ctx, const char *key, size_t klen, NumInfo ni) {
+    volatile VALUE	text = rb_str_new(ni->str, ni->len);
+    VALUE		num;
+
+    if (ni->infinity) {
+	num = rb_float_new(ni->neg ? -HUGE_VAL : HUGE_VAL);
+    } else if (ni->nan) {
+	num = rb_float_new(nan(""));
+    } else if (1 != ni->div || ni->hasExp) {
+	num = rb_float_new(rb_cstr_to_dbl(StringValueCStr(text), 0));
+    } else {
+	num = rb_cstr_to_inum(StringValueCStr(text), 10, 0);
+    }
+    rec_value(ctx, num, key, klen);
+}
+
+static void
+rec_add_value(void *ctx, const char *key, size_t klen, VALUE value) {
+    rec_value(ctx, value, key, klen);
+}
+
+static void
+rec_mark(void *ptr) {
+    rb_gc_mark(((Recorder)ptr)->events);
+}
+
+/* call-seq: handler(events, ends=true) => Oj::NativeHandler
+ *
+ * Returns a handler that appends each event to the events Array. Container
+ * ends are left out, and not asked for, if ends is false.
+ */
+static VALUE
+rec_handler(int argc, VALUE *argv, VALUE self) {
+    Recorder	r;
+
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "wrong number of arguments (%d for 1..2)", argc);
+    }
+    Check_Type(*argv, T_ARRAY);
+    r = ALLOC(struct _Recorder);
+    memset(r, 0, sizeof(struct _Recorder));
+    r->events = *argv;
+    r->nh.ctx = r;
+    r->nh.hash_start = rec_hash_start;
+    r->nh.array_start = rec_array_start;
+    if (1 == argc || RTEST(argv[1])) {
+	r->nh.hash_end = rec_hash_end;
+	r->nh.array_end = rec_array_end;
+    }
+    r->nh.add_str = rec_add_str;
+    r->nh.add_num = rec_add_num;
+    r->nh.add_value = rec_add_value;
+
+    return oj_native_handler_new(&r->nh, rec_mark, xfree);
+}
+
+void
+Init_oj_test_native() {
+    VALUE	m = rb_define_module("OjTestNative");
+
+    rb_define_module_function(m, "handler", rec_handler, -1);
+}
@@ -259,6 +259,208 @@ class DocTest < Minitest::Test
     end
   end
 
+  def test_fetch_compiled_path
+    Oj::Doc.open($json1) do |doc|
+      [['/array/1/num', 3],
+       ['/array/1/hash/h2/a/2', 2],
+       ['/array/1/hash/../string', 'message'],
+       ['/boolean', true],
+       ['/array/2', nil],
+       ['/missing', nil],
+      ].each do |path,val|
+        p = Oj::Doc::Path.new(path)
+        assert_equal(path, p.to_s)
+        assert_equal(val, doc.fetch(p))
+        assert_equal(val, doc.fetch(p)) # a Path is reusable
+      end
+      doc.move(Oj::Doc::Path.new('/array/1'))
+      assert_equal('/array/1', doc.where?)
+      assert_equal(Fixnum, doc.type(Oj::Doc::Path.new('num')))
+      locations = []
+      doc.each_child(Oj::Doc::Path.new('/array/1/hash/h2/a')) { |d| locations << d.where? }
+      assert_equal(['/array/1/hash/h2/a/1', '/array/1/hash/h2/a/2', '/array/1/hash/h2/a/3'], locations)
+    end
+  end
+
+  def test_fetch_large_containers
+    a = (1..1000).to_a
+    h = {}
+    1000.times { |i| h["k#{i}"] = i }
+    json = Oj.dump({ 'a' => a, 'h' => h, 'd' => [1] * 20 }, :mode => :strict)
+    # duplicate key, the first one wins as with a linear search
+    json = json.sub('"k0":0', '"k0":0,"k0":-1')
+    Oj::Doc.open(json) do |doc|
+      assert_equal(1, doc.fetch('/a/1'))
+      assert_equal(500, doc.fetch('/a/500'))
+      assert_equal(1000, doc.fetch('/a/1000'))
+      assert_nil(doc.fetch('/a/1001'))
+      assert_equal(0, doc.fetch('/h/k0'))
+      assert_equal(999, doc.fetch('/h/k999'))
+      assert_nil(doc.fetch('/h/k1000'))
+      doc.move('/h/k10')
+      assert_equal('/h/k10', doc.where?)
+      assert_equal(1, doc.fetch('/d/20'))
+    end
+  end
+
+  def test_fetch_many
+    json = %{{"a":{"b":{"c":1,"d":[2,3]},"e":true},"f":"x"}}
+    Oj::Doc.open(json) do |doc|
+      paths = ['/a/b/c', '/a/b/d/1', '/a/b/d/2', '/a/e', '/a/b/../e', '/f', '/a/x/y', 'a/b/c']
+      assert_equal([1, 2, 3, true, true, 'x', nil, 1], doc.fetch_many(paths))
+      assert_equal([1, 0], doc.fetch_many([Oj::Doc::Path.new('/a/b/c'), '/z'], 0))
+      doc.move('/a/b')
+      assert_equal([[2, 3], 3, true], doc.fetch_many(['d', 'd/2', '../e']))
+      assert_equal({ 'c' => 1, :e => true, :z => nil },
+                   doc.fetch_hash('c' => 'c', :e => '/a/e', :z => 'z'))
+      assert_equal({ :z => false }, doc.fetch_hash({ :z => 'z' }, false))
+    end
+  end
+
+  def test_memoize
+    json = %{{"config":{"a":[1,"two"],"b":"x"}}}
+    Oj::Doc.open(json, :memoize => true) do |doc|
+      config = doc.fetch('/config')
+      assert(config.frozen?)
+      assert(config['a'].frozen?)
+      assert(config['b'].frozen?)
+      assert_equal({ 'a' => [1, 'two'], 'b' => 'x' }, config)
+      assert_same(config, doc.fetch('/config'))
+      assert_same(config['a'], doc.fetch('/config/a'))
+      GC.start
+      assert_equal([1, 'two'], doc.fetch('/config/a'))
+    end
+    Oj::Doc.open(json) do |doc|
+      config = doc.fetch('/config')
+      assert(!config.frozen?)
+      assert(!config.equal?(doc.fetch('/config')))
+    end
+  end
+
+  def test_query
+    json = %{{
+  "store":{
+    "items":[
+      {"id":1,"price":5,"tag":"a","info":{"w":1}},
+      {"id":2,"price":12.5,"tag":"b"},
+      {"id":3,"price":20,"tag":"a/b","info":{"w":3}}
+    ],
+    "name":"x"
+  },
+  "prices":[3,9,27]
+}}
+    Oj::Doc.open(json) do |doc|
+      assert_equal([1, 2, 3], doc.query('/store/items/*/id'))
+      assert_equal([2, 3], doc.query('/store/items/[?price > 10]/id'))
+      assert_equal([1], doc.query('/store/items/[?price <= 5]/id'))
+      assert_equal([3], doc.query("/store/items/[?tag == 'a/b']/id"))
+      assert_equal([2, 3], doc.query('/store/items/[?tag != "a"]/id'))
+      assert_equal([1, 3], doc.query('/store/items/[?info]/id'))
+      assert_equal([3], doc.query('/store/items/[?info/w >= 2]/id'))
+      assert_equal([9, 27], doc.query('/prices/[?@ > 5]'))
+      assert_equal([9, 27], doc.query('/prices/[2:]'))
+      assert_equal([3, 9], doc.query('/prices/[:-2]'))
+      assert_equal([27], doc.query('/prices/[-1]'))
+      assert_equal([1, 2, 3], doc.query('**/id'))
+      assert_equal([1, 3], doc.query('/**/info/w'))
+      assert_equal(['x'], doc.query('/store/items/1/../../name'))
+      assert_equal([], doc.query('/store/missing/*'))
+      ids = []
+      assert_nil(doc.query('/store/items/*/id') { |id| ids << id })
+      assert_equal([1, 2, 3], ids)
+      doc.move('/store/items')
+      assert_equal([5, 12.5, 20], doc.query('*/price'))
+      assert_raises(ArgumentError) { doc.query('/store/items/[?price >]') }
+      assert_raises(ArgumentError) { doc.query('/store/items/[1') }
+    end
+  end
+
+  def test_edit
+    json = %{{"a":[1,2,3],"b":{"c":"x","d":null},"e":"secret"}}
+    Oj::Doc.open(json) do |doc|
+      assert_equal('y', doc.set('/b/c', 'y'))
+      doc.set('/e', nil)
+      doc.set('/b/f', { 'g' => [true, 1.5], :h => :sym })
+      doc.set('/a/4', 4)
+      assert_equal(%{{"a":[1,2,3,4],"b":{"c":"y","d":null,"f":{"g":[true,1.5],"h":"sym"}},"e":null}}, doc.dump)
+      assert_equal(1.5, doc.fetch('/b/f/g/2'))
+      assert_equal(2, doc.delete('/a/2'))
+      assert_equal(3, doc.fetch('/a/2'))
+      assert_nil(doc.delete('/b/missing'))
+      doc.insert('/a/1', 0)
+      doc.insert('/a/3', 'x')
+      doc.insert('/a/6', 5)
+      assert_equal([0, 1, 'x', 3, 4, 5], doc.fetch('/a'))
+      assert_equal('x', doc.fetch('/a/3'))
+      doc.move('/b/f/g')
+      doc.delete('/b/f')
+      assert_equal('/b', doc.where?)
+      assert_equal(%{{"a":[0,1,"x",3,4,5],"b":{"c":"y","d":null},"e":null}}, doc.dump('/'))
+      assert_equal(12, doc.size)
+      assert_raises(ArgumentError) { doc.set('/x/y', 1) }
+      assert_raises(ArgumentError) { doc.set('/a/9', 1) }
+      assert_raises(TypeError) { doc.set('/a/1', Object.new) }
+      GC.start
+      assert_equal('y', doc.fetch('/b/c'))
+      # overwriting a leaf releases the value it held
+      100.times { |i| doc.set('/b/c', "v#{i}") }
+      doc.set('/b', { 'c' => 'z' })
+      GC.start
+      assert_equal('z', doc.fetch('/b/c'))
+      assert_equal('x', doc.fetch('/a/3'))
+    end
+    # a large container is indexed so edits must keep the index current
+    Oj::Doc.open(Oj.dump((1..100).to_a), :memoize => true) do |doc|
+      assert_equal(50, doc.fetch('/50'))
+      assert_equal(100, doc.fetch.size)
+      doc.delete('/1')
+      assert_equal(51, doc.fetch('/50'))
+      assert_equal(99, doc.fetch.size)
+      doc.set('/99', [1, 2])
+      assert_equal([1, 2], doc.fetch('/99'))
+      doc.set('/99/3', 3)
+      assert_equal([1, 2, 3], doc.fetch.last)
+    end
+  end
+
+  def test_aggregates
+    json = %{{"orders":[{"total":3},{"total":4.5},{"total":-2},{"total":"x"},{"id":1}]}}
+    Oj::Doc.open(json) do |doc|
+      assert_equal(5.5, doc.sum('/orders/*/total'))
+      assert_equal(4, doc.count('/orders/*/total'))
+      assert_equal(-2, doc.min('/orders/*/total'))
+      assert_equal(4.5, doc.max('/orders/*/total'))
+      assert_equal(5.5 / 3, doc.avg('/orders/*/total'))
+      assert_equal(7.5, doc.sum('/orders/[1:2]/total'))
+      assert_equal(-2, doc.sum('/orders/[?total < 0]/total'))
+      assert_equal(0, doc.sum('/missing/*'))
+      assert_nil(doc.min('/missing/*'))
+      assert_nil(doc.avg('/orders/*/none'))
+    end
+    Oj::Doc.open('[9223372036854775807,1,100000000000000000000,-1]') do |doc|
+      assert_equal(9223372036854775807 + 100000000000000000000, doc.sum('/*'))
+      assert_equal(100000000000000000000, doc.max('/*'))
+      assert_kind_of(Integer, doc.sum('/[1:2]'))
+    end
+  end
+
+  def test_reuse_after_close
+    small = '{"a":[1,2,3],"b":{"c":true}}'
+    big = Oj.dump((1..2000).map { |i| { 'i' => i } }, :mode => :strict)
+    20.times do |n|
+      doc = Oj::Doc.open(n.even? ? big : small)
+      if n.even?
+        assert_equal(4001, doc.size)
+        assert_equal(n + 1, doc.fetch("/#{n + 1}/i"))
+      else
+        assert_equal(7, doc.size)
+        assert_equal([1, 2, 3], doc.fetch('/a'))
+        assert_equal(true, doc.fetch('/b/c'))
+      end
+      doc.close
+    end
+  end
+
   def test_move_fetch_path
     Oj::Doc.open($json1) do |doc|
       [['/array/1', 'num', 3],
@@ -345,6 +547,108 @@ class DocTest < Minitest::Test
     end
   end
 
+  def test_open_large_file
+    filename = File.join(File.dirname(__FILE__), 'open_large_file_test.json')
+    a = (1..10000).map { |i| "line\n#{i}" }
+    json = Oj.dump(a, :mode => :strict)
+    File.open(filename, 'w') { |f| f.write(json) }
+    Oj::Doc.open_file(filename, :mmap => true) do |doc|
+      assert_equal(10001, doc.size)
+      assert_equal("line\n10000", doc.fetch('/10000'))
+    end
+    doc = Oj::Doc.open_file(filename, :mmap => true)
+    assert_equal("line\n1", doc.fetch('/1'))
+    doc.close
+    # strings are unescaped in place but that must not reach the file
+    assert_equal(json, File.read(filename))
+    # without :mmap the file can change while the Doc is open
+    doc = Oj::Doc.open_file(filename)
+    File.open(filename, 'w') { |f| f.write('[]') }
+    assert_equal("line\n9000", doc.fetch('/9000'))
+    doc.close
+    # :tape reads strings when they are used so the file is not mapped
+    File.open(filename, 'w') { |f| f.write(json) }
+    doc = Oj::Doc.open_file(filename, :mmap => true, :tape => true)
+    File.open(filename, 'w') { |f| f.write('[]') }
+    assert_equal("line\n9000", doc.fetch('/9000'))
+    doc.close
+  ensure
+    File.delete(filename) if File.exist?(filename)
+  end
+
+  def test_save_index
+    filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
+    index = File.join(File.dirname(__FILE__), 'open_file_test.idx')
+    File.open(filename, 'w') { |f| f.write(%{{"a":[1,2.5,"x\\ny"],"b":{"c":null,"d":true},"e":12345678901234567890}}) }
+    expect = Oj::Doc.open_file(filename) do |doc|
+      # fetch first so some leaves hold Ruby values when saved
+      assert_equal(2.5, doc.fetch('/a/2'))
+      doc.save_index(index)
+      doc.fetch
+    end
+    Oj::Doc.open_file(filename, :index => index) do |doc|
+      assert_equal(9, doc.size)
+      assert_equal(expect, doc.fetch)
+      assert_equal("x\ny", doc.fetch('/a/3'))
+      assert_equal(true, doc.fetch('/b/d'))
+      # an index of an index is the same document
+      doc.save_index(index)
+    end
+    doc = Oj::Doc.open_file(filename, :index => index)
+    assert_equal(expect, doc.fetch)
+    doc.close
+    # a changed file is parsed instead of loaded from the stale index
+    File.open(filename, 'w') { |f| f.write('[true]') }
+    Oj::Doc.open_file(filename, :index => index) do |doc|
+      assert_equal([true], doc.fetch)
+    end
+    # same size and modification time, caught by :verify
+    File.open(filename, 'w') { |f| f.write(%{{"a":"xy","b":[1,2]}}) }
+    Oj::Doc.open_file(filename, :index => index) { |doc| doc.save_index(index) }
+    mtime = File.mtime(filename)
+    File.open(filename, 'w') { |f| f.write(%{["abcdefgh",1,2,3]  }) }
+    File.utime(mtime, mtime, filename)
+    Oj::Doc.open_file(filename, :index => index, :verify => true) do |doc|
+      assert_equal(["abcdefgh", 1, 2, 3], doc.fetch)
+    end
+    # a malformed index is ignored and leaves no file open
+    json = %{{"a":[1,2,3],"b":"text"}}
+    File.open(filename, 'w') { |f| f.write(json) }
+    Oj::Doc.open_file(filename) { |doc| doc.save_index(index) }
+    good = File.binread(index)
+    cnt, tlen = good[48, 16].unpack('Q2')
+    k = tlen / 16 + 1
+    # the text length wraps around so the total looks right
+    crafted = good.dup
+    crafted[48, 16] = [cnt + k, (tlen - 16 * k) % 2**64].pack('Q2')
+    fds = Dir.entries('/proc/self/fd').size if File.directory?('/proc/self/fd')
+    [crafted, good[0...-1], good[0, 20]].each do |bad|
+      File.binwrite(index, bad)
+      5.times do
+        assert_equal(Oj.load(json), Oj::Doc.open_file(filename, :index => index) { |doc| doc.fetch })
+      end
+    end
+    assert_equal(fds, Dir.entries('/proc/self/fd').size) unless fds.nil?
+    assert_raises(ArgumentError) { Oj::Doc.open('[1]') { |doc| doc.save_index(index) } }
+    # an edited document would index values that are not in the file
+    File.open(filename, 'w') { |f| f.write(%{{"a":1,"b":[1,2,3]}}) }
+    Oj::Doc.open_file(filename) { |doc| doc.save_index(index) }
+    Oj::Doc.open_file(filename) do |doc|
+      doc.set('/a', 99)
+      doc.delete('/b/1')
+      assert_raises(ArgumentError) { doc.save_index(index) }
+    end
+    Oj::Doc.open_file(filename) do |doc|
+      doc.insert('/b/1', 0)
+      assert_raises(ArgumentError) { doc.save_index(index) }
+    end
+    Oj::Doc.open_file(filename, :index => index) do |doc|
+      assert_equal({'a' => 1, 'b' => [1, 2, 3]}, doc.fetch)
+    end
+  ensure
+    File.delete(index) if File.exist?(index)
+  end
+
   def test_open_close
     json = %{{"a":[1,2,3]}}
     doc = Oj::Doc.open(json)
@@ -363,6 +667,13 @@ class DocTest < Minitest::Test
     end
   end
 
+  def test_parse
+    doc = Oj::Doc.parse('[1,2]')
+    assert_equal(2, doc.fetch('/2'))
+    doc.close
+    assert_equal([1, 2], Oj::Doc.parse('[1,2]', :memoize => true) { |d| d.fetch })
+  end
+
   def test_file_open_close
     filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
     File.open(filename, 'w') { |f| f.write('{"a":[1,2,3]}') }
@@ -406,6 +717,199 @@ class DocTest < Minitest::Test
     end
   end
 
+  def test_dump_unchanged
+    items = (1..40).map { |i| %{{"id":#{i},"price":1.50,"tags":["a","b"]}} }
+    json = %{{"items":[#{items.join(',')}],"n":1}}
+    Oj::Doc.open(json) do |doc|
+      # the fetch converts the price but the text is still copied as is
+      assert_equal(1.5, doc.fetch('/items/1/price'))
+      assert_equal(json, doc.dump())
+      assert_equal("[#{items.join(',')}]", doc.dump('/items'))
+      doc.set('/items/1/price', 2)
+      assert_equal(%{{"id":1,"price":2,"tags":["a","b"]}}, doc.dump('/items/1'))
+      assert_equal('{"items":[{"id":1,"price":2,"tags"', doc.dump()[0, 34])
+    end
+    Oj::Doc.open(json.gsub(',', ', ')) do |doc|
+      assert_equal(json, doc.dump())
+    end
+  end
+
+  def test_open_frozen
+    json = %{{"a\\tb":"x\\u00e9y","ab":[12345678901234567890,-1.25e2,"plain"],"c":{"d":null}}}
+    expect = Oj::Doc.open(json.dup) { |doc| [doc.fetch, doc.dump] }
+    bytes = json.bytes
+    Oj::Doc.open(json.freeze) do |doc|
+      assert_equal(expect, [doc.fetch, doc.dump])
+      assert_equal("x\u00e9y", doc.fetch("/a\tb"))
+      assert_equal(12345678901234567890, doc.fetch('/ab/1'))
+      assert_equal(-125.0, doc.fetch('/ab/2'))
+      # keys are not terminated in the text so a longer key must not match
+      assert_nil(doc.fetch('/ab":[1'))
+      doc.move('/c/d')
+      assert_equal('/c/d', doc.where?)
+      assert_equal('d', doc.local_key)
+    end
+    # the text is shared with the frozen String so it must not be written to
+    assert_equal(bytes, json.bytes)
+  end
+
+  def test_cursor
+    json = %{{"a":[1,2,{"x":3}],"b":{"c":"d"}}}
+    Oj::Doc.open(json) do |doc|
+      doc.move('/b')
+      c1 = doc.cursor
+      c2 = doc.cursor('/a/3')
+      assert_equal('/b', c1.where?)
+      assert_equal('/a/3', c2.where?)
+      c1.move('c')
+      assert_equal('d', c1.fetch)
+      assert_equal('c', c1.local_key)
+      assert_equal(3, c2.fetch('x'))
+      assert_equal('/b', doc.where?)
+      keys = []
+      c2.home
+      c2.each_child('/a') { |c| keys << [c.where?, c.type] }
+      assert_equal([['/a/1', Fixnum], ['/a/2', Fixnum], ['/a/3', Hash]], keys)
+      assert_equal('/', c2.where?)
+      assert_equal('{"x":3}', c2.cursor('/a/3').dump)
+      assert_equal(doc, c2.doc)
+    end
+  end
+
+  def test_tape
+    rows = (1..40).map { |i| %{{"id":#{i},"name":"n#{i}","tags":["a","b"]}} }
+    json = %{{"rows":[#{rows.join(',')}],"meta":{"note":"x\\ty","n":[1,[2,[3]]]}, "e":[]}}
+    expect = Oj::Doc.open(json) { |doc| [doc.fetch, doc.dump, doc.size] }
+    Oj::Doc.open(json, :tape => true) do |doc|
+      assert_equal(expect[2], doc.size)
+      assert_equal('n7', doc.fetch('/rows/7/name'))
+      assert_equal("x\ty", doc.fetch('/meta/note'))
+      assert_equal(3, doc.fetch('/meta/n/2/2/1'))
+      assert_equal([], doc.fetch('/e'))
+      assert_equal(expect[1], doc.dump)
+      assert_equal(expect[0], doc.fetch)
+      doc.move('/rows/40/tags/2')
+      assert_equal('/rows/40/tags/2', doc.where?)
+      keys = []
+      doc.each_child('/meta') { |d| keys << d.local_key }
+      assert_equal(['note', 'n'], keys)
+      assert_equal('n3', doc.cursor('/rows/3').fetch('name'))
+      doc.set('/rows/2/name', 'two')
+      doc.delete('/rows/1')
+      assert_equal(expect[2] - 6, doc.size)
+      assert_equal('two', doc.fetch('/rows/1/name'))
+      assert_equal(%{{"id":3,"name":"n3","tags":["a","b"]}}, doc.dump('/rows/2'))
+    end
+    Oj::Doc.open(json.dup.freeze, :tape => true) do |doc|
+      assert_equal(expect[1], doc.dump)
+    end
+    assert_raises(Oj::ParseError) { Oj::Doc.open('{"a":[1,{"b":]}', :tape => true) }
+  end
+
+  def test_store
+    filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
+    members = (1..20).map { |i| %{"k#{i}":[#{i},#{i}.5,"v#{i}"]} }
+    json = %{{#{members.join(',')},"list":[#{(1..30).to_a.join(',')}],"e":"x\\u00e9\\ny","z":[null,true,false,{}],"big":12345678901234567890}}
+    File.open(filename, 'w') { |f| f.write(json) }
+    expect = Oj::Doc.open(json) { |doc| doc.fetch }
+    store = Oj::Store.load(filename)
+    assert_equal(expect, store.fetch)
+    assert_equal(Oj::Doc.open(json) { |doc| doc.size }, store.size)
+    assert_equal('v17', store.fetch('/k17/3'))
+    assert_equal(3.5, store.fetch('/k3/2'))
+    assert_equal(25, store.fetch('/list/25'))
+    assert_equal("x\u00e9\ny", store.fetch('/e'))
+    assert_equal(12345678901234567890, store.fetch('/big'))
+    assert_equal(2, store.fetch('/k2/3/../1'))
+    assert_nil(store.fetch('/list/31'))
+    assert_equal(:none, store.fetch('/k21', :none))
+    assert_equal(true, store.exists?('/z/4'))
+    assert_equal(false, store.exists?('/k'))
+    assert_equal(Hash, store.type('/z/4'))
+    assert_equal(Float, store.type('/k1/2'))
+    pairs = []
+    store.each('/z') { |i, v| pairs << [i, v] }
+    assert_equal([[1, nil], [2, true], [3, false], [4, {}]], pairs)
+    if Process.respond_to?(:fork)
+      pid = Process.fork { exit!('v9' == store.fetch('/k9/3') ? 0 : 1) }
+      Process.wait(pid)
+      assert_equal(0, $?.exitstatus)
+    end
+    store.close
+    assert_raises(IOError) { store.fetch }
+    assert_equal([1, {'a' => 'b'}], Oj::Store.parse('[1,{"a":"b"}]').fetch)
+  end
+
+  def test_open_io
+    rows = (1..2000).map { |i| %{{"id":#{i}, "s":"a,[b]{c}:\\"q\\\\#{i}", /* c{,} */ "n":[#{i}.5,-#{i}e2,true,null] // x,]\n}} }
+    json = %{ [#{rows.join(",\n")}, "#{'z' * 100_000}"] }
+    expect = Oj::Doc.open(json) { |doc| [doc.fetch, doc.size] }
+    [1, 7, 4096].each do |n|
+      # hands out a few bytes at a time so values are split across reads
+      pos = 0
+      io = Object.new
+      io.define_singleton_method(:readpartial) do |max|
+        raise EOFError if json.size <= pos
+        pos += n
+        json[pos - n, n]
+      end
+      assert_equal(expect, Oj::Doc.open_io(io) { |doc| [doc.fetch, doc.size] })
+    end
+    doc = Oj::Doc.open_io(StringIO.new(json))
+    assert_equal(%{a,[b]{c}:"q\\2}, doc.fetch('/2/s'))
+    assert_equal(3.5, doc.fetch('/3/n/1'))
+    doc.close
+    assert_raises(Oj::ParseError) { Oj::Doc.open_io(StringIO.new('{"a":[1,2}')) }
+  end
+
+  def test_same_json
+    assert(Oj.same_json?(%{{"a":1,"b":[2.0,"x",null],"c":{}}}, %{ { "c" : {}, "b" : [2, "x", null], "a" : 1.0 } }))
+    assert(Oj.same_json?('[0.5,-12e1,100]', '[5e-1,-120,1E2]'))
+    assert(Oj.same_json?('"a\\u0062c"', '"abc"'))
+    assert(!Oj.same_json?('{"a":1,"b":2}', '{"a":1}'))
+    assert(!Oj.same_json?('{"a":1}', '{"a":1,"b":2}'))
+    assert(!Oj.same_json?('[1,2]', '[2,1]'))
+    assert(!Oj.same_json?('[1]', '{"1":1}'))
+    assert(!Oj.same_json?('"1"', '1'))
+    assert(!Oj.same_json?('null', 'false'))
+    assert_raises(Oj::ParseError) { Oj.same_json?('[1]', '[1') }
+  end
+
+  def test_diff
+    Oj::Doc.open(%{{"a":1,"b":[1,2,3],"c":{"d":true},"e/~":"x"}}) do |doc|
+      assert_equal([], doc.diff(%{{"e/~":"x","c":{"d":true},"b":[1,2.0,3],"a":1.0}}))
+      assert_equal([{'op' => 'replace', 'path' => '/a', 'value' => 2},
+                    {'op' => 'remove', 'path' => '/b/2'},
+                    {'op' => 'remove', 'path' => '/b/1'},
+                    {'op' => 'add', 'path' => '/c/f', 'value' => [1]},
+                    {'op' => 'remove', 'path' => '/e~1~0'},
+                    {'op' => 'add', 'path' => '/g', 'value' => nil}],
+                   doc.diff(%{{"a":2,"b":[1],"c":{"d":true,"f":[1]},"g":null}}))
+      Oj::Doc.open('[{"a":1},2]') do |other|
+        assert_equal([{'op' => 'replace', 'path' => '', 'value' => [{'a' => 1}, 2]}], doc.diff(other))
+      end
+    end
+    Oj::Doc.open('[1]') do |doc|
+      assert_equal([{'op' => 'add', 'path' => '/1', 'value' => {'x' => 'y'}}], doc.diff('[1,{"x":"y"}]'))
+    end
+  end
+
+  def test_cursor_threads
+    json = Oj.dump((1..200).map { |i| { 'id' => i, 'tags' => ['t'] * (i % 5) } }, :mode => :strict)
+    Oj::Doc.open(json) do |doc|
+      threads = (1..4).map {
+        Thread.new(doc.cursor) { |c|
+          sum = 0
+          10.times { c.each_child('/') { |e| sum += e.fetch('id') + e.fetch('tags').size } }
+          sum
+        }
+      }
+      assert_equal([10 * (20100 + 400)] * 4, threads.map(&:value))
+    end
+    c = Oj::Doc.open(json) { |doc| doc.cursor }
+    assert_raises(IOError) { c.fetch }
+  end
+
   def test_each_leaf
     results = Oj::Doc.open('[1,[2,3]]') do |doc|
       h = {}
@@ -220,6 +220,48 @@ class FileJuice < Minitest::Test
     dump_and_load(DateTime.new(2012, 6, 19), false)
   end
 
+  def test_gzip_load_file
+    require 'zlib'
+    filename = File.join(File.dirname(__FILE__), 'file_test.json.gz')
+    obj = { 'a' => [1, 2.5, 'three' * 5000], 'b' => { 'c' => nil, 'd' => true } }
+    Zlib::GzipWriter.open(filename) { |gz| gz.write(Oj.dump(obj, :mode => :strict)) }
+    assert_equal(obj, Oj.load_file(filename, :mode => :strict))
+    File.open(filename) { |f| assert_equal(obj, Oj.load(f, :mode => :strict)) }
+  end
+
+  def test_deflate_io
+    require 'zlib'
+    obj = [1, 'two', { 'three' => [3] }]
+    r, w = IO.pipe
+    w.write(Zlib::Deflate.deflate(Oj.dump(obj, :mode => :strict)))
+    w.close
+    assert_equal(obj, Oj.load(r, :mode => :strict))
+    r.close
+  end
+
+  # Reads one byte at a time so the first read is shorter than a header.
+  class ByteReader
+    def initialize(str)
+      @io = StringIO.new(str)
+    end
+
+    def readpartial(size)
+      @io.read(1) || raise(EOFError)
+    end
+  end
+
+  def test_gzip_short_reads
+    require 'zlib'
+    obj = [1, 'two', { 'three' => [3] }]
+    io = StringIO.new
+    gz = Zlib::GzipWriter.new(io)
+    gz.write(Oj.dump(obj, :mode => :strict))
+    gz.close
+    assert_equal(obj, Oj.load(ByteReader.new(io.string), :mode => :strict))
+    assert_equal(obj, Oj.load(ByteReader.new(Oj.dump(obj, :mode => :strict)), :mode => :strict))
+    assert_equal(7, Oj.load(ByteReader.new('7'), :mode => :strict))
+  end
+
   def dump_and_load(obj, trace=false)
     filename = File.join(File.dirname(__FILE__), 'file_test.json')
     File.open(filename, "w") { |f|
@@ -4,6 +4,9 @@
 $: << File.dirname(__FILE__)
 
 require 'helper'
+require 'rbconfig'
+require 'tmpdir'
+require 'fileutils'
 
 $json = %{{
   "array": [
@@ -53,6 +56,36 @@ class AllSaj < Oj::Saj
 
 end # AllSaj
 
+# Reads a few characters at a time.
+class Trickle
+  def initialize(str, n)
+    @io = StringIO.new(str)
+    @n = n
+  end
+
+  def readpartial(max)
+    s = @io.read([max, @n].min)
+    raise EOFError if s.nil?
+    s
+  end
+end # Trickle
+
+# Builds and loads the NativeHandler test extension in test/native once.
+# Returns false if it can not be built, as when there is no compiler.
+module NativeExt
+  def self.build
+    return @built if defined?(@built)
+    dir = Dir.mktmpdir('oj_test_native')
+    at_exit { FileUtils.rm_rf(dir) }
+    extconf = File.expand_path('../native/extconf.rb', __FILE__)
+    @built = Dir.chdir(dir) {
+      system("#{RbConfig.ruby} #{extconf} > /dev/null 2>&1 && make > /dev/null 2>&1")
+    } && require(File.join(dir, 'oj_test_native'))
+  rescue Exception
+    @built = false
+  end
+end # NativeExt
+
 class SajTest < Minitest::Test
 
   def setup
@@ -173,6 +206,65 @@ class SajTest < Minitest::Test
                   [:hash_end, nil]], handler.calls)
   end
 
+  def test_escaped
+    handler = AllSaj.new()
+    json = %{{"a\\"b":"x\\ty","c":["\\u00e9\\ud83d\\ude00",12345678901234567890]}}
+    orig = json.dup
+    Oj.saj_parse(handler, json)
+    assert_equal(orig, json)
+    assert_equal([[:hash_start, nil],
+                  [:add_value, "x\ty", 'a"b'],
+                  [:array_start, 'c'],
+                  [:add_value, "\u00e9\u{1f600}", nil],
+                  [:add_value, 12345678901234567890, nil],
+                  [:array_end, 'c'],
+                  [:hash_end, nil]], handler.calls)
+    handler = AllSaj.new()
+    Oj.saj_parse(handler, '["a\\nb"]'.freeze)
+    assert_equal([:add_value, "a\nb", nil], handler.calls[1])
+  end
+
+  def test_io
+    json = %{{"a\\"b" : [1, 2.5, "x\\ny", null], // note
+  "c":{"d":true, "e":12345678901234567890}, "f":"#{'z' * 300}"}}
+    expected = AllSaj.new()
+    Oj.saj_parse(expected, json)
+    [1, 3, 7].each { |n|
+      handler = AllSaj.new()
+      Oj.saj_parse(handler, Trickle.new(json, n))
+      assert_equal(expected.calls, handler.calls)
+    }
+    filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
+    File.open(filename, 'w') { |f| f.write(json) }
+    handler = AllSaj.new()
+    File.open(filename) { |f| Oj.saj_parse(handler, f) }
+    assert_equal(expected.calls, handler.calls)
+    handler = AllSaj.new()
+    assert_raises(Oj::ParseError) { Oj.saj_parse(handler, Trickle.new('[1,2', 2)) }
+    assert_equal(:error, handler.calls.last[0])
+  end
+
+  def test_native
+    skip('the native handler test extension could not be built') unless NativeExt.build
+    json = %{{"a":[1,-2.5,"x\\ny",12345678901234567890,1e3,-Infinity],"b":{"c":null,"d":[]},"e":true,"f":false}}
+    expected = AllSaj.new()
+    Oj.saj_parse(expected, json)
+    events = []
+    Oj.saj_parse(OjTestNative.handler(events), json)
+    assert_equal(expected.calls, events)
+    events = []
+    Oj.saj_parse(OjTestNative.handler(events), Trickle.new(json, 3))
+    assert_equal(expected.calls, events)
+    # container ends the handler does not take are not passed on
+    events = []
+    Oj.saj_parse(OjTestNative.handler(events, false), json)
+    assert_equal(expected.calls.reject { |c| [:hash_end, :array_end].include?(c[0]) }, events)
+    # a native handler has no error() so errors are raised
+    events = []
+    assert_raises(Oj::ParseError) { Oj.saj_parse(OjTestNative.handler(events), '{"a":[1,}') }
+    assert_equal([[:hash_start, nil], [:array_start, 'a'], [:add_value, 1, nil]], events)
+  end
+
   def test_fixnum_bad
     handler = AllSaj.new()
     json = %{12345xyz}
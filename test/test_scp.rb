@@ -91,6 +91,49 @@ class Closer < AllHandler
 
 end # Closer
 
+class InterestHandler < AllHandler
+  def initialize(interest)
+    super()
+    @interest = interest
+  end
+
+  def interest()
+    @interest
+  end
+
+end # InterestHandler
+
+class BatchHandler < Oj::ScHandler
+  attr_accessor :batches
+
+  def initialize()
+    @batches = []
+  end
+
+  def on_events(events)
+    @batches << events
+  end
+
+end # BatchHandler
+
+# Returns at most n characters a read and remembers the largest read asked for.
+class SmallReader
+  attr_reader :max
+
+  def initialize(str, n)
+    @io = StringIO.new(str)
+    @n = n
+    @max = 0
+  end
+
+  def readpartial(max)
+    @max = max if @max < max
+    s = @io.read([max, @n].min)
+    raise EOFError if s.nil?
+    s
+  end
+end # SmallReader
+
 class ScpTest < Minitest::Test
 
   def setup
@@ -289,6 +332,107 @@ class ScpTest < Minitest::Test
     end
   end
 
+  def test_batch
+    handler = BatchHandler.new()
+    json = %{{"a":[1,2.5,"x"],"b":{"c":null},"d":true}}
+    Oj.sc_parse(handler, json, :batch_size => 4)
+    assert_equal([4, 4, 3], handler.batches.map(&:size))
+    assert_equal([[:hash_start, nil],
+                  [:array_start, 'a'],
+                  [:add_value, 1, nil],
+                  [:add_value, 2.5, nil],
+                  [:add_value, 'x', nil],
+                  [:array_end, 'a'],
+                  [:hash_start, 'b'],
+                  [:add_value, nil, 'c'],
+                  [:hash_end, 'b'],
+                  [:add_value, true, 'd'],
+                  [:hash_end, nil]], handler.batches.flatten(1))
+    handler = BatchHandler.new()
+    Oj.sc_parse(handler, StringIO.new(json), :symbol_keys => true)
+    assert_equal(1, handler.batches.size)
+    assert_equal([:array_start, :a], handler.batches[0][1])
+  end
+
+  def test_interest
+    handler = InterestHandler.new(['/array/*/hash/h2/a/2', '/boolean'])
+    Oj.sc_parse(handler, $json)
+    assert_equal([[:hash_start],
+                  [:hash_key, 'array'],
+                  [:array_start],
+                  [:hash_start],
+                  [:hash_key, 'hash'],
+                  [:hash_start],
+                  [:hash_key, 'h2'],
+                  [:hash_start],
+                  [:hash_key, 'a'],
+                  [:array_start],
+                  [:array_append, 2],
+                  [:array_end],
+                  [:hash_set, 'a', []],
+                  [:hash_end],
+                  [:hash_set, 'h2', {}],
+                  [:hash_end],
+                  [:hash_set, 'hash', {}],
+                  [:hash_end],
+                  [:array_append, {}],
+                  [:array_end],
+                  [:hash_set, 'array', []],
+                  [:hash_key, 'boolean'],
+                  [:hash_set, 'boolean', true],
+                  [:hash_end],
+                  [:add_value, {}]], handler.calls)
+  end
+
+  def test_interest_key
+    handler = InterestHandler.new([:h2])
+    Oj.sc_parse(handler, StringIO.new($json))
+    assert_equal([[:hash_start],
+                  [:hash_key, 'array'],
+                  [:array_start],
+                  [:hash_start],
+                  [:hash_key, 'num'],
+                  [:hash_key, 'string'],
+                  [:hash_key, 'hash'],
+                  [:hash_start],
+                  [:hash_key, 'h2'],
+                  [:hash_start],
+                  [:hash_key, 'a'],
+                  [:array_start],
+                  [:array_append, 1],
+                  [:array_append, 2],
+                  [:array_append, 3],
+                  [:array_end],
+                  [:hash_set, 'a', []],
+                  [:hash_end],
+                  [:hash_set, 'h2', {}],
+                  [:hash_end],
+                  [:hash_set, 'hash', {}],
+                  [:hash_end],
+                  [:array_append, {}],
+                  [:array_end],
+                  [:hash_set, 'array', []],
+                  [:hash_key, 'boolean'],
+                  [:hash_end],
+                  [:add_value, {}]], handler.calls)
+    assert_raises(TypeError) { Oj.sc_parse(InterestHandler.new([1]), $json) }
+  end
+
+  def test_native_handler
+    # made by other C extensions only, see native.h
+    assert_raises(TypeError) { Oj::NativeHandler.new }
+  end
+
+  def test_long_read
+    # text already parsed is shifted out so the buffer does not grow
+    json = Oj.dump((1..100000).map { |i| { 'n' => i, 's' => 'x' * 10 } }, :mode => :strict)
+    io = SmallReader.new(json, 1000)
+    handler = AllHandler.new()
+    Oj.sc_parse(handler, io)
+    assert_equal(100000 * 7 + 3, handler.calls.size)
+    assert_operator(io.max, :<=, 0x1000)
+  end
+
   def test_null_string
     handler = AllHandler.new()
     json = %{"\0"}
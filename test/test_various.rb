@@ -302,6 +302,21 @@ class Juice < Minitest::Test
     assert_raises(Oj::ParseError) { Oj.load(json) }
   end
 
+  # each_element
+  def test_each_element
+    json = %{[1,"two",{"three":[3]},[4,[5]]]}
+    results = []
+    Oj.each_element(StringIO.new(json), nil, :mode => :strict) { |x| results << x }
+    assert_equal([1, "two", {"three"=>[3]}, [4,[5]]], results)
+  end
+
+  def test_each_element_path
+    json = %{{"meta":{"items":[0]},"data":{"items":[{"a":1},{"b":[2]},3]}}}
+    results = []
+    Oj.each_element(StringIO.new(json), '/data/items', :mode => :strict) { |x| results << x }
+    assert_equal([{"a"=>1}, {"b"=>[2]}, 3], results)
+  end
+
   # encoding tests
   def test_does_not_escape_entities_by_default
     Oj.default_options = { :escape_mode => :ascii } # set in mimic mode
@@ -346,6 +361,15 @@ class Juice < Minitest::Test
     out = Oj.dump(x)
     assert_equal(json, out)
   end
+  def test_escape_long_string
+    # escapes before, across, and after 8 byte words
+    str = %{"0123456789\\abcdefgh</i>\n12345678é☃ tail\u007f}
+    assert_equal(%{"\\"0123456789\\\\abcdefgh</i>\\n12345678é☃ tail\u007f"}, Oj.dump(str, :escape_mode => :json))
+    assert_equal(%{"\\"0123456789\\\\abcdefgh\\u003c\\/i\\u003e\\n12345678\\u00e9\\u2603 tail\\u007f"}, Oj.dump(str, :escape_mode => :xss_safe))
+    [:json, :newline, :ascii, :xss_safe].each { |mode|
+      assert_equal(str, Oj.load(Oj.dump(str, :escape_mode => mode)), "#{mode} mode")
+    }
+  end
 
   # Symbol
   def test_symbol_strict